@@ -145,4 +145,29 @@ df = pd.DataFrame({'UPPER': ['UPPER', 'CASE', 'DATA'],
 table = pa.Table.from_pandas(df)
 
 with pq.ParquetWriter('column_name/case-sensitive.parquet', table.schema) as writer:
-    writer.write_table(table)
\ No newline at end of file
+    writer.write_table(table)
+# example_pages.parquet file: three row groups of 100 rows with pages of
+# 10 rows and page indexes. Values of 'gap' in the second row group are
+# within 1..10 and 91..100, so only its pages tell that nothing in between
+# is there.
+df = pd.DataFrame({'id': range(1, 301),
+                   'gap': list(range(1, 101)) +
+                          [i % 10 + (1 if i < 50 else 91) for i in range(100)] +
+                          list(range(101, 201))})
+table = pa.Table.from_pandas(df, preserve_index=False)
+
+pq.write_table(table, 'simple/example_pages.parquet', row_group_size=100,
+               max_rows_per_page=10, write_page_index=True)
+
+# example_bloom.parquet file: three row groups of 100 rows with bloom filters
+# on 'code' which holds even numbers in the first row group, odd ones in the
+# second and multiples of 3 in the third, so that min/max statistics of every
+# row group span small values they do not have.
+df = pd.DataFrame({'id': range(1, 301),
+                   'code': [2 * i for i in range(1, 101)] +
+                           [2 * i - 1 for i in range(1, 101)] +
+                           [3 * i for i in range(1, 101)]})
+table = pa.Table.from_pandas(df, preserve_index=False)
+
+pq.write_table(table, 'simple/example_bloom.parquet', row_group_size=100,
+               bloom_filter_options={'code': {'ndv': 100, 'fpp': 0.0001}})
@@ -0,0 +1,6 @@
+CREATE FUNCTION parquet_s3_fdw_block_cache_stats (OUT hits bigint,
+    OUT misses bigint,
+    OUT evictions bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
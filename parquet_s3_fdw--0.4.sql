@@ -58,3 +58,10 @@ CREATE FUNCTION parquet_s3_fdw_disconnect_all ()
 RETURNS bool
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION parquet_s3_fdw_block_cache_stats (OUT hits bigint,
+    OUT misses bigint,
+    OUT evictions bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
@@ -12,28 +12,112 @@
  */
 #include "parquet_s3_fdw.hpp"
 
+#include <algorithm>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+#include "arrow/util/thread_pool.h"
+#include "parquet/file_reader.h"
+#include "parquet/metadata.h"
 
 using namespace std;
 
 #define S3_ALLOCATION_TAG "S3_ALLOCATION_TAG"
 
+/*
+ * Ranges passed to WillNeed() which are closer than S3_COALESCE_HOLE_SIZE
+ * bytes are fetched by a single GET, as long as the merged range does not
+ * exceed S3_COALESCE_RANGE_SIZE bytes. Reading a small hole is much cheaper
+ * than paying for one more S3 round trip.
+ */
+#define S3_COALESCE_HOLE_SIZE	(1024 * 1024)
+#define S3_COALESCE_RANGE_SIZE	(64 * 1024 * 1024)
+
+/*
+ * Number of bytes at the end of the object read by GetSize(). It matches the
+ * amount parquet reads speculatively to get the footer, so opening a file
+ * takes a single request whenever the footer fits in it.
+ */
+#define S3_FOOTER_READ_SIZE		(64 * 1024)
+
+/*
+ * Stream writing the body of a GetObject response straight into a buffer
+ * allocated by the caller, so that the data is not copied around through
+ * intermediate string streams.
+ */
+class S3PreallocatedStream : Aws::Utils::Stream::PreallocatedStreamBuf, public std::iostream
+{
+	public:
+	S3PreallocatedStream(void *data, int64_t nbytes)
+		: Aws::Utils::Stream::PreallocatedStreamBuf(reinterpret_cast<unsigned char *>(data),
+													static_cast<size_t>(nbytes)),
+		  std::iostream(this) {}
+};
+
 /* Implementation of S3RandomAccessFile class methods */
 S3RandomAccessFile::S3RandomAccessFile(Aws::S3::S3Client *s3_client,
-				   const Aws::String &bucket, const Aws::String &object)
-				: bucket_(bucket), object_(object), s3_client_(s3_client) {
+				   const Aws::String &bucket, const Aws::String &object,
+				   int64_t size, const Aws::String &etag)
+				: bucket_(bucket), object_(object), s3_client_(s3_client),
+				  etag_(etag), size_(size) {
+	tail_offset_ = 0;
 	offset = 0;
 	isclosed = false;
 }
 
+/*
+ * Close
+ *		Cancel the background GETs which have not started yet and wait for
+ *		the running ones, so that none of them uses the S3 client once the
+ *		file is closed.
+ */
 arrow::Status
 S3RandomAccessFile::Close() 
 {
-	isclosed = true;
+	std::vector<arrow::Future<std::shared_ptr<arrow::Buffer>>> futures;
+
+	{
+		std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+		prefetch_stop_.RequestStop();
+		DropPrefetched();
+		futures.swap(abandoned_);
+		isclosed = true;
+	}
+
+	/* Wait outside of the lock, the tasks may be serving a ReadAt() */
+	for (auto &future : futures)
+		future.Wait();
+
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	prefetch_stop_.Reset();
 	return arrow::Status::OK();
 }
 
+/*
+ * DropPrefetched
+ *		Forget the ranges requested by WillNeed(). The GETs which are still
+ *		in progress are remembered until they complete. The caller holds
+ *		prefetch_mutex_.
+ */
+void
+S3RandomAccessFile::DropPrefetched()
+{
+	abandoned_.erase(std::remove_if(abandoned_.begin(), abandoned_.end(),
+									[](const arrow::Future<std::shared_ptr<arrow::Buffer>> &f) {
+										return f.is_finished();
+									}),
+					 abandoned_.end());
+
+	for (auto &r : prefetched_)
+	{
+		if (!r.future.is_finished())
+			abandoned_.push_back(r.future);
+	}
+	prefetched_.clear();
+}
+
 arrow::Result<int64_t>
 S3RandomAccessFile::Tell() const
 {
@@ -53,40 +137,264 @@ S3RandomAccessFile::Seek(int64_t position)
 	return arrow::Status::OK();
 }
 
+/*
+ * GetObjectRange
+ *		Read nbytes starting at position from the object into "out" with a
+ *		single ranged GET. It does not touch the file position so that it can
+ *		be called from several threads at once. Once the ETag is known the
+ *		GET is conditional on it, so that the data of a rewritten object is
+ *		never mixed with the footer and cached blocks of the old one.
+ */
 arrow::Result<int64_t>
-S3RandomAccessFile::Read(int64_t nbytes, void* out)
+S3RandomAccessFile::GetObjectRange(int64_t position, int64_t nbytes, void *out)
 {
-	/* Nothing to read, return immediately */
-	if (nbytes < 1)
-		return nbytes;
-
 	Aws::S3::Model::GetObjectRequest object_request;
+	Aws::String	etag;
+
+	{
+		std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+		etag = etag_;
+	}
+
 	object_request.WithBucket(bucket_.c_str()).WithKey(object_.c_str());
-	string bytes = "bytes=" + to_string(offset) + "-" + to_string(offset + nbytes - 1);
+	if (!etag.empty())
+		object_request.SetIfMatch(etag);
+	string bytes = "bytes=" + to_string(position) + "-" + to_string(position + nbytes - 1);
 	object_request.SetRange(bytes.c_str());
 	object_request.SetBucket(this->bucket_);
 	object_request.SetKey(this->object_);
-#if 0
-	object_request.SetResponseStreamFactory([](){
-		return Aws::New<Aws::FStream>(
-			"ALLOCATION_TAG", "DOWNLOADED_FILENAME", std::ios_base::out); });
-#else
-	object_request.SetResponseStreamFactory([](){
-		return Aws::New<Aws::StringStream >(S3_ALLOCATION_TAG); });
-#endif
+	object_request.SetResponseStreamFactory([out, nbytes](){
+		return Aws::New<S3PreallocatedStream>(S3_ALLOCATION_TAG, out, nbytes); });
 
 	Aws::S3::Model::GetObjectOutcome get_object_outcome = this->s3_client_->GetObject(object_request);
 	if (!get_object_outcome.IsSuccess()) {
         auto err = get_object_outcome.GetError();
+        if (err.GetResponseCode() == Aws::Http::HttpResponseCode::PRECONDITION_FAILED)
+            return arrow::Status(arrow::StatusCode::IOError,
+                                 "GetObject failed. The object has changed since it was opened");
         Aws::String msg = "GetObject failed. " + err.GetExceptionName() + ": " + err.GetMessage();
 		return arrow::Status(arrow::StatusCode::IOError, msg.c_str());
 	}
 
+	/* The body has already been written into "out" by the response stream */
 	int64_t n_read = get_object_outcome.GetResult().GetContentLength();
-    offset += n_read;
-	std::stringstream string_stream;
-	string_stream << get_object_outcome.GetResult().GetBody().rdbuf();
-	string_stream.read((char*)out, n_read);
+	if (n_read > nbytes)
+		return arrow::Status(arrow::StatusCode::IOError,
+							 "GetObject returned more data than requested");
+	return n_read;
+}
+
+/*
+ * FetchRangeCached
+ *		Read the range through the local block cache. Blocks found in the
+ *		cache are read from local disk, every run of consecutive missing
+ *		blocks is fetched by a single GET and stored in the cache.
+ */
+arrow::Result<int64_t>
+S3RandomAccessFile::FetchRangeCached(const BlockCacheSettings &cache, const Aws::String &etag,
+									 int64_t position, int64_t nbytes, void *out)
+{
+	int64_t		block_size = cache.block_size;
+	int64_t		first = position / block_size;
+	int64_t		last = (position + nbytes - 1) / block_size;
+	std::string	key = std::string(bucket_.c_str()) + "/" + object_.c_str() +
+					  ":" + etag.c_str();
+	/* One block buffer per thread, reads of a file may run concurrently */
+	static thread_local std::vector<char> block;
+	int64_t		n_read = 0;
+	int64_t		blk = first;
+
+	/* Copy the part of the block overlapping the requested range to "out" */
+	auto copy_block = [&](int64_t blkno, const char *data, int64_t len) {
+		int64_t		block_start = blkno * block_size;
+		int64_t		from = std::max(position, block_start);
+		int64_t		to = std::min(position + nbytes, block_start + len);
+
+		if (to > from)
+		{
+			memcpy((char *) out + (from - position), data + (from - block_start), to - from);
+			n_read = std::max(n_read, to - position);
+		}
+	};
+
+	if ((int64_t) block.size() < block_size)
+		block.resize(block_size);
+
+	while (blk <= last)
+	{
+		int64_t		len;
+		int64_t		run_end;
+		int64_t		got;
+
+		if (parquetBlockCacheRead(cache, key, blk, block.data(), &len))
+		{
+			copy_block(blk, block.data(), len);
+			/* a short block is the last one of the object */
+			if (len < block_size)
+				break;
+			blk++;
+			continue;
+		}
+
+		for (run_end = blk + 1; run_end <= last; run_end++)
+		{
+			if (parquetBlockCacheExists(cache, key, run_end))
+				break;
+		}
+
+		std::vector<char> run((run_end - blk) * block_size);
+		ARROW_ASSIGN_OR_RAISE(got, GetObjectRange(blk * block_size, run.size(), run.data()));
+
+		for (int64_t i = blk; i < run_end; i++)
+		{
+			int64_t		off = (i - blk) * block_size;
+
+			len = std::min(block_size, got - off);
+			if (len <= 0)
+				return n_read;
+
+			parquetBlockCacheWrite(cache, key, i, run.data() + off, len);
+			copy_block(i, run.data() + off, len);
+			if (len < block_size)
+				return n_read;
+		}
+		blk = run_end;
+	}
+
+	return n_read;
+}
+
+/*
+ * FetchRange
+ *		Read the range from the block cache if it is enabled and the object
+ *		version is known, from S3 otherwise.
+ */
+arrow::Result<int64_t>
+S3RandomAccessFile::FetchRange(int64_t position, int64_t nbytes, void *out)
+{
+	std::shared_ptr<const BlockCacheSettings> cache;
+	Aws::String	etag;
+
+	{
+		std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+		cache = block_cache_;
+		etag = etag_;
+	}
+
+	if (cache && !etag.empty())
+		return FetchRangeCached(*cache, etag, position, nbytes, out);
+
+	return GetObjectRange(position, nbytes, out);
+}
+
+/*
+ * SetBlockCache
+ *		Remember the block cache settings for the reads of the file. It is
+ *		called on the backend thread every time the file is used by a scan.
+ */
+void
+S3RandomAccessFile::SetBlockCache(std::shared_ptr<const BlockCacheSettings> cache)
+{
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	block_cache_ = std::move(cache);
+}
+
+arrow::Result<std::shared_ptr<arrow::Buffer>>
+S3RandomAccessFile::FetchBuffer(int64_t position, int64_t nbytes)
+{
+	ARROW_ASSIGN_OR_RAISE(auto buffer, arrow::AllocateResizableBuffer(nbytes));
+	ARROW_ASSIGN_OR_RAISE(int64_t n_read, FetchRange(position, nbytes, buffer->mutable_data()));
+
+	if (n_read < nbytes)
+		ARROW_RETURN_NOT_OK(buffer->Resize(n_read, false));
+	return std::shared_ptr<arrow::Buffer>(std::move(buffer));
+}
+
+/*
+ * ReadTail
+ *		Serve the read from the tail of the object read by GetSize(). The tail
+ *		is released once its end has been read, which is normally the footer
+ *		read done right after opening the file.
+ */
+bool
+S3RandomAccessFile::ReadTail(int64_t position, int64_t nbytes, std::shared_ptr<arrow::Buffer> *out)
+{
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	if (!tail_ || position < tail_offset_ ||
+		position + nbytes > tail_offset_ + tail_->size())
+		return false;
+
+	*out = arrow::SliceBuffer(tail_, position - tail_offset_, nbytes);
+	if (position + nbytes == tail_offset_ + tail_->size())
+		tail_.reset();
+	return true;
+}
+
+/*
+ * ReadPrefetched
+ *		Serve the read from a range requested by WillNeed() if there is one
+ *		covering it. Returns false if the read has to go to S3.
+ */
+bool
+S3RandomAccessFile::ReadPrefetched(int64_t position, int64_t nbytes,
+								   std::shared_ptr<arrow::Buffer> *out, arrow::Status *status)
+{
+	arrow::Future<std::shared_ptr<arrow::Buffer>> future;
+	int64_t		start;
+
+	{
+		std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+		auto it = std::find_if(prefetched_.begin(), prefetched_.end(),
+							   [position, nbytes](const S3PrefetchedRange &r) {
+								   return position >= r.range.offset &&
+										  position + nbytes <= r.range.offset + r.range.length;
+							   });
+		if (it == prefetched_.end())
+			return false;
+
+		future = it->future;
+		start = it->range.offset;
+
+		/* Forget the range as soon as all of it has been handed out */
+		it->consumed += nbytes;
+		if (it->consumed >= it->range.length)
+			prefetched_.erase(it);
+	}
+
+	/* Wait for the background GET outside of the lock */
+	const arrow::Result<std::shared_ptr<arrow::Buffer>> &result = future.result();
+	if (!result.ok())
+	{
+		*status = result.status();
+		return true;
+	}
+
+	std::shared_ptr<arrow::Buffer> buf = *result;
+	int64_t		skip = position - start;
+
+	/* The object may end before the requested range does */
+	if (skip >= buf->size())
+		*out = std::make_shared<arrow::Buffer>((const uint8_t*) NULL, 0);
+	else
+		*out = arrow::SliceBuffer(buf, skip, std::min(nbytes, buf->size() - skip));
+	*status = arrow::Status::OK();
+	return true;
+}
+
+arrow::Result<int64_t>
+S3RandomAccessFile::Read(int64_t nbytes, void* out)
+{
+	/* Nothing to read, return immediately */
+	if (nbytes < 1)
+		return nbytes;
+
+	ARROW_ASSIGN_OR_RAISE(int64_t n_read, ReadAt(offset, nbytes, out));
+	offset += n_read;
 	return n_read;
 }
 
@@ -97,15 +405,191 @@ S3RandomAccessFile::Read(int64_t nbytes)
 	if (nbytes < 1)
 		return std::make_shared<arrow::Buffer>((const uint8_t*) NULL, 0);
 
-	char *out = (char*)malloc(nbytes);
-	arrow::Result<int64_t> res = this->Read(nbytes, out);
-	int64_t n = res.ValueOrDie();
-	std::shared_ptr<arrow::Buffer> buf = make_shared<arrow::Buffer>((const uint8_t*)out, n);
+	/* Return the arrow-owned buffer the object has been read into */
+	ARROW_ASSIGN_OR_RAISE(auto buf, ReadAt(offset, nbytes));
+	offset += buf->size();
 	return buf;
 }
 
+/*
+ * The positional reads do not depend on the file position, so they are safe
+ * to be called concurrently by arrow's I/O and CPU thread pools.
+ */
+arrow::Result<int64_t>
+S3RandomAccessFile::ReadAt(int64_t position, int64_t nbytes, void* out)
+{
+	std::shared_ptr<arrow::Buffer> buf;
+	arrow::Status status;
+
+	/* Nothing to read, return immediately */
+	if (nbytes < 1)
+		return nbytes;
+
+	if (ReadTail(position, nbytes, &buf))
+	{
+		memcpy(out, buf->data(), buf->size());
+		return buf->size();
+	}
+
+	if (ReadPrefetched(position, nbytes, &buf, &status))
+	{
+		ARROW_RETURN_NOT_OK(status);
+		memcpy(out, buf->data(), buf->size());
+		return buf->size();
+	}
+
+	return FetchRange(position, nbytes, out);
+}
+
+arrow::Result<std::shared_ptr<arrow::Buffer>>
+S3RandomAccessFile::ReadAt(int64_t position, int64_t nbytes)
+{
+	std::shared_ptr<arrow::Buffer> buf;
+	arrow::Status status;
+
+	/* Nothing to read, return immediately */
+	if (nbytes < 1)
+		return std::make_shared<arrow::Buffer>((const uint8_t*) NULL, 0);
+
+	if (ReadTail(position, nbytes, &buf))
+		return buf;
+
+	if (ReadPrefetched(position, nbytes, &buf, &status))
+	{
+		ARROW_RETURN_NOT_OK(status);
+		return buf;
+	}
+
+	return FetchBuffer(position, nbytes);
+}
+
+arrow::Future<std::shared_ptr<arrow::Buffer>>
+S3RandomAccessFile::ReadAsync(const arrow::io::IOContext &ctx,
+							  int64_t position, int64_t nbytes)
+{
+	auto self = std::dynamic_pointer_cast<S3RandomAccessFile>(shared_from_this());
+
+	return arrow::DeferNotOk(ctx.executor()->Submit(ctx.stop_token(),
+		[self, position, nbytes]() { return self->ReadAt(position, nbytes); }));
+}
+
+/*
+ * WillNeed
+ *		Start fetching the given ranges in the background. Nearby ranges are
+ *		coalesced the same way arrow::io::internal::ReadRangeCache does it and
+ *		the resulting requests are issued concurrently on arrow's I/O thread
+ *		pool. Subsequent ReadAt() calls covered by one of them wait for it
+ *		instead of sending their own GET.
+ */
+arrow::Status
+S3RandomAccessFile::WillNeed(const std::vector<arrow::io::ReadRange> &ranges)
+{
+	std::vector<arrow::io::ReadRange> sorted;
+	std::vector<arrow::io::ReadRange> coalesced;
+	const arrow::io::IOContext &ctx = arrow::io::default_io_context();
+	auto self = std::dynamic_pointer_cast<S3RandomAccessFile>(shared_from_this());
+
+	for (auto &range : ranges)
+	{
+		if (range.length > 0)
+			sorted.push_back(range);
+	}
+	std::sort(sorted.begin(), sorted.end(),
+			  [](const arrow::io::ReadRange &a, const arrow::io::ReadRange &b) {
+				  return a.offset < b.offset;
+			  });
+
+	for (auto &range : sorted)
+	{
+		if (!coalesced.empty())
+		{
+			arrow::io::ReadRange &last = coalesced.back();
+			int64_t		last_end = last.offset + last.length;
+			int64_t		end = std::max(last_end, range.offset + range.length);
+
+			if (range.offset - last_end <= S3_COALESCE_HOLE_SIZE &&
+				end - last.offset <= S3_COALESCE_RANGE_SIZE)
+			{
+				last.length = end - last.offset;
+				continue;
+			}
+		}
+		coalesced.push_back(range);
+	}
+
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	/* Whatever has not been read from the previous hint is not needed anymore */
+	DropPrefetched();
+	for (auto &range : coalesced)
+	{
+		auto future = arrow::DeferNotOk(ctx.executor()->Submit(prefetch_stop_.token(),
+			[self, range]() { return self->FetchBuffer(range.offset, range.length); }));
+
+		prefetched_.push_back({range, std::move(future), 0});
+	}
+
+	return arrow::Status::OK();
+}
+
+/*
+ * GetSize
+ *		Return the size of the object. Unless it is already known from listing,
+ *		the last S3_FOOTER_READ_SIZE bytes of the object are read with a suffix
+ *		range GET. The response tells the object size and ETag, and the data is
+ *		kept to serve the footer read which parquet does right after this.
+ */
 arrow::Result<int64_t>
 S3RandomAccessFile::GetSize()
+{
+	/* The object is not expected to change while the file is open */
+	if (size_ >= 0)
+		return size_;
+
+	ARROW_ASSIGN_OR_RAISE(auto buffer, arrow::AllocateResizableBuffer(S3_FOOTER_READ_SIZE));
+
+	Aws::S3::Model::GetObjectRequest object_request;
+	object_request.SetBucket(this->bucket_);
+	object_request.SetKey(this->object_);
+	string bytes = "bytes=-" + to_string(S3_FOOTER_READ_SIZE);
+	object_request.SetRange(bytes.c_str());
+	uint8_t *data = buffer->mutable_data();
+	object_request.SetResponseStreamFactory([data](){
+		return Aws::New<S3PreallocatedStream>(S3_ALLOCATION_TAG, data, S3_FOOTER_READ_SIZE); });
+
+	Aws::S3::Model::GetObjectOutcome outcome = this->s3_client_->GetObject(object_request);
+
+	/* Empty objects cannot satisfy a range request, ask for the size then */
+	if (!outcome.IsSuccess())
+		return HeadObjectSize();
+
+	/* Content-Range looks like "bytes 1000-66535/66536" */
+	const Aws::String &range = outcome.GetResult().GetContentRange();
+	size_t		slash = range.rfind('/');
+	int64_t		n_read = outcome.GetResult().GetContentLength();
+	char	   *end;
+	long long	total;
+
+	if (slash == Aws::String::npos)
+		return HeadObjectSize();
+	total = strtoll(range.c_str() + slash + 1, &end, 10);
+	if (*end != '\0' || total < n_read || n_read > S3_FOOTER_READ_SIZE)
+		return HeadObjectSize();
+
+	ARROW_RETURN_NOT_OK(buffer->Resize(n_read, false));
+
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	/* The ETag identifies the version of the object in the block cache */
+	etag_ = outcome.GetResult().GetETag();
+	size_ = total;
+	tail_ = std::shared_ptr<arrow::Buffer>(std::move(buffer));
+	tail_offset_ = size_ - n_read;
+	return size_;
+}
+
+arrow::Result<int64_t>
+S3RandomAccessFile::HeadObjectSize()
 {
 	Aws::S3::Model::HeadObjectRequest headObj;
 	headObj.SetBucket(bucket_);
@@ -116,6 +600,117 @@ S3RandomAccessFile::GetSize()
 		return arrow::Status(arrow::StatusCode::IOError, "HeadObject failed");
 	}
 
-	int64_t fileSize = object.GetResultWithOwnership().GetContentLength();
-	return fileSize;
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	/* The ETag identifies the version of the object in the block cache */
+	etag_ = object.GetResult().GetETag();
+
+	size_ = object.GetResult().GetContentLength();
+	return size_;
+}
+
+/*
+ * ETag
+ *		ETag of the object, empty if it is not known yet.
+ */
+Aws::String
+S3RandomAccessFile::ETag()
+{
+	std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+	return etag_;
+}
+
+/*
+ * parquetWillNeedRowGroup
+ *		Let the S3 file behind a cached reader know which column chunks of the
+ *		row group are about to be read, so that they are fetched by a few
+ *		concurrent requests instead of one blocking GET per column.
+ */
+void
+parquetWillNeedRowGroup(ReaderCacheEntry *entry, parquet::arrow::FileReader *reader,
+						int rowgroup, const std::vector<int> &columns)
+{
+	std::vector<arrow::io::ReadRange> ranges;
+
+	if (entry == NULL || entry->file_reader == NULL || !entry->file_reader->file)
+		return;
+
+	auto rowgroup_meta = reader->parquet_reader()->metadata()->RowGroup(rowgroup);
+
+	for (int col : columns)
+	{
+		if (col < 0 || col >= rowgroup_meta->num_columns())
+			continue;
+
+		auto	chunk = rowgroup_meta->ColumnChunk(col);
+		int64_t	start = chunk->data_page_offset();
+
+		if (chunk->has_dictionary_page() &&
+			chunk->dictionary_page_offset() > 0 &&
+			chunk->dictionary_page_offset() < start)
+			start = chunk->dictionary_page_offset();
+
+		ranges.push_back({start, chunk->total_compressed_size()});
+	}
+
+	/* It is only a hint, reads fall back to plain GETs if the prefetch fails */
+	(void) entry->file_reader->file->WillNeed(ranges);
+}
+
+/*
+ * parquetDictionaryReaderProperties
+ *		Arrow reader properties asking to read top-level string and binary
+ *		columns as dictionary arrays, so that a value shared by many rows is
+ *		converted only once. Nested columns are left alone, list and map
+ *		conversions expect plain arrays.
+ */
+parquet::ArrowReaderProperties
+parquetDictionaryReaderProperties(const parquet::SchemaDescriptor *schema)
+{
+	parquet::ArrowReaderProperties props;
+
+	for (int i = 0; i < schema->num_columns(); i++)
+	{
+		const parquet::ColumnDescriptor *col = schema->Column(i);
+
+		if (col->physical_type() == parquet::Type::BYTE_ARRAY &&
+			col->path()->ToDotVector().size() == 1)
+			props.set_read_dictionary(i, true);
+	}
+	return props;
+}
+
+/*
+ * parquetMakeDictionaryReader
+ *		Create an arrow reader of the file with parquetDictionaryReaderProperties.
+ *		The footer is taken from the caller so that no I/O is done. Returns
+ *		nullptr if the reader cannot be created.
+ */
+std::unique_ptr<parquet::arrow::FileReader>
+parquetMakeDictionaryReader(std::shared_ptr<arrow::io::RandomAccessFile> file,
+							std::shared_ptr<parquet::FileMetaData> metadata)
+{
+	std::unique_ptr<parquet::arrow::FileReader> reader;
+
+	if (!file || !metadata)
+		return nullptr;
+
+	try
+	{
+		auto props = parquetDictionaryReaderProperties(metadata->schema());
+		auto parquet_reader = parquet::ParquetFileReader::Open(file,
+															   parquet::default_reader_properties(),
+															   metadata);
+
+		if (!parquet::arrow::FileReader::Make(arrow::default_memory_pool(),
+											  std::move(parquet_reader),
+											  props, &reader).ok())
+			return nullptr;
+	}
+	catch (const std::exception &)
+	{
+		return nullptr;
+	}
+	return reader;
 }
@@ -15,8 +15,15 @@
 
 #include <aws/core/Aws.h>
 #include <aws/s3/S3Client.h>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "arrow/api.h"
+#include "arrow/io/interfaces.h"
+#include "arrow/util/cancel.h"
+#include "arrow/util/future.h"
 #include <parquet/arrow/reader.h>
+#include <parquet/file_reader.h>
 
 extern "C"
 {
@@ -25,18 +32,70 @@ extern "C"
 #include "parquet_s3_fdw.h"
 }
 
+/*
+ * Settings of the local block cache. The GUCs are copied on the backend
+ * thread, the cache is used from arrow's I/O threads.
+ */
+typedef struct BlockCacheSettings
+{
+	std::string dir;
+	int64_t block_size;
+	int64_t capacity;
+} BlockCacheSettings;
+
+/*
+ * Range of the object which has been requested in advance by WillNeed().
+ * "consumed" counts the bytes already handed out by ReadAt() so that the
+ * buffer can be released as soon as the reader is done with it.
+ */
+typedef struct S3PrefetchedRange
+{
+	arrow::io::ReadRange range;
+	arrow::Future<std::shared_ptr<arrow::Buffer>> future;
+	int64_t consumed;
+} S3PrefetchedRange;
+
 class S3RandomAccessFile : public arrow::io::RandomAccessFile
 {
 	private:
 	Aws::String bucket_;
 	Aws::String object_;
 	Aws::S3::S3Client *s3_client_;
+	Aws::String etag_;
+	int64_t size_;
 	int64_t offset;
 	bool isclosed;
 
+	/* ranges fetched in the background, protected by prefetch_mutex_ */
+	std::mutex prefetch_mutex_;
+	std::vector<S3PrefetchedRange> prefetched_;
+	/* GETs of dropped ranges which may still be using s3_client_ */
+	std::vector<arrow::Future<std::shared_ptr<arrow::Buffer>>> abandoned_;
+	arrow::StopSource prefetch_stop_;
+
+	/* block cache settings, nullptr if disabled, protected by prefetch_mutex_ */
+	std::shared_ptr<const BlockCacheSettings> block_cache_;
+
+	/* tail of the object read by GetSize(), protected by prefetch_mutex_ */
+	std::shared_ptr<arrow::Buffer> tail_;
+	int64_t tail_offset_;
+
+	bool ReadTail(int64_t position, int64_t nbytes, std::shared_ptr<arrow::Buffer> *out);
+	void DropPrefetched();
+	arrow::Result<int64_t> HeadObjectSize();
+
+	arrow::Result<int64_t> GetObjectRange(int64_t position, int64_t nbytes, void *out);
+	arrow::Result<int64_t> FetchRangeCached(const BlockCacheSettings &cache, const Aws::String &etag,
+											int64_t position, int64_t nbytes, void *out);
+	arrow::Result<int64_t> FetchRange(int64_t position, int64_t nbytes, void *out);
+	arrow::Result<std::shared_ptr<arrow::Buffer>> FetchBuffer(int64_t position, int64_t nbytes);
+	bool ReadPrefetched(int64_t position, int64_t nbytes,
+						std::shared_ptr<arrow::Buffer> *out, arrow::Status *status);
+
 	public:
 	S3RandomAccessFile(Aws::S3::S3Client *s3_client,
-					   const Aws::String &bucket, const Aws::String &object);
+					   const Aws::String &bucket, const Aws::String &object,
+					   int64_t size = -1, const Aws::String &etag = "");
 
 	arrow::Status Close();
 	arrow::Result<int64_t>Tell() const;
@@ -44,7 +103,14 @@ class S3RandomAccessFile : public arrow::io::RandomAccessFile
 	arrow::Status Seek(int64_t position);
 	arrow::Result<int64_t> Read(int64_t nbytes, void* out);
 	arrow::Result<std::shared_ptr<arrow::Buffer>> Read(int64_t nbytes);
+	arrow::Result<int64_t> ReadAt(int64_t position, int64_t nbytes, void* out);
+	arrow::Result<std::shared_ptr<arrow::Buffer>> ReadAt(int64_t position, int64_t nbytes);
+	arrow::Future<std::shared_ptr<arrow::Buffer>> ReadAsync(const arrow::io::IOContext &ctx,
+															int64_t position, int64_t nbytes);
+	arrow::Status WillNeed(const std::vector<arrow::io::ReadRange> &ranges);
 	arrow::Result<int64_t> GetSize();
+	Aws::String ETag();
+	void SetBlockCache(std::shared_ptr<const BlockCacheSettings> cache);
 };
 
 typedef enum FileLocation_t
@@ -65,6 +131,7 @@ class FileReaderCache
 {
 	public:
 		std::unique_ptr<parquet::arrow::FileReader> reader;
+		std::shared_ptr<arrow::io::RandomAccessFile> file;
 };
 
 typedef struct ReaderCacheKey
@@ -94,13 +161,40 @@ extern void parquetSplitS3Path(const char *dirname, const char *filename, char *
 extern bool parquetIsS3Filenames(List *filenames);
 extern List *parquetImportForeignSchemaS3(ImportForeignSchemaStmt *stmt, Oid serverOid);
 extern List *parquetExtractParquetFields(List *fields, char **paths, const char *servername) noexcept;
+extern void parquetRegisterS3ObjectInfo(const char *dname, const char *fname, int64 size, const char *etag);
+extern bool parquetLookupS3ObjectInfo(const char *dname, const char *fname, int64 *size, char **etag);
+extern void parquetForgetS3ObjectInfo(const char *dname, const char *fname);
 extern ReaderCacheEntry *parquetGetFileReader(Aws::S3::S3Client *s3client, char *dname, char *fname);
+extern void parquetWillNeedRowGroup(ReaderCacheEntry *entry, parquet::arrow::FileReader *reader,
+									int rowgroup, const std::vector<int> &columns);
+extern parquet::ArrowReaderProperties parquetDictionaryReaderProperties(const parquet::SchemaDescriptor *schema);
+extern std::unique_ptr<parquet::arrow::FileReader> parquetMakeDictionaryReader(std::shared_ptr<arrow::io::RandomAccessFile> file,
+																			   std::shared_ptr<parquet::FileMetaData> metadata);
 extern void parquet_disconnect_s3_server();
 extern bool parquet_upload_file_to_s3(const char *dirname, Aws::S3::S3Client *s3_client, const char *filename, const char *local_file);
 extern bool parquet_delete_object(const char *dirname, const char *filename, const Aws::S3::S3Client *s3_client);
 extern bool parquet_is_object_exist(const char *dirname, const char *filename, const Aws::S3::S3Client *s3_client);
 extern void parquetDeleteFile(const char *dirname, List *filenames, UserMapping *user, bool use_minio);
 
+/* Shared memory cache of Parquet footers */
+extern std::shared_ptr<parquet::FileMetaData> parquetMetadataCacheLookup(const std::string &identity);
+extern void parquetMetadataCacheStore(const std::string &identity,
+									  const std::shared_ptr<parquet::FileMetaData> &metadata);
+extern std::unique_ptr<parquet::ParquetFileReader> parquetOpenLocalFile(const std::string &filename,
+																		bool use_mmap);
+extern std::unique_ptr<parquet::ParquetFileReader> parquetOpenS3File(const std::shared_ptr<S3RandomAccessFile> &input,
+																	 const char *dname, const char *fname);
+
+/* Local block cache of S3 objects */
+extern std::shared_ptr<const BlockCacheSettings> parquetBlockCacheSettings(void);
+extern bool parquetBlockCacheRead(const BlockCacheSettings &cache, const std::string &key,
+								  int64_t block, void *buf, int64_t *len);
+extern bool parquetBlockCacheExists(const BlockCacheSettings &cache, const std::string &key,
+									int64_t block);
+extern void parquetBlockCacheWrite(const BlockCacheSettings &cache, const std::string &key,
+								   int64_t block, const void *buf, int64_t len);
+extern void parquetBlockCacheShutdown(void);
+
 extern char *get_selected_file_from_userfunc(char *funcname, TupleTableSlot *slot, const char *dirname);
 
 #define IS_S3_PATH(str) (str != NULL && strncmp(str, "s3://", 5) == 0)
@@ -0,0 +1,452 @@
+/*-------------------------------------------------------------------------
+ *
+ * parquet_s3_fdw_block_cache.cpp
+ *		  Local on-disk cache of S3 object blocks for parquet_s3_fdw
+ *
+ * Objects are cached in fixed size blocks. A block is identified by the
+ * bucket, key and ETag of the object plus the block number, so a modified
+ * object never hits stale blocks. Every block lives in its own file, which
+ * is written under a temporary name and renamed into place, so that any
+ * number of backends may fill and read the cache concurrently. The cache is
+ * bounded by parquet_s3_fdw.block_cache_size; least recently used blocks
+ * (by file modification time, which is refreshed on every hit) are evicted
+ * once it is exceeded.
+ *
+ * These functions are called from arrow's I/O threads, so they must not use
+ * any PostgreSQL facility which is not thread safe (palloc, elog, ...). The
+ * GUCs are not read there either as the backend may reassign them meanwhile;
+ * the files get a copy of them made by parquetBlockCacheSettings().
+ * Eviction runs on a thread of its own so that reads do not wait for the
+ * directory scan; the backend joins it on exit so that it never outlives
+ * the process shutdown.
+ *
+ * Portions Copyright (c) 2020, TOSHIBA CORPORATION
+ *
+ * IDENTIFICATION
+ *		  contrib/parquet_s3_fdw/parquet_s3_fdw_block_cache.cpp
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "parquet_s3_fdw.hpp"
+
+extern "C"
+{
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "common/hashfn.h"
+#include "funcapi.h"
+#include "utils/builtins.h"
+}
+
+/* GUC variables */
+char	   *parquet_s3_block_cache_dir = NULL;
+int			parquet_s3_block_cache_block_size = 1024;	/* kB */
+int			parquet_s3_block_cache_size = 1024;		/* MB */
+
+/* Statistics of the current backend */
+static std::atomic<uint64_t> block_cache_hits(0);
+static std::atomic<uint64_t> block_cache_misses(0);
+static std::atomic<uint64_t> block_cache_evictions(0);
+
+/* Bytes written since the last eviction pass */
+static std::atomic<int64_t> block_cache_written(0);
+
+/* Whether an eviction thread of this process is running */
+static std::atomic<bool> block_cache_evicting(false);
+
+/* The last eviction thread started, protected by block_cache_evictor_mutex */
+static std::thread block_cache_evictor;
+static std::mutex block_cache_evictor_mutex;
+
+/* Used to make the names of temporary files unique within the process */
+static std::atomic<uint64_t> block_cache_tmp_counter(0);
+
+/* Name of the lock file serializing eviction passes */
+#define BLOCK_CACHE_EVICT_LOCK		"evict.lock"
+
+/* Temporary files older than this are leftovers of crashed writers */
+#define BLOCK_CACHE_STALE_TMP_SECS	600
+
+extern "C"
+{
+PG_FUNCTION_INFO_V1(parquet_s3_fdw_block_cache_stats);
+}
+
+/*
+ * parquetBlockCacheSettings
+ *		Copy of the block cache GUCs, or nullptr if the cache is disabled,
+ *		that is parquet_s3_fdw.block_cache_dir is not set or the capacity is
+ *		zero. Called on the backend thread.
+ */
+std::shared_ptr<const BlockCacheSettings>
+parquetBlockCacheSettings(void)
+{
+	std::shared_ptr<BlockCacheSettings> settings;
+
+	if (parquet_s3_block_cache_dir == NULL ||
+		parquet_s3_block_cache_dir[0] == '\0' ||
+		parquet_s3_block_cache_size <= 0)
+		return nullptr;
+
+	settings = std::make_shared<BlockCacheSettings>();
+	settings->dir = parquet_s3_block_cache_dir;
+	settings->block_size = (int64_t) parquet_s3_block_cache_block_size * 1024;
+	settings->capacity = (int64_t) parquet_s3_block_cache_size * 1024 * 1024;
+	return settings;
+}
+
+/*
+ * block_cache_path
+ *		Path of the file holding the given block. Block size is a part of the
+ *		identity so that changing it does not mix blocks of different sizes.
+ *		Files are spread over 256 subdirectories to keep directories small.
+ */
+static std::string
+block_cache_path(const BlockCacheSettings &cache, const std::string &key,
+				 int64_t block, std::string *subdir)
+{
+	std::string	id = key + ":" + std::to_string(cache.block_size) +
+					 ":" + std::to_string(block);
+	uint64		h1 = hash_bytes_extended((const unsigned char *) id.data(), id.size(), 0);
+	uint64		h2 = hash_bytes_extended((const unsigned char *) id.data(), id.size(), 0x5bd1e995);
+	char		name[40];
+
+	snprintf(name, sizeof(name), "%016llx%016llx",
+			 (unsigned long long) h1, (unsigned long long) h2);
+
+	*subdir = cache.dir + "/" + std::string(name, 2);
+	return *subdir + "/" + name;
+}
+
+/*
+ * Block files start with the full identity of the block, which is verified
+ * on read, so that a hash collision can never return wrong data.
+ */
+static std::string
+block_cache_header(const BlockCacheSettings &cache, const std::string &key,
+				   int64_t block)
+{
+	return key + ":" + std::to_string(cache.block_size) +
+		   ":" + std::to_string(block) + "\n";
+}
+
+static bool
+read_fully(int fd, char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t		n = read(fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool
+write_fully(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t		n = write(fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+/*
+ * parquetBlockCacheRead
+ *		Copy the cached block into buf, which must be able to hold a whole
+ *		block. Returns false if the block is not cached. The length of the
+ *		block is returned in *len, it is less than the block size only for
+ *		the last block of an object.
+ */
+bool
+parquetBlockCacheRead(const BlockCacheSettings &cache, const std::string &key,
+					  int64_t block, void *buf, int64_t *len)
+{
+	std::string	subdir;
+	std::string	path = block_cache_path(cache, key, block, &subdir);
+	std::string	expected = block_cache_header(cache, key, block);
+	std::string	header(expected.size(), '\0');
+	struct stat	st;
+	int			fd;
+	bool		ok;
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		block_cache_misses++;
+		return false;
+	}
+
+	ok = fstat(fd, &st) == 0 &&
+		 st.st_size >= (off_t) header.size() &&
+		 st.st_size - (off_t) header.size() <= cache.block_size &&
+		 read_fully(fd, &header[0], header.size()) &&
+		 header == expected;
+
+	if (ok)
+	{
+		*len = st.st_size - header.size();
+		ok = read_fully(fd, (char *) buf, *len);
+	}
+	close(fd);
+
+	if (!ok)
+	{
+		block_cache_misses++;
+		return false;
+	}
+
+	/* Refresh modification time, it is what LRU eviction looks at */
+	(void) utimensat(AT_FDCWD, path.c_str(), NULL, 0);
+	block_cache_hits++;
+	return true;
+}
+
+/*
+ * parquetBlockCacheExists
+ *		Cheap check whether the block is cached, used to decide how many
+ *		consecutive missing blocks can be fetched by a single request.
+ */
+bool
+parquetBlockCacheExists(const BlockCacheSettings &cache, const std::string &key,
+						int64_t block)
+{
+	std::string	subdir;
+	std::string	path = block_cache_path(cache, key, block, &subdir);
+
+	return access(path.c_str(), R_OK) == 0;
+}
+
+struct BlockCacheFile
+{
+	std::string	path;
+	time_t		mtime;
+	off_t		size;
+};
+
+/*
+ * block_cache_evict
+ *		Scan the cache directory and remove least recently used blocks until
+ *		the cache is back under 90% of its capacity. Only one process at a
+ *		time does this, the others just skip it.
+ */
+static void
+block_cache_evict(const BlockCacheSettings &cache)
+{
+	const std::string &dir = cache.dir;
+	std::string	lockpath = dir + "/" + BLOCK_CACHE_EVICT_LOCK;
+	std::vector<BlockCacheFile> files;
+	int64_t		total = 0;
+	int64_t		target = cache.capacity / 10 * 9;
+	time_t		now = time(NULL);
+	DIR		   *top;
+	struct dirent *de;
+	int			lockfd;
+
+	lockfd = open(lockpath.c_str(), O_CREAT | O_RDWR, 0600);
+	if (lockfd < 0)
+		return;
+	if (flock(lockfd, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(lockfd);
+		return;
+	}
+
+	if ((top = opendir(dir.c_str())) != NULL)
+	{
+		while ((de = readdir(top)) != NULL)
+		{
+			std::string	subdir = dir + "/" + de->d_name;
+			DIR		   *sub;
+			struct dirent *fe;
+
+			if (strlen(de->d_name) != 2)
+				continue;
+			if ((sub = opendir(subdir.c_str())) == NULL)
+				continue;
+
+			while ((fe = readdir(sub)) != NULL)
+			{
+				std::string	path = subdir + "/" + fe->d_name;
+				struct stat	st;
+
+				if (fe->d_name[0] == '.' || stat(path.c_str(), &st) != 0 ||
+					!S_ISREG(st.st_mode))
+					continue;
+
+				if (strstr(fe->d_name, ".tmp") != NULL)
+				{
+					if (now - st.st_mtime > BLOCK_CACHE_STALE_TMP_SECS)
+						(void) unlink(path.c_str());
+					continue;
+				}
+
+				files.push_back({path, st.st_mtime, st.st_size});
+				total += st.st_size;
+			}
+			closedir(sub);
+		}
+		closedir(top);
+	}
+
+	if (total > target)
+	{
+		std::sort(files.begin(), files.end(),
+				  [](const BlockCacheFile &a, const BlockCacheFile &b) {
+					  return a.mtime < b.mtime;
+				  });
+
+		for (auto &file : files)
+		{
+			if (total <= target)
+				break;
+			if (unlink(file.path.c_str()) == 0)
+			{
+				total -= file.size;
+				block_cache_evictions++;
+			}
+		}
+	}
+
+	flock(lockfd, LOCK_UN);
+	close(lockfd);
+}
+
+/*
+ * block_cache_start_eviction
+ *		Run an eviction pass in the background unless one is running already.
+ */
+static void
+block_cache_start_eviction(const BlockCacheSettings &cache)
+{
+	std::lock_guard<std::mutex> lock(block_cache_evictor_mutex);
+
+	if (block_cache_evicting.exchange(true))
+		return;
+
+	try
+	{
+		/* The previous pass has finished, only its handle is left */
+		if (block_cache_evictor.joinable())
+			block_cache_evictor.join();
+
+		block_cache_evictor = std::thread([cache]() {
+			block_cache_evict(cache);
+			block_cache_evicting = false;
+		});
+	}
+	catch (const std::exception &)
+	{
+		/* Try again after the next sixteenth of the capacity is written */
+		block_cache_evicting = false;
+	}
+}
+
+/*
+ * parquetBlockCacheShutdown
+ *		Wait for the eviction thread, if any. Called at process exit so that
+ *		no thread removes cache files or holds the eviction lock after the
+ *		backend has gone.
+ */
+void
+parquetBlockCacheShutdown(void)
+{
+	std::lock_guard<std::mutex> lock(block_cache_evictor_mutex);
+
+	if (block_cache_evictor.joinable())
+		block_cache_evictor.join();
+}
+
+/*
+ * parquetBlockCacheWrite
+ *		Store the block in the cache. The cache is best effort, so any failure
+ *		just leaves the block uncached.
+ */
+void
+parquetBlockCacheWrite(const BlockCacheSettings &cache, const std::string &key,
+					   int64_t block, const void *buf, int64_t len)
+{
+	std::string	subdir;
+	std::string	path = block_cache_path(cache, key, block, &subdir);
+	std::string	header = block_cache_header(cache, key, block);
+	std::string	tmppath = path + ".tmp." + std::to_string(getpid()) + "." +
+						  std::to_string(block_cache_tmp_counter++);
+	int			fd;
+	bool		ok;
+
+	(void) mkdir(cache.dir.c_str(), 0700);
+	(void) mkdir(subdir.c_str(), 0700);
+
+	fd = open(tmppath.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+	if (fd < 0)
+		return;
+
+	ok = write_fully(fd, header.data(), header.size()) &&
+		 write_fully(fd, (const char *) buf, len);
+	ok = (close(fd) == 0) && ok;
+
+	/* rename() atomically replaces whatever another backend has put there */
+	if (!ok || rename(tmppath.c_str(), path.c_str()) != 0)
+	{
+		(void) unlink(tmppath.c_str());
+		return;
+	}
+
+	/* Check the cache size every time a sixteenth of the capacity is written */
+	if ((block_cache_written += len + header.size()) > cache.capacity / 16)
+	{
+		block_cache_written = 0;
+		block_cache_start_eviction(cache);
+	}
+}
+
+/*
+ * parquet_s3_fdw_block_cache_stats
+ *		Return block cache hits, misses and evictions of the current backend.
+ */
+extern "C"
+{
+Datum
+parquet_s3_fdw_block_cache_stats(PG_FUNCTION_ARGS)
+{
+#define PARQUET_S3_FDW_BLOCK_CACHE_STATS_COLS	3
+	TupleDesc	tupdesc;
+	Datum		values[PARQUET_S3_FDW_BLOCK_CACHE_STATS_COLS];
+	bool		nulls[PARQUET_S3_FDW_BLOCK_CACHE_STATS_COLS];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "parquet_s3_fdw: return type must be a row type");
+
+	MemSet(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum((int64) block_cache_hits.load());
+	values[1] = Int64GetDatum((int64) block_cache_misses.load());
+	values[2] = Int64GetDatum((int64) block_cache_evictions.load());
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+}
@@ -14,13 +14,18 @@
 #include <aws/core/auth/AWSAuthSigner.h>
 #include <aws/core/Aws.h>
 #include <aws/s3/S3Client.h>
-#include <aws/s3/model/ListObjectsRequest.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/PutObjectRequest.h>
 #include <aws/s3/model/DeleteObjectRequest.h>
 #include <aws/s3/model/HeadObjectRequest.h>
 #include <aws/s3/model/HeadBucketRequest.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <mutex>
+#include <thread>
 #include <dirent.h>
 #include <sys/stat.h>
 #include "parquet_s3_fdw.hpp"
@@ -48,11 +53,32 @@ extern "C"
 
 static Aws::SDKOptions *aws_sdk_options;
 
+/* GUC variable */
+int			parquet_s3_list_concurrency = 8;
+
 /*
  * Connection cache (initialized on first use)
  */
 static HTAB *FileReaderHash = NULL;
 
+/*
+ * Sizes and ETags of S3 objects learned from listing, so that opening an
+ * object right after it has been listed does not need to ask S3 for them.
+ * An entry is only trusted by the statement which listed the object: the
+ * object may be rewritten at any time, and a cached plan or a parallel worker
+ * does not list the objects again. The table lives in TopTransactionContext
+ * and is forgotten at the end of the transaction.
+ */
+static HTAB *ObjectInfoHash = NULL;
+
+typedef struct ObjectInfoEntry
+{
+	ReaderCacheKey key;			/* hash key (must be first) */
+	TimestampTz	listed;			/* start of the statement which listed it */
+	int64		size;
+	char		etag[128];
+} ObjectInfoEntry;
+
 struct Error : std::exception
 {
     char text[1000];
@@ -123,8 +149,10 @@ static void make_new_connection(ConnCacheEntry *entry, UserMapping *user, bool u
 static bool disconnect_cached_connections(Oid serverid);
 static Aws::S3::S3Client *create_s3_connection(ForeignServer *server, UserMapping *user, bool use_minio);
 static void close_s3_connection(ConnCacheEntry *entry);
+static void wait_cached_file_reads(void);
 static void check_conn_params(const char **keywords, const char **values, UserMapping *user);
 static void parquet_fdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
+static void object_info_reset_callback(void *arg);
 static Aws::S3::S3Client* s3_client_open(const char *user, const char *password, bool use_minio, const char *endpoint, const char *awsRegion);
 static void s3_client_close(Aws::S3::S3Client *s3_client);
 
@@ -138,6 +166,8 @@ parquet_s3_init()
 extern "C" void
 parquet_s3_shutdown()
 {
+	/* The eviction thread must not outlive the backend */
+	parquetBlockCacheShutdown();
 	Aws::ShutdownAPI(*aws_sdk_options);
     aws_sdk_options = NULL;
 }
@@ -410,11 +440,37 @@ close_s3_connection(ConnCacheEntry *entry)
 {
 	if (entry->conn != NULL)
 	{
+		/* Background reads of the cached files may still use the client */
+		wait_cached_file_reads();
 		s3_client_close(entry->conn);
 		entry->conn = NULL;
 	}
 }
 
+/*
+ * wait_cached_file_reads
+ *		Close the files of the reader cache, which cancels the reads they have
+ *		started in the background and waits for the ones in progress. The files
+ *		stay usable, they only do not keep requests going behind the back of
+ *		the S3 client.
+ */
+static void
+wait_cached_file_reads(void)
+{
+	HASH_SEQ_STATUS scan;
+	ReaderCacheEntry *entry;
+
+	if (FileReaderHash == NULL)
+		return;
+
+	hash_seq_init(&scan, FileReaderHash);
+	while ((entry = (ReaderCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->file_reader != NULL && entry->file_reader->file)
+			(void) entry->file_reader->file->Close();
+	}
+}
+
 /*
  * Password is required to connect to S3.
  */
@@ -556,15 +612,152 @@ parquetGetConnectionByTableid(Oid foreigntableid, Oid userid)
     return s3client;
 }
 
+/*
+ * Object found by the S3 listing. Listing threads must not palloc, so keys
+ * are collected in this form and converted into a List afterwards.
+ */
+struct S3ListedObject
+{
+    Aws::String key;
+    int64       size;
+    Aws::String etag;
+};
+
+/*
+ * Shared state of the listing threads: a queue of prefixes to be listed and
+ * the objects found so far.
+ */
+struct S3ListState
+{
+    Aws::S3::S3Client          *s3_client;
+    Aws::String                 bucket;
+    std::mutex                  mutex;
+    std::condition_variable     cond;
+    std::deque<Aws::String>     prefixes;
+    int                         active = 0;
+    bool                        failed = false;
+    std::string                 error;
+    std::vector<S3ListedObject> objects;
+};
+
+/*
+ * s3_list_prefix
+ *      List all objects directly under the prefix, following continuation
+ *      tokens. Deeper levels are returned as common prefixes so that they can
+ *      be listed concurrently.
+ */
+static bool
+s3_list_prefix(S3ListState *state, const Aws::String &prefix,
+               std::vector<S3ListedObject> &objects,
+               std::vector<Aws::String> &subprefixes,
+               std::string &error)
+{
+    Aws::S3::Model::ListObjectsV2Request request;
+
+    request.SetBucket(state->bucket);
+    request.SetPrefix(prefix);
+    request.SetDelimiter("/");
+
+    while (true)
+    {
+        auto outcome = state->s3_client->ListObjectsV2(request);
+
+        if (!outcome.IsSuccess())
+        {
+            error = outcome.GetError().GetMessage().c_str();
+            return false;
+        }
+
+        const auto &result = outcome.GetResult();
+
+        for (const auto &object : result.GetContents())
+            objects.push_back({object.GetKey(), object.GetSize(), object.GetETag()});
+        for (const auto &common : result.GetCommonPrefixes())
+            subprefixes.push_back(common.GetPrefix());
+
+        if (!result.GetIsTruncated() || result.GetNextContinuationToken().empty())
+            break;
+        request.SetContinuationToken(result.GetNextContinuationToken());
+    }
+    return true;
+}
+
+static void
+s3_list_worker(S3ListState *state)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+
+    while (true)
+    {
+        std::vector<S3ListedObject> objects;
+        std::vector<Aws::String>    subprefixes;
+        std::string                 error;
+        Aws::String                 prefix;
+        bool                        ok;
+
+        /* Wait for work, we are done once nobody can produce any more */
+        state->cond.wait(lock, [state] {
+            return !state->prefixes.empty() || state->active == 0 || state->failed;
+        });
+        if (state->prefixes.empty() || state->failed)
+            break;
+
+        prefix = std::move(state->prefixes.front());
+        state->prefixes.pop_front();
+        state->active++;
+
+        lock.unlock();
+        /* An exception must not escape the thread, report it to the backend */
+        try
+        {
+            ok = s3_list_prefix(state, prefix, objects, subprefixes, error);
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+            ok = false;
+        }
+        catch (...)
+        {
+            error = "unknown error";
+            ok = false;
+        }
+        lock.lock();
+
+        state->active--;
+        if (!ok)
+        {
+            if (!state->failed)
+                state->error = error;
+            state->failed = true;
+        }
+        else
+        {
+            for (auto &object : objects)
+                state->objects.push_back(std::move(object));
+            for (auto &subprefix : subprefixes)
+                state->prefixes.push_back(std::move(subprefix));
+        }
+        state->cond.notify_all();
+    }
+    state->cond.notify_all();
+}
+
 /*
  * Get file names in S3 directory. Retuned file names are path from s3path.
+ *
+ * Objects are listed by ListObjectsV2 restricted to the directory prefix.
+ * Every level of the tree is listed with '/' as the delimiter, and the
+ * resulting common prefixes (e.g. hive style partitions) are listed by up to
+ * parquet_s3_fdw.list_concurrency threads in parallel.
  */
 List*
 parquetGetS3ObjectList(Aws::S3::S3Client *s3_cli, const char *s3path)
 {
-    List *objectlist = NIL;
-	Aws::S3::S3Client s3_client = *s3_cli;
-	Aws::S3::Model::ListObjectsRequest request;
+    List       *objectlist = NIL;
+    S3ListState state;
+    std::vector<std::thread> workers;
+    int         nworkers;
 
     if (s3path == NULL)
         return NIL;
@@ -583,40 +776,62 @@ parquetGetS3ObjectList(Aws::S3::S3Client *s3_cli, const char *s3path)
     {
         len = bucketName.length();
     }
-    request.WithBucket(bucketName.substr(0, len));
 
-	auto outcome = s3_client.ListObjects(request);
+    state.s3_client = s3_cli;
+    state.bucket = bucketName.substr(0, len);
+    state.prefixes.push_back(dir ? Aws::String(dir) : Aws::String());
 
-	if (!outcome.IsSuccess())
-		elog(ERROR, "parquet_s3_fdw: failed to get object list on %s. %s", bucketName.substr(0, len).c_str(), outcome.GetError().GetMessage().c_str());
+    nworkers = Max(parquet_s3_list_concurrency, 1);
+    try
+    {
+        for (int i = 1; i < nworkers; i++)
+            workers.emplace_back(s3_list_worker, &state);
+    }
+    catch (const std::system_error &)
+    {
+        /* Go on with the threads we could start */
+    }
+    s3_list_worker(&state);
+    for (auto &worker : workers)
+        worker.join();
+
+    if (state.failed)
+        elog(ERROR, "parquet_s3_fdw: failed to get object list on %s. %s", state.bucket.c_str(), state.error.c_str());
+
+    /* Threads finish in arbitrary order, return keys in the S3 listing order */
+    std::sort(state.objects.begin(), state.objects.end(),
+              [](const S3ListedObject &a, const S3ListedObject &b) {
+                  return a.key < b.key;
+              });
+
+    for (S3ListedObject &object : state.objects)
+    {
+        const Aws::String &key = object.key;
+
+        CHECK_FOR_INTERRUPTS();
 
-	Aws::Vector<Aws::S3::Model::Object> objects =
-		outcome.GetResult().GetContents();
-	for (Aws::S3::Model::Object& object : objects)
-	{
-        Aws::String key = object.GetKey();
         if (!dir)
         {
-		    objectlist = lappend(objectlist, makeString(pstrdup((char*)key.c_str())));
+            parquetRegisterS3ObjectInfo(bucket, key.c_str(), object.size, object.etag.c_str());
+            objectlist = lappend(objectlist, makeString(pstrdup((char*)key.c_str())));
             elog(DEBUG1, "parquet_s3_fdw: accessing %s%s", s3path, key.c_str());
         }
-        else if (strncmp(key.c_str(), dir, strlen(dir)) == 0)
+        else
         {
             char *file = pstrdup((char*) key.substr(strlen(dir)).c_str());
             /* Don't register if the object is directory. */
             if (key.at(key.length()-1) != '/' && strcmp(file, "/") != 0)
             {
+                parquetRegisterS3ObjectInfo(bucket, file, object.size, object.etag.c_str());
                 objectlist = lappend(objectlist, makeString(file));
                 elog(DEBUG1, "parquet_s3_fdw: accessing %s%s", s3path, key.substr(strlen(dir)).c_str());
             }
-			else
-				pfree(file);
+            else
+                pfree(file);
         }
-        else
-            elog(DEBUG1, "parquet_s3_fdw: skipping s3://%s/%s", bucketName.substr(0, len).c_str(), key.c_str());
-	}
+    }
 
-	return objectlist;
+    return objectlist;
 }
 
 /*
@@ -892,6 +1107,114 @@ parquetExtractParquetFields(List *fields, char **paths, const char *servername)
     return fields;
 }
 
+/*
+ * object_info_reset_callback
+ *		Forget the object info table when TopTransactionContext goes away.
+ */
+static void
+object_info_reset_callback(void *arg)
+{
+	ObjectInfoHash = NULL;
+}
+
+/*
+ * parquetRegisterS3ObjectInfo
+ *		Remember size and ETag of the object "fname" in "dname", where the
+ *		two are split the same way parquetSplitS3Path() does it.
+ */
+void
+parquetRegisterS3ObjectInfo(const char *dname, const char *fname, int64 size, const char *etag)
+{
+	ReaderCacheKey key = {0};
+	ObjectInfoEntry *entry;
+
+	if (strlen(dname) >= sizeof(key.dname) || strlen(fname) >= sizeof(key.fname) ||
+		strlen(etag) >= sizeof(entry->etag))
+		return;
+
+	if (ObjectInfoHash == NULL)
+	{
+		HASHCTL		ctl;
+		MemoryContextCallback *cb;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(ReaderCacheKey);
+		ctl.entrysize = sizeof(ObjectInfoEntry);
+		ctl.hcxt = TopTransactionContext;
+		ObjectInfoHash = hash_create("parquet_s3_fdw object info cache", 64,
+									 &ctl,
+									 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		cb = (MemoryContextCallback *) MemoryContextAlloc(TopTransactionContext,
+														  sizeof(MemoryContextCallback));
+		cb->func = object_info_reset_callback;
+		cb->arg = NULL;
+		MemoryContextRegisterResetCallback(TopTransactionContext, cb);
+	}
+
+	strcpy(key.dname, dname);
+	strcpy(key.fname, fname);
+
+	entry = (ObjectInfoEntry *) hash_search(ObjectInfoHash, &key, HASH_ENTER, NULL);
+	entry->listed = GetCurrentStatementStartTimestamp();
+	entry->size = size;
+	strlcpy(entry->etag, etag, sizeof(entry->etag));
+}
+
+/*
+ * parquetLookupS3ObjectInfo
+ *		Find size and ETag registered by parquetRegisterS3ObjectInfo() in the
+ *		current statement.
+ */
+bool
+parquetLookupS3ObjectInfo(const char *dname, const char *fname, int64 *size, char **etag)
+{
+	ReaderCacheKey key = {0};
+	ObjectInfoEntry *entry;
+
+	if (ObjectInfoHash == NULL ||
+		strlen(dname) >= sizeof(key.dname) || strlen(fname) >= sizeof(key.fname))
+		return false;
+
+	strcpy(key.dname, dname);
+	strcpy(key.fname, fname);
+
+	entry = (ObjectInfoEntry *) hash_search(ObjectInfoHash, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+		return false;
+
+	/* Listed by an earlier statement, the object may have changed since */
+	if (entry->listed != GetCurrentStatementStartTimestamp())
+	{
+		hash_search(ObjectInfoHash, &key, HASH_REMOVE, NULL);
+		return false;
+	}
+
+	*size = entry->size;
+	*etag = entry->etag;
+	return true;
+}
+
+/*
+ * parquetForgetS3ObjectInfo
+ *		Drop what is known about the object, because it has been rewritten or
+ *		found to differ from what listing said.
+ */
+void
+parquetForgetS3ObjectInfo(const char *dname, const char *fname)
+{
+	ReaderCacheKey key = {0};
+
+	if (ObjectInfoHash == NULL ||
+		strlen(dname) >= sizeof(key.dname) || strlen(fname) >= sizeof(key.fname))
+		return;
+
+	strcpy(key.dname, dname);
+	strcpy(key.fname, fname);
+
+	hash_search(ObjectInfoHash, &key, HASH_REMOVE, NULL);
+}
+
 /*
  * Get a S3 handle which can be used to get objects on AWS S3
  * with the user's authorization.  A new connection is established
@@ -956,9 +1279,53 @@ parquetGetFileReader(Aws::S3::S3Client *s3client, char *dname, char *fname)
 	if (entry->file_reader == NULL || entry->file_reader->reader == nullptr)
 	{
 		std::unique_ptr<parquet::arrow::FileReader> reader;
+		std::unique_ptr<parquet::ParquetFileReader> parquet_reader;
 		entry->pool = arrow::default_memory_pool();
-		std::shared_ptr<arrow::io::RandomAccessFile> input(new S3RandomAccessFile(s3client, dname, fname));
-		arrow::Status status = parquet::arrow::OpenFile(input, entry->pool, &reader);
+		int64		size = -1;
+		char	   *etag = NULL;
+		std::shared_ptr<S3RandomAccessFile> input;
+
+		/* Size and ETag known from listing save a request to S3 */
+		if (parquetLookupS3ObjectInfo(dname, fname, &size, &etag))
+		{
+			input.reset(new S3RandomAccessFile(s3client, dname, fname, size, etag));
+
+			/*
+			 * Reads are conditional on the listed ETag, so they fail if the
+			 * object has been rewritten since. Ask S3 about it then.
+			 */
+			try
+			{
+				parquet_reader = parquetOpenS3File(input, dname, fname);
+			}
+			catch (const std::exception &e)
+			{
+				elog(DEBUG1, "parquet_s3_fdw: %s/%s does not match its listing: %s",
+					 dname, fname, e.what());
+				parquetForgetS3ObjectInfo(dname, fname);
+				(void) input->Close();
+				input = nullptr;
+			}
+		}
+
+		if (parquet_reader == nullptr)
+		{
+			input.reset(new S3RandomAccessFile(s3client, dname, fname));
+
+			/* The footer may have been already read by another backend */
+			try
+			{
+				parquet_reader = parquetOpenS3File(input, dname, fname);
+			}
+			catch (const std::exception &e)
+			{
+				throw Error("failed to open Parquet file %s", e.what());
+			}
+		}
+
+		arrow::Status status = parquet::arrow::FileReader::Make(entry->pool,
+																std::move(parquet_reader),
+																&reader);
 
         if (!status.ok())
             throw Error("failed to open Parquet file %s",
@@ -967,10 +1334,19 @@ parquetGetFileReader(Aws::S3::S3Client *s3client, char *dname, char *fname)
 		if (!entry->file_reader)
 			entry->file_reader = new FileReaderCache();
 		entry->file_reader->reader = std::move(reader);
+		entry->file_reader->file = input;
 		elog(DEBUG3, "parquet_s3_fdw: new parquet file reader for s3handle %p %s/%s",
 			 s3client, dname, fname);
 	}
 
+	/* The I/O threads do not read the GUCs, which may change meanwhile */
+	if (entry->file_reader->file)
+	{
+		auto	file = std::static_pointer_cast<S3RandomAccessFile>(entry->file_reader->file);
+
+		file->SetBlockCache(parquetBlockCacheSettings());
+	}
+
 	return entry;
 }
 
@@ -1165,6 +1541,9 @@ parquet_upload_file_to_s3(const char *dirname, Aws::S3::S3Client *s3_client, con
 	request.SetBody(input_data);
 	outcome = s3_client->PutObject(request);
 
+	/* Size and ETag from an earlier listing do not hold anymore */
+	parquetForgetS3ObjectInfo(bucket, filepath);
+
 	if (outcome.IsSuccess())
 	{
 	    elog(DEBUG1, "parquet_s3_fdw: added object '%s' to bucket '%s'.", filepath, bucket);
@@ -1188,6 +1567,7 @@ parquet_delete_object(const char *dirname, const char *filename, const Aws::S3::
 
 	request.WithKey(filename).WithBucket(dirname);
 	outcome = s3_client->DeleteObject(request);
+	parquetForgetS3ObjectInfo(dirname, filename);
 
 	if (outcome.IsSuccess())
 	{
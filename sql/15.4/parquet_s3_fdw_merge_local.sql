@@ -0,0 +1,5 @@
+\set ECHO none
+\ir sql/parameters_local.conf
+\set ECHO all
+show server_version \gset
+\ir sql/:server_version/parquet_s3_fdw_merge.sql
\ No newline at end of file
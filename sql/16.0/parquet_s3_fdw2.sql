@@ -89,6 +89,20 @@ CREATE FOREIGN TABLE dummy1 (timestamp timestamp, col1 text, col2 bigint, col3 d
 --Testcase 27:
 CREATE FOREIGN TABLE dummy2 (timestamp timestamp, col1 text, col2 bigint, col3 double precision) SERVER parquet_s3_srv OPTIONS (filename 's3://test-bucket/dir1/file1.parquet /tmp/file2.parquet');
 -- **********************************************
+-- Local block cache
+-- **********************************************
+--Testcase 42:
+SET parquet_s3_fdw.block_cache_dir = '/tmp/parquet_s3_fdw_block_cache';
+-- The first scan fills the cache, the second one reads from it
+--Testcase 43:
+SELECT * FROM file0;
+--Testcase 44:
+SELECT * FROM file0;
+--Testcase 45:
+SELECT hits > 0 AS hits, evictions = 0 AS no_evictions FROM parquet_s3_fdw_block_cache_stats();
+--Testcase 46:
+RESET parquet_s3_fdw.block_cache_dir;
+-- **********************************************
 -- Cleanup
 -- **********************************************
 --Testcase 28:
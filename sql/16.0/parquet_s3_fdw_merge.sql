@@ -0,0 +1,497 @@
+--Testcase 1:
+SET datestyle = 'ISO';
+--Testcase 2:
+SET client_min_messages = WARNING;
+--Testcase 3:
+CREATE EXTENSION parquet_s3_fdw;
+--Testcase 4:
+CREATE SERVER parquet_s3_srv FOREIGN DATA WRAPPER parquet_s3_fdw :USE_MINIO;
+--Testcase 5:
+CREATE USER MAPPING FOR CURRENT_USER SERVER parquet_s3_srv :USER_PASSWORD;
+
+-- row filters with the caching multifile merge reader
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 6:
+CREATE FOREIGN TABLE example_sorted_caching (
+    one     INT8,
+    three   TEXT,
+    seven   FLOAT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'one', max_open_files '1');
+--Testcase 7:
+SELECT one, three FROM example_sorted_caching WHERE one > 3 ORDER BY one;
+--Testcase 8:
+SELECT one, three FROM example_sorted_caching WHERE three IN ('foo', 'drei', 'tres') ORDER BY one;
+--Testcase 9:
+SELECT one, three FROM example_sorted_caching WHERE seven IS NULL ORDER BY one;
+
+-- rescan of a multifile reader which reached the end, see parquetReScanForeignScan
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 14:
+CREATE FOREIGN TABLE example_seq (
+    one     INT8,
+    three   TEXT)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 15:
+SET enable_hashjoin = off;
+--Testcase 16:
+SET enable_mergejoin = off;
+--Testcase 17:
+SET enable_material = off;
+--Testcase 18:
+SELECT x, (SELECT count(*) FROM example_seq e WHERE e.one <= t.x) FROM (VALUES (1), (5), (9)) t(x) ORDER BY x;
+-- parameterized nested loop
+--Testcase 19:
+SET parquet_s3_fdw.enable_parameterized_paths = on;
+--Testcase 20:
+SELECT t.x, e.three FROM (VALUES (1), (5), (9)) t(x) JOIN example_seq e ON e.one = t.x ORDER BY 1, 2;
+--Testcase 21:
+RESET parquet_s3_fdw.enable_parameterized_paths;
+--Testcase 22:
+RESET enable_hashjoin;
+--Testcase 23:
+RESET enable_mergejoin;
+--Testcase 24:
+RESET enable_material;
+
+-- aggregates answered from metadata when the scan starts
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 26:
+CREATE FOREIGN TABLE example_agg (
+    one     INT8,
+    three   TEXT,
+    seven   FLOAT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 27:
+SET parquet_s3_fdw.enable_aggregate_pushdown = on;
+--Testcase 28:
+EXPLAIN (COSTS OFF) SELECT count(*), min(one), max(one) FROM example_agg WHERE one > 0;
+--Testcase 29:
+SELECT count(*), min(one), max(one) FROM example_agg WHERE one > 0;
+-- generic plan of a prepared statement
+--Testcase 30:
+SET plan_cache_mode = force_generic_plan;
+--Testcase 31:
+PREPARE agg_stmt AS SELECT count(*), min(one), max(one) FROM example_agg WHERE one > 0;
+--Testcase 32:
+EXECUTE agg_stmt;
+--Testcase 33:
+EXECUTE agg_stmt;
+--Testcase 34:
+DEALLOCATE agg_stmt;
+--Testcase 35:
+RESET plan_cache_mode;
+--Testcase 36:
+RESET parquet_s3_fdw.enable_aggregate_pushdown;
+
+-- grouping column not in the target list
+--Testcase 38:
+SET parquet_s3_fdw.enable_aggregate_pushdown = on;
+--Testcase 39:
+SELECT count(*) FROM example_agg GROUP BY one ORDER BY 1;
+--Testcase 40:
+RESET parquet_s3_fdw.enable_aggregate_pushdown;
+
+-- equal keys of the merged files come in the order of the files
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 41:
+CREATE FOREIGN TABLE example_sorted (
+    one     INT8,
+    three   TEXT)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'one');
+--Testcase 42:
+SELECT one, three FROM example_sorted ORDER BY one;
+
+-- merge of overlapping and disjoint files, with runs of single files
+\set var :PATH_FILENAME'/data/test-bucket/file0.parquet ':PATH_FILENAME'/data/test-bucket/dir1/file1.parquet ':PATH_FILENAME'/data/test-bucket/dir1/dir11/file111.parquet ':PATH_FILENAME'/data/test-bucket/dir1/dir12/file121.parquet'
+--Testcase 44:
+CREATE FOREIGN TABLE example_ts (
+    timestamp   TIMESTAMP,
+    col1        TEXT,
+    col2        INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'timestamp');
+--Testcase 45:
+SELECT * FROM example_ts ORDER BY timestamp;
+--Testcase 46:
+SELECT * FROM example_ts ORDER BY timestamp LIMIT 3;
+-- the same files merged by two keys, without runs
+--Testcase 47:
+CREATE FOREIGN TABLE example_ts2 (
+    timestamp   TIMESTAMP,
+    col1        TEXT,
+    col2        INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'timestamp col2');
+--Testcase 48:
+SELECT * FROM example_ts2 ORDER BY timestamp, col2;
+-- NULL keys of files without the column sort last
+\set var :PATH_FILENAME'/data/simple/example2.parquet ':PATH_FILENAME'/data/test-bucket/file0.parquet ':PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/test-bucket/dir1/file1.parquet'
+--Testcase 49:
+CREATE FOREIGN TABLE example_ts_nulls (
+    timestamp   TIMESTAMP,
+    col1        TEXT,
+    three       TEXT)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'timestamp');
+--Testcase 50:
+SELECT * FROM example_ts_nulls ORDER BY timestamp;
+--Testcase 51:
+SELECT * FROM example_ts_nulls ORDER BY timestamp LIMIT 7;
+
+-- rescan of the merge, files are opened again when their readers start
+--Testcase 55:
+SELECT x, (SELECT col1 FROM example_ts e WHERE e.col2 = t.x ORDER BY timestamp LIMIT 1) FROM (VALUES (1), (3)) t(x) ORDER BY x;
+
+-- parallel merge split into key ranges of the first sort key
+\set var :PATH_FILENAME'/data/test-bucket/file0.parquet ':PATH_FILENAME'/data/test-bucket/dir1/file1.parquet ':PATH_FILENAME'/data/test-bucket/dir1/dir11/file111.parquet ':PATH_FILENAME'/data/test-bucket/dir1/dir12/file121.parquet'
+--Testcase 56:
+CREATE FOREIGN TABLE example_ts_par (
+    timestamp   TIMESTAMP,
+    col1        TEXT,
+    col2        INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'timestamp', parallel_workers '2');
+--Testcase 57:
+SET parallel_setup_cost = 0;
+--Testcase 58:
+SET parallel_tuple_cost = 0;
+--Testcase 59:
+SET parquet_fdw.enable_multifile = off;
+--Testcase 60:
+EXPLAIN (COSTS OFF) SELECT * FROM example_ts_par ORDER BY timestamp;
+--Testcase 61:
+SELECT * FROM example_ts_par ORDER BY timestamp;
+--Testcase 62:
+RESET parquet_fdw.enable_multifile;
+--Testcase 63:
+RESET parallel_tuple_cost;
+--Testcase 64:
+RESET parallel_setup_cost;
+
+-- aggregates computed by the scan, by argument and grouping column types
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 66:
+CREATE FOREIGN TABLE example_agg_i4 (
+    one     INT4,
+    three   TEXT,
+    seven   FLOAT4)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 67:
+CREATE FOREIGN TABLE example_agg_i2 (
+    one     INT2)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 68:
+SET parquet_s3_fdw.enable_aggregate_pushdown = on;
+--Testcase 69:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT count(*) FROM example_agg GROUP BY one ORDER BY 1;
+--Testcase 70:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT sum(one), avg(one), sum(seven), avg(seven) FROM example_agg;
+--Testcase 71:
+SELECT sum(one), avg(one), sum(seven), avg(seven) FROM example_agg;
+--Testcase 72:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT sum(one), avg(one), sum(seven), avg(seven) FROM example_agg_i4;
+--Testcase 73:
+SELECT sum(one), avg(one), sum(seven), avg(seven) FROM example_agg_i4;
+--Testcase 74:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT sum(one), avg(one) FROM example_agg_i2;
+--Testcase 75:
+SELECT sum(one), avg(one) FROM example_agg_i2;
+-- float and text grouping columns
+--Testcase 76:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT seven, count(*), sum(one) FROM example_agg GROUP BY seven ORDER BY seven;
+--Testcase 77:
+SELECT seven, count(*), sum(one) FROM example_agg GROUP BY seven ORDER BY seven;
+--Testcase 78:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT three, count(*), sum(one) FROM example_agg WHERE one < 4 GROUP BY three ORDER BY three;
+--Testcase 79:
+SELECT three, count(*), sum(one) FROM example_agg WHERE one < 4 GROUP BY three ORDER BY three;
+-- row groups are answered from metadata only when every qual is exact
+--Testcase 80:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT count(*), min(one), max(one) FROM example_agg WHERE one > 2;
+--Testcase 81:
+SELECT count(*), min(one), max(one) FROM example_agg WHERE one > 2;
+--Testcase 82:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT count(*), min(one), max(one) FROM example_agg WHERE three > 'c';
+--Testcase 83:
+SELECT count(*), min(one), max(one) FROM example_agg WHERE three > 'c';
+-- partial aggregation by the workers of a parallel scan
+--Testcase 84:
+SET parallel_setup_cost = 0;
+--Testcase 85:
+SET parallel_tuple_cost = 0;
+--Testcase 86:
+EXPLAIN (VERBOSE, COSTS OFF) SELECT sum(one), avg(seven), count(*) FROM example_agg_i4;
+--Testcase 87:
+SELECT sum(one), avg(seven), count(*) FROM example_agg_i4;
+--Testcase 88:
+RESET parallel_tuple_cost;
+--Testcase 89:
+RESET parallel_setup_cost;
+--Testcase 90:
+RESET parquet_s3_fdw.enable_aggregate_pushdown;
+
+-- number of planned parallel workers
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 93:
+CREATE FOREIGN TABLE example_workers (
+    one     INT8,
+    three   TEXT)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 94:
+SET parallel_setup_cost = 0;
+--Testcase 95:
+SET parallel_tuple_cost = 0;
+--Testcase 96:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers;
+-- too small for a parallel scan by the estimate
+--Testcase 97:
+SET parquet_s3_fdw.enable_parallel_workers_estimate = on;
+--Testcase 98:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers;
+--Testcase 99:
+SET min_parallel_table_scan_size = 0;
+--Testcase 100:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers;
+--Testcase 101:
+RESET min_parallel_table_scan_size;
+-- the table option takes precedence over the estimate
+--Testcase 102:
+ALTER FOREIGN TABLE example_workers OPTIONS (ADD parallel_workers '2');
+--Testcase 103:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers;
+--Testcase 104:
+RESET parquet_s3_fdw.enable_parallel_workers_estimate;
+-- no more workers than row groups besides the one of the leader
+--Testcase 105:
+SET max_parallel_workers_per_gather = 4;
+--Testcase 106:
+ALTER FOREIGN TABLE example_workers OPTIONS (SET parallel_workers '4');
+--Testcase 107:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers;
+--Testcase 108:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers WHERE one > 3;
+--Testcase 109:
+SELECT * FROM example_workers WHERE one > 3 ORDER BY one, three;
+--Testcase 110:
+ALTER FOREIGN TABLE example_workers OPTIONS (SET parallel_workers '0');
+--Testcase 111:
+EXPLAIN (COSTS OFF) SELECT * FROM example_workers;
+--Testcase 112:
+RESET max_parallel_workers_per_gather;
+--Testcase 113:
+RESET parallel_tuple_cost;
+--Testcase 114:
+RESET parallel_setup_cost;
+
+-- row groups filtered out by page indexes
+\set var :PATH_FILENAME'/data/simple/example_pages.parquet'
+--Testcase 116:
+CREATE FOREIGN TABLE example_pages (
+    id      INT8,
+    gap     INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 117:
+SET client_min_messages = DEBUG1;
+--Testcase 118:
+EXPLAIN (COSTS OFF) SELECT * FROM example_pages WHERE gap BETWEEN 45 AND 55;
+--Testcase 119:
+SELECT min(id), max(id), count(*) FROM example_pages WHERE gap BETWEEN 45 AND 55;
+--Testcase 120:
+SET parquet_s3_fdw.enable_page_index = off;
+--Testcase 121:
+EXPLAIN (COSTS OFF) SELECT * FROM example_pages WHERE gap BETWEEN 45 AND 55;
+--Testcase 122:
+SELECT min(id), max(id), count(*) FROM example_pages WHERE gap BETWEEN 45 AND 55;
+--Testcase 123:
+RESET parquet_s3_fdw.enable_page_index;
+--Testcase 124:
+SET client_min_messages = WARNING;
+
+-- row groups filtered out by bloom filters
+\set var :PATH_FILENAME'/data/simple/example_bloom.parquet'
+--Testcase 126:
+CREATE FOREIGN TABLE example_bloom (
+    id      INT8,
+    code    INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 127:
+SET client_min_messages = DEBUG1;
+--Testcase 128:
+EXPLAIN (COSTS OFF) SELECT * FROM example_bloom WHERE code = 4;
+--Testcase 129:
+SELECT * FROM example_bloom WHERE code = 4;
+--Testcase 130:
+SELECT * FROM example_bloom WHERE code IN (4, 8) ORDER BY id;
+--Testcase 131:
+SELECT * FROM example_bloom WHERE code = 9 ORDER BY id;
+--Testcase 132:
+SET parquet_s3_fdw.enable_bloom_filter = off;
+--Testcase 133:
+EXPLAIN (COSTS OFF) SELECT * FROM example_bloom WHERE code = 4;
+--Testcase 134:
+SELECT * FROM example_bloom WHERE code = 4;
+--Testcase 135:
+RESET parquet_s3_fdw.enable_bloom_filter;
+--Testcase 136:
+SET client_min_messages = WARNING;
+
+-- row groups filtered out by IN lists and ORs
+\set var :PATH_FILENAME'/data/simple/example_pages.parquet'
+--Testcase 138:
+CREATE FOREIGN TABLE example_in (
+    id      INT8,
+    gap     INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 139:
+SET client_min_messages = DEBUG1;
+--Testcase 140:
+EXPLAIN (COSTS OFF) SELECT * FROM example_in WHERE id IN (5, 250);
+--Testcase 141:
+SELECT * FROM example_in WHERE id IN (5, 250) ORDER BY id;
+--Testcase 142:
+EXPLAIN (COSTS OFF) SELECT * FROM example_in WHERE id = 150 OR id > 290;
+--Testcase 143:
+SELECT count(*), min(id), max(id) FROM example_in WHERE id = 150 OR id > 290;
+--Testcase 144:
+SELECT count(*), min(id), max(id) FROM example_in WHERE id < 10 OR gap > 195;
+--Testcase 145:
+SELECT count(*), min(id), max(id) FROM example_in WHERE id > ALL ('{100, 250}'::int8[]);
+--Testcase 146:
+SET client_min_messages = WARNING;
+
+-- aggregates answered from the metadata of the row groups which fully match
+\set var :PATH_FILENAME'/data/simple/example_pages.parquet'
+--Testcase 148:
+CREATE FOREIGN TABLE example_meta (
+    id      INT8,
+    gap     INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 149:
+SET parquet_s3_fdw.enable_aggregate_pushdown = on;
+--Testcase 150:
+EXPLAIN (COSTS OFF) SELECT count(*), min(id), max(id) FROM example_meta WHERE id > 150;
+--Testcase 151:
+SELECT count(*), min(id), max(id) FROM example_meta WHERE id > 150;
+--Testcase 152:
+EXPLAIN (COSTS OFF) SELECT count(gap), min(gap), max(gap) FROM example_meta WHERE id > 200;
+--Testcase 153:
+SELECT count(gap), min(gap), max(gap) FROM example_meta WHERE id > 200;
+--Testcase 154:
+SELECT count(*), min(gap), max(gap) FROM example_meta;
+--Testcase 155:
+RESET parquet_s3_fdw.enable_aggregate_pushdown;
+
+-- LIMIT passed to the scan
+\set var :PATH_FILENAME'/data/simple/example_pages.parquet'
+--Testcase 157:
+CREATE FOREIGN TABLE example_limit (
+    id      INT8,
+    gap     INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var');
+--Testcase 158:
+SELECT * FROM example_limit LIMIT 5 OFFSET 97;
+--Testcase 159:
+SELECT id FROM example_limit WHERE id % 40 = 0 LIMIT 3 OFFSET 2;
+--Testcase 160:
+SET parquet_s3_fdw.batch_size = 7;
+--Testcase 161:
+SELECT * FROM example_limit LIMIT 5 OFFSET 97;
+--Testcase 162:
+SELECT id FROM example_limit WHERE id % 40 = 0 LIMIT 3 OFFSET 2;
+--Testcase 163:
+RESET parquet_s3_fdw.batch_size;
+\set var :PATH_FILENAME'/data/simple/example1.parquet ':PATH_FILENAME'/data/simple/example2.parquet'
+--Testcase 164:
+CREATE FOREIGN TABLE example_limit_sorted (
+    one     INT8,
+    three   TEXT)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', sorted 'one');
+--Testcase 165:
+SELECT one FROM example_limit_sorted ORDER BY one LIMIT 4 OFFSET 1;
+--Testcase 166:
+SET parquet_s3_fdw.enable_limit_pushdown = off;
+--Testcase 167:
+SELECT * FROM example_limit LIMIT 5 OFFSET 97;
+--Testcase 168:
+SELECT one FROM example_limit_sorted ORDER BY one LIMIT 4 OFFSET 1;
+--Testcase 169:
+RESET parquet_s3_fdw.enable_limit_pushdown;
+
+-- row groups of several files shared out to parallel workers
+\set var :PATH_FILENAME'/data/simple/example_pages.parquet ':PATH_FILENAME'/data/simple/example_bloom.parquet'
+--Testcase 172:
+CREATE FOREIGN TABLE example_queue (
+    id      INT8)
+SERVER parquet_s3_srv
+OPTIONS (filename :'var', parallel_workers '2');
+--Testcase 173:
+SET parallel_setup_cost = 0;
+--Testcase 174:
+SET parallel_tuple_cost = 0;
+--Testcase 175:
+SELECT count(*), sum(id) FROM example_queue;
+--Testcase 176:
+SELECT count(*), sum(id) FROM example_queue WHERE id > 150;
+--Testcase 177:
+SELECT id FROM example_queue WHERE id % 100 = 0 ORDER BY id;
+--Testcase 178:
+RESET parallel_tuple_cost;
+--Testcase 179:
+RESET parallel_setup_cost;
+
+-- Clean-up
+--Testcase 10:
+DROP FOREIGN TABLE example_sorted_caching;
+--Testcase 25:
+DROP FOREIGN TABLE example_seq;
+--Testcase 37:
+DROP FOREIGN TABLE example_agg;
+--Testcase 43:
+DROP FOREIGN TABLE example_sorted;
+--Testcase 52:
+DROP FOREIGN TABLE example_ts;
+--Testcase 53:
+DROP FOREIGN TABLE example_ts2;
+--Testcase 54:
+DROP FOREIGN TABLE example_ts_nulls;
+--Testcase 65:
+DROP FOREIGN TABLE example_ts_par;
+--Testcase 91:
+DROP FOREIGN TABLE example_agg_i4;
+--Testcase 92:
+DROP FOREIGN TABLE example_agg_i2;
+--Testcase 115:
+DROP FOREIGN TABLE example_workers;
+--Testcase 125:
+DROP FOREIGN TABLE example_pages;
+--Testcase 137:
+DROP FOREIGN TABLE example_bloom;
+--Testcase 147:
+DROP FOREIGN TABLE example_in;
+--Testcase 156:
+DROP FOREIGN TABLE example_meta;
+--Testcase 170:
+DROP FOREIGN TABLE example_limit;
+--Testcase 171:
+DROP FOREIGN TABLE example_limit_sorted;
+--Testcase 180:
+DROP FOREIGN TABLE example_queue;
+--Testcase 11:
+DROP USER MAPPING FOR CURRENT_USER SERVER parquet_s3_srv;
+--Testcase 12:
+DROP SERVER parquet_s3_srv;
+--Testcase 13:
+DROP EXTENSION parquet_s3_fdw CASCADE;
@@ -0,0 +1,1050 @@
+/*-------------------------------------------------------------------------
+ *
+ * aggregate.cpp
+ *		  Aggregation done by the foreign scan for parquet_s3_fdw
+ *
+ * Grouped aggregates (COUNT, SUM, AVG, MIN and MAX grouped by plain columns)
+ * are computed while reading the Parquet files instead of producing a tuple
+ * for each row. Whole row groups are aggregated straight from arrow arrays:
+ * group numbers are computed for all rows first, then every aggregate is
+ * advanced by a type specialized loop over its argument column. Row groups
+ * which cannot be handled that way (casts, quals not evaluated by the row
+ * filters) are consumed row by row from tuple slots with the same results.
+ *
+ * Portions Copyright (c) 2021, TOSHIBA CORPORATION
+ *
+ * IDENTIFICATION
+ *		  contrib/parquet_s3_fdw/src/aggregate.cpp
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <cmath>
+#include <limits>
+
+#include "arrow/api.h"
+
+#include "aggregate.hpp"
+#include "common.hpp"
+
+extern "C"
+{
+#include "postgres.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+
+#if PG_VERSION_NUM < 110000
+#include "catalog/pg_type.h"
+#else
+#include "catalog/pg_type_d.h"
+#endif
+}
+
+
+/*
+ * Turn postgres errors raised by code_block into a c++ exception carrying the
+ * error message.
+ */
+#define PG_TRY_THROW(code_block) \
+    do { \
+        MemoryContext ccxt = CurrentMemoryContext; \
+        char    errstr[ERROR_STR_LEN]; \
+        bool    error = false; \
+        PG_TRY(); \
+        code_block \
+        PG_CATCH(); \
+        { \
+            ErrorData *errdata; \
+            MemoryContextSwitchTo(ccxt); \
+            error = true; \
+            errdata = CopyErrorData(); \
+            FlushErrorState(); \
+            strlcpy(errstr, errdata->message, ERROR_STR_LEN); \
+            FreeErrorData(errdata); \
+        } \
+        PG_END_TRY(); \
+        if (error) { throw std::runtime_error(errstr); } \
+    } while(0)
+
+/* Size of a key value within a group key: null flag and int64 */
+#define KEY_PART_SIZE (1 + sizeof(int64))
+
+static bool
+is_integer_type(Oid type)
+{
+    switch (type)
+    {
+        case BOOLOID:
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case DATEOID:
+        case TIMESTAMPOID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool
+is_float_type(Oid type)
+{
+    return type == FLOAT4OID || type == FLOAT8OID;
+}
+
+static bool
+is_string_type(Oid type)
+{
+    return type == TEXTOID || type == VARCHAROID;
+}
+
+/*
+ * aggregate_key_supported
+ *      Whether the scan can group by columns of the type. Grouping columns
+ *      are compared by their binary representation.
+ */
+bool
+aggregate_key_supported(Oid type)
+{
+    return is_integer_type(type) || is_float_type(type) || is_string_type(type);
+}
+
+/*
+ * aggregate_supported
+ *      Whether the scan can compute the aggregate of a column of the type. In
+ *      partial mode the transition value must not be of type internal.
+ */
+bool
+aggregate_supported(AggregateKind kind, Oid type, bool partial)
+{
+    switch (kind)
+    {
+        case AK_COUNT_STAR:
+        case AK_COUNT:
+        case AK_MIN:
+        case AK_MAX:
+            return true;
+        case AK_SUM:
+        case AK_AVG:
+            if (type == INT8OID)
+            {
+#ifdef HAVE_INT128
+                return !partial;
+#else
+                return false;
+#endif
+            }
+            return type == INT2OID || type == INT4OID || is_float_type(type);
+        default:
+            return false;
+    }
+}
+
+/*
+ * aggregate_group_size
+ *      Approximate memory used by a group, excluding strings of the keys.
+ */
+Size
+aggregate_group_size(int nkeys, int naggs)
+{
+    Size    key_size = nkeys * KEY_PART_SIZE;
+
+    /* key stored in the hash table and in group_keys, plus table overhead */
+    return 2 * (sizeof(std::string) + key_size) + 4 * sizeof(void *) +
+        naggs * sizeof(GroupAggregator::Accum);
+}
+
+/* NaN is equal to itself and greater than any other value, as in float.c */
+static inline int
+float_cmp(double a, double b)
+{
+    if (std::isnan(a))
+        return std::isnan(b) ? 0 : 1;
+    if (std::isnan(b))
+        return -1;
+    return (a > b) - (a < b);
+}
+
+/* Floats equal for postgres get the same key, see hashfloat8() */
+static inline int64
+float_key(double v)
+{
+    int64   res;
+
+    if (v == 0.0)
+        v = 0.0;
+    else if (std::isnan(v))
+        v = std::numeric_limits<double>::quiet_NaN();
+    memcpy(&res, &v, sizeof(res));
+    return res;
+}
+
+static int64
+datum_to_int64(Oid type, Datum value)
+{
+    switch (type)
+    {
+        case BOOLOID:
+            return DatumGetBool(value);
+        case INT2OID:
+            return DatumGetInt16(value);
+        case INT4OID:
+            return DatumGetInt32(value);
+        case DATEOID:
+            return DatumGetDateADT(value);
+        case TIMESTAMPOID:
+            return DatumGetTimestamp(value);
+        default:
+            return DatumGetInt64(value);
+    }
+}
+
+static Datum
+int64_to_datum(Oid type, int64 value)
+{
+    switch (type)
+    {
+        case BOOLOID:
+            return BoolGetDatum(value != 0);
+        case INT2OID:
+            return Int16GetDatum((int16) value);
+        case INT4OID:
+            return Int32GetDatum((int32) value);
+        case DATEOID:
+            return DateADTGetDatum((DateADT) value);
+        case TIMESTAMPOID:
+            return TimestampGetDatum(value);
+        default:
+            return Int64GetDatum(value);
+    }
+}
+
+#ifdef HAVE_INT128
+static Datum
+int128_to_numeric(int128 value)
+{
+    char        buf[64];
+    char       *p = buf + sizeof(buf);
+    uint128     u = value < 0 ? -(uint128) value : (uint128) value;
+
+    *--p = '\0';
+    do
+    {
+        *--p = '0' + (int) (u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (value < 0)
+        *--p = '-';
+
+    return DirectFunctionCall3(numeric_in, CStringGetDatum(p),
+                               ObjectIdGetDatum(InvalidOid),
+                               Int32GetDatum(-1));
+}
+#endif
+
+template <typename ArrayType, typename Convert>
+static inline void
+copy_values(const arrow::Array *array, int64 *out, Convert convert)
+{
+    auto        typed = static_cast<const ArrayType *>(array);
+    int64       len = array->length();
+
+    for (int64 i = 0; i < len; i++)
+        out[i] = convert(typed->Value(i));
+}
+
+/*
+ * integer_values
+ *      Convert the values of an integer-like array into the int64
+ *      representation of the corresponding postgres values. Values at NULL
+ *      positions are undefined.
+ */
+static void
+integer_values(const arrow::Array *array, int64 *out)
+{
+    switch (array->type_id())
+    {
+        case arrow::Type::BOOL:
+            copy_values<arrow::BooleanArray>(array, out, [](bool v) { return (int64) v; });
+            break;
+        case arrow::Type::INT8:
+            copy_values<arrow::Int8Array>(array, out, [](int8_t v) { return (int64) v; });
+            break;
+        case arrow::Type::INT16:
+            copy_values<arrow::Int16Array>(array, out, [](int16_t v) { return (int64) v; });
+            break;
+        case arrow::Type::INT32:
+            copy_values<arrow::Int32Array>(array, out, [](int32_t v) { return (int64) v; });
+            break;
+        case arrow::Type::INT64:
+            copy_values<arrow::Int64Array>(array, out, [](int64_t v) { return (int64) v; });
+            break;
+        case arrow::Type::DATE32:
+            copy_values<arrow::Date32Array>(array, out, [](int32_t v) {
+                return (int64) v + (UNIX_EPOCH_JDATE - POSTGRES_EPOCH_JDATE);
+            });
+            break;
+        case arrow::Type::TIMESTAMP:
+        {
+            auto tstype = (arrow::TimestampType *) array->type().get();
+
+            copy_values<arrow::TimestampArray>(array, out, [tstype](int64_t v) {
+                TimestampTz ts;
+
+                to_postgres_timestamp(tstype, v, ts);
+                return (int64) ts;
+            });
+            break;
+        }
+        default:
+            throw Error("parquet_s3_fdw: unexpected arrow type '%s' in aggregation",
+                        array->type()->ToString().c_str());
+    }
+}
+
+static void
+float_values(const arrow::Array *array, double *out)
+{
+    int64       len = array->length();
+
+    if (array->type_id() == arrow::Type::FLOAT)
+    {
+        auto    typed = static_cast<const arrow::FloatArray *>(array);
+
+        for (int64 i = 0; i < len; i++)
+            out[i] = typed->Value(i);
+    }
+    else
+    {
+        auto    typed = static_cast<const arrow::DoubleArray *>(array);
+
+        for (int64 i = 0; i < len; i++)
+            out[i] = typed->Value(i);
+    }
+}
+
+/*
+ * update_integer, update_float
+ *      Advance the aggregate by a value. Used for both arrow arrays and tuple
+ *      slots so that both give the same results.
+ */
+inline void
+GroupAggregator::update_integer(Accum &acc, const AggregateSpec &agg, int64 v)
+{
+    switch (agg.kind)
+    {
+        case AK_SUM:
+        case AK_AVG:
+            acc.count++;
+#ifdef HAVE_INT128
+            if (agg.type == INT8OID)
+            {
+                acc.bigsum += v;
+                break;
+            }
+#endif
+            acc.isum += v;
+            break;
+        case AK_MIN:
+            if (acc.isnull || v < acc.ivalue)
+                acc.ivalue = v;
+            acc.isnull = false;
+            break;
+        case AK_MAX:
+            if (acc.isnull || v > acc.ivalue)
+                acc.ivalue = v;
+            acc.isnull = false;
+            break;
+        default:
+            break;
+    }
+}
+
+inline void
+GroupAggregator::update_float(Accum &acc, const AggregateSpec &agg, double v)
+{
+    switch (agg.kind)
+    {
+        case AK_SUM:
+            acc.count++;
+            /* sum(real) adds in single precision */
+            if (agg.type == FLOAT4OID)
+                acc.fsum = (float) acc.fsum + (float) v;
+            else
+                acc.fsum += v;
+            break;
+        case AK_AVG:
+        {
+            double  n = (double) ++acc.count;
+
+            /* Youngs-Cramer, as in float8_accum() */
+            acc.fsum += v;
+            if (n > 1.0)
+            {
+                double  tmp = v * n - acc.fsum;
+
+                acc.fsumsq += tmp * tmp / (n * (n - 1.0));
+                if (std::isinf(acc.fsum) || std::isinf(acc.fsumsq))
+                    acc.fsumsq = std::numeric_limits<double>::quiet_NaN();
+            }
+            else if (std::isnan(v) || std::isinf(v))
+                acc.fsumsq = std::numeric_limits<double>::quiet_NaN();
+            break;
+        }
+        case AK_MIN:
+            if (acc.isnull || float_cmp(v, acc.fvalue) < 0)
+                acc.fvalue = v;
+            acc.isnull = false;
+            break;
+        case AK_MAX:
+            if (acc.isnull || float_cmp(v, acc.fvalue) > 0)
+                acc.fvalue = v;
+            acc.isnull = false;
+            break;
+        default:
+            break;
+    }
+}
+
+GroupAggregator::GroupAggregator(MemoryContext parent, TupleDesc tuple_desc,
+                                 const std::vector<AttrNumber> &keys,
+                                 const std::vector<AggregateSpec> &aggs,
+                                 bool partial)
+    : cxt(NULL), tuple_desc(tuple_desc), keys(keys), aggs(aggs),
+      cmpfuncs(aggs.size(), NULL), typlens(aggs.size(), 0),
+      typbyvals(aggs.size(), true), partial(partial), group_mem(0),
+      string_mem(0), mem_limit((Size) work_mem * 1024L), output_group(0)
+{
+    for (auto attnum : keys)
+        key_types.push_back(TupleDescAttr(tuple_desc, attnum - 1)->atttypid);
+
+    PG_TRY_THROW(
+        {
+            cxt = AllocSetContextCreate(parent, "parquet_s3_fdw aggregate values",
+                                        ALLOCSET_DEFAULT_SIZES);
+
+            for (size_t a = 0; a < this->aggs.size(); a++)
+            {
+                AggregateSpec  &agg = this->aggs[a];
+                TypeCacheEntry *tce;
+                int16           typlen;
+                bool            typbyval;
+
+                if (agg.kind != AK_MIN && agg.kind != AK_MAX)
+                    continue;
+                if (is_integer_type(agg.type) || is_float_type(agg.type))
+                    continue;
+
+                /* Values of other types are compared by the btree support function */
+                tce = lookup_type_cache(agg.type, TYPECACHE_CMP_PROC_FINFO);
+                cmpfuncs[a] = &tce->cmp_proc_finfo;
+                get_typlenbyval(agg.type, &typlen, &typbyval);
+                typlens[a] = typlen;
+                typbyvals[a] = typbyval;
+            }
+        });
+
+    reset();
+}
+
+/*
+ * reset
+ *      Forget all the groups and the strings of their keys. Without grouping
+ *      columns there is always a single group, starting with the values
+ *      computed from metadata.
+ */
+void
+GroupAggregator::reset()
+{
+    groups.clear();
+    group_keys.clear();
+    accums.clear();
+    string_ids.clear();
+    strings.clear();
+    group_mem = 0;
+    string_mem = 0;
+    output_group = 0;
+    MemoryContextReset(cxt);
+
+    if (keys.empty())
+        lookup_group(std::string());
+}
+
+void
+GroupAggregator::init_accum(Accum &acc, const AggregateSpec &agg)
+{
+    memset(&acc, 0, sizeof(acc));
+    acc.isnull = true;
+
+    /* Only aggregation without grouping starts with values from metadata */
+    if (!keys.empty())
+        return;
+
+    acc.count = agg.count;
+    if ((agg.kind == AK_MIN || agg.kind == AK_MAX) && !agg.isnull)
+    {
+        if (is_float_type(agg.type))
+            acc.fvalue = agg.type == FLOAT4OID ?
+                DatumGetFloat4(agg.value) : DatumGetFloat8(agg.value);
+        else if (is_integer_type(agg.type))
+            acc.ivalue = datum_to_int64(agg.type, agg.value);
+        else
+            return;     /* only exact statistics types come from metadata */
+        acc.isnull = false;
+    }
+}
+
+int32
+GroupAggregator::lookup_group(const std::string &key)
+{
+    auto    res = groups.emplace(key, (int32) group_keys.size());
+
+    if (res.second)
+    {
+        group_keys.push_back(key);
+        accums.resize(accums.size() + aggs.size());
+        for (size_t a = 0; a < aggs.size(); a++)
+            init_accum(accums[accums.size() - aggs.size() + a], aggs[a]);
+
+        group_mem += aggregate_group_size(keys.size(), aggs.size());
+        check_memory();
+    }
+    return res.first->second;
+}
+
+int64
+GroupAggregator::string_id(const char *data, size_t len)
+{
+    auto    res = string_ids.emplace(std::string(data, len), (int64) strings.size());
+
+    if (res.second)
+    {
+        strings.push_back(res.first->first);
+
+        /* the string is stored twice, as in aggregate_group_size() */
+        string_mem += 2 * (sizeof(std::string) + len) + 4 * sizeof(void *);
+        check_memory();
+    }
+    return res.first->second;
+}
+
+/*
+ * check_memory
+ *      The number of groups is only estimated at planning time, so it may
+ *      turn out that they do not fit into work_mem. There is no way to spill
+ *      them, so give up rather than use unbounded memory.
+ */
+void
+GroupAggregator::check_memory()
+{
+    if (group_mem + string_mem > mem_limit)
+        throw Error("parquet_s3_fdw: aggregation groups exceed work_mem (%zu groups); "
+                    "increase work_mem or disable parquet_s3_fdw.enable_aggregate_pushdown",
+                    group_keys.size());
+}
+
+/*
+ * column_supported
+ *      Whether the column is read as the type of the attribute, i.e. without
+ *      a cast, so that its values can be used directly.
+ */
+bool
+GroupAggregator::column_supported(const arrow::ChunkedArray *column, Oid type)
+{
+    arrow::Type::type   type_id;
+
+    if (column == nullptr)
+        return true;
+
+    type_id = column->type()->id();
+    if (type_id == arrow::Type::DICTIONARY)
+    {
+        type_id = static_cast<const arrow::DictionaryType *>(column->type().get())
+                        ->value_type()->id();
+        if (type_id != arrow::Type::STRING)
+            return false;
+    }
+
+    return to_postgres_type(type_id) == type;
+}
+
+/*
+ * key_parts
+ *      Compute the key values of the column for all rows, see lookup_group().
+ */
+void
+GroupAggregator::key_parts(const arrow::ChunkedArray *column, Oid type,
+                           int64 *parts, uint8_t *nulls, size_t stride)
+{
+    std::vector<int64>  values;
+    std::vector<double> fvalues;
+    int64               offset = 0;
+
+    for (const auto &chunk : column->chunks())
+    {
+        const arrow::Array *array = chunk.get();
+        int64       len = array->length();
+
+        for (int64 i = 0; i < len; i++)
+            nulls[(offset + i) * stride] = array->IsNull(i);
+
+        if (array->type_id() == arrow::Type::DICTIONARY)
+        {
+            /* Look the strings of the dictionary up once */
+            auto   *dictarray = static_cast<const arrow::DictionaryArray *>(array);
+            auto    dict = std::static_pointer_cast<arrow::BinaryArray>(dictarray->dictionary());
+            std::vector<int64> ids(dict->length());
+
+            for (int64 j = 0; j < dict->length(); j++)
+            {
+                int32_t     l;
+                const uint8_t *s = dict->GetValue(j, &l);
+
+                ids[j] = string_id((const char *) s, l);
+            }
+            for (int64 i = 0; i < len; i++)
+                if (!array->IsNull(i))
+                    parts[(offset + i) * stride] = ids[dictarray->GetValueIndex(i)];
+        }
+        else if (is_string_type(type))
+        {
+            auto    strarray = static_cast<const arrow::BinaryArray *>(array);
+
+            for (int64 i = 0; i < len; i++)
+            {
+                int32_t     l;
+                const uint8_t *s;
+
+                if (array->IsNull(i))
+                    continue;
+                s = strarray->GetValue(i, &l);
+                parts[(offset + i) * stride] = string_id((const char *) s, l);
+            }
+        }
+        else if (is_float_type(type))
+        {
+            fvalues.resize(len);
+            float_values(array, fvalues.data());
+            for (int64 i = 0; i < len; i++)
+                if (!array->IsNull(i))
+                    parts[(offset + i) * stride] = float_key(fvalues[i]);
+        }
+        else
+        {
+            values.resize(len);
+            integer_values(array, values.data());
+            for (int64 i = 0; i < len; i++)
+                if (!array->IsNull(i))
+                    parts[(offset + i) * stride] = values[i];
+        }
+        offset += len;
+    }
+}
+
+/*
+ * accumulate
+ *      Advance the aggregate a by the values of its argument column for the
+ *      rows having group number in gids (-1 for rows not passing the filters).
+ */
+void
+GroupAggregator::accumulate(size_t a, const arrow::ChunkedArray *column,
+                            const int32 *gids)
+{
+    AggregateSpec  &agg = aggs[a];
+    size_t          naggs = aggs.size();
+    std::vector<int64>  values;
+    std::vector<double> fvalues;
+    int64           offset = 0;
+
+    if (column == nullptr)
+        return;     /* all values are NULL */
+
+    for (const auto &chunk : column->chunks())
+    {
+        const arrow::Array *array = chunk.get();
+        int64       len = array->length();
+        const int32 *g = gids + offset;
+        bool        has_nulls = array->null_count() > 0;
+
+        offset += len;
+
+        if (agg.kind == AK_COUNT)
+        {
+            for (int64 i = 0; i < len; i++)
+                if (g[i] >= 0 && !(has_nulls && array->IsNull(i)))
+                    accums[g[i] * naggs + a].count++;
+            continue;
+        }
+
+        if (is_float_type(agg.type))
+        {
+            fvalues.resize(len);
+            float_values(array, fvalues.data());
+            for (int64 i = 0; i < len; i++)
+            {
+                if (g[i] < 0 || (has_nulls && array->IsNull(i)))
+                    continue;
+
+                update_float(accums[g[i] * naggs + a], agg, fvalues[i]);
+            }
+        }
+        else
+        {
+            values.resize(len);
+            integer_values(array, values.data());
+            for (int64 i = 0; i < len; i++)
+            {
+                if (g[i] < 0 || (has_nulls && array->IsNull(i)))
+                    continue;
+
+                update_integer(accums[g[i] * naggs + a], agg, values[i]);
+            }
+        }
+    }
+}
+
+/*
+ * consume
+ *      Aggregate the selected rows of the row group. Returns false, without
+ *      consuming anything, if some of the columns cannot be used directly.
+ */
+bool
+GroupAggregator::consume(const RowGroupBatch &batch)
+{
+    int64       nrows = batch.num_rows;
+    size_t      nkeys = keys.size();
+    std::vector<int32> gids(nrows);
+
+    for (size_t k = 0; k < nkeys; k++)
+        if (!column_supported(batch.columns[keys[k] - 1].get(), key_types[k]))
+            return false;
+
+    for (size_t a = 0; a < aggs.size(); a++)
+    {
+        switch (aggs[a].kind)
+        {
+            case AK_COUNT_STAR:
+            case AK_COUNT:
+            case AK_GROUP_KEY:
+                break;
+            default:
+                if (cmpfuncs[a] != NULL ||
+                    !column_supported(batch.columns[aggs[a].attnum - 1].get(),
+                                      aggs[a].type))
+                    return false;
+        }
+    }
+
+    /* Group numbers of the rows */
+    if (nkeys == 0)
+    {
+        for (int64 i = 0; i < nrows; i++)
+            gids[i] = 0;
+    }
+    else
+    {
+        std::vector<int64>      parts(nrows * nkeys, 0);
+        std::vector<uint8_t>    nulls(nrows * nkeys, 1);
+        std::string             key;
+
+        for (size_t k = 0; k < nkeys; k++)
+        {
+            auto   &column = batch.columns[keys[k] - 1];
+
+            if (column)
+                key_parts(column.get(), key_types[k], parts.data() + k,
+                          nulls.data() + k, nkeys);
+        }
+
+        for (int64 i = 0; i < nrows; i++)
+        {
+            if (batch.selection && !batch.selection[i])
+                continue;
+
+            key.clear();
+            for (size_t k = 0; k < nkeys; k++)
+            {
+                key.push_back((char) nulls[i * nkeys + k]);
+                key.append((const char *) &parts[i * nkeys + k], sizeof(int64));
+            }
+            gids[i] = lookup_group(key);
+        }
+    }
+
+    if (batch.selection)
+        for (int64 i = 0; i < nrows; i++)
+            if (!batch.selection[i])
+                gids[i] = -1;
+
+    for (size_t a = 0; a < aggs.size(); a++)
+    {
+        switch (aggs[a].kind)
+        {
+            case AK_GROUP_KEY:
+                break;
+            case AK_COUNT_STAR:
+                for (int64 i = 0; i < nrows; i++)
+                    if (gids[i] >= 0)
+                        accums[gids[i] * aggs.size() + a].count++;
+                break;
+            default:
+                accumulate(a, batch.columns[aggs[a].attnum - 1].get(), gids.data());
+        }
+    }
+
+    return true;
+}
+
+/*
+ * update_value
+ *      Advance MIN/MAX of a type compared by its btree support function.
+ */
+void
+GroupAggregator::update_value(Accum &acc, size_t a, Datum value)
+{
+    AggregateSpec  &agg = aggs[a];
+
+    PG_TRY_THROW(
+        {
+            bool    replace = acc.isnull;
+
+            if (!replace)
+            {
+                int cmp = DatumGetInt32(FunctionCall2Coll(cmpfuncs[a], agg.collid,
+                                                          value, acc.value));
+
+                replace = agg.kind == AK_MIN ? cmp < 0 : cmp > 0;
+            }
+            if (replace)
+            {
+                MemoryContext oldcxt = MemoryContextSwitchTo(cxt);
+
+                if (!acc.isnull && !typbyvals[a])
+                    pfree(DatumGetPointer(acc.value));
+                acc.value = datumCopy(value, typbyvals[a], typlens[a]);
+                acc.isnull = false;
+                MemoryContextSwitchTo(oldcxt);
+            }
+        });
+}
+
+/*
+ * consume
+ *      Aggregate the row stored in the slot.
+ */
+void
+GroupAggregator::consume(TupleTableSlot *slot)
+{
+    std::string key;
+    int32       g;
+
+    for (size_t k = 0; k < keys.size(); k++)
+    {
+        Oid     type = key_types[k];
+        bool    isnull;
+        Datum   value = slot_getattr(slot, keys[k], &isnull);
+        int64   part = 0;
+
+        if (!isnull)
+        {
+            if (is_string_type(type))
+                part = string_id(VARDATA_ANY(DatumGetPointer(value)),
+                                 VARSIZE_ANY_EXHDR(DatumGetPointer(value)));
+            else if (type == FLOAT4OID)
+                part = float_key(DatumGetFloat4(value));
+            else if (type == FLOAT8OID)
+                part = float_key(DatumGetFloat8(value));
+            else
+                part = datum_to_int64(type, value);
+        }
+        key.push_back((char) isnull);
+        key.append((const char *) &part, sizeof(int64));
+    }
+    g = lookup_group(key);
+
+    for (size_t a = 0; a < aggs.size(); a++)
+    {
+        AggregateSpec  &agg = aggs[a];
+        Accum          &acc = accums[g * aggs.size() + a];
+        Datum           value;
+        bool            isnull;
+
+        if (agg.kind == AK_GROUP_KEY)
+            continue;
+        if (agg.kind == AK_COUNT_STAR)
+        {
+            acc.count++;
+            continue;
+        }
+
+        value = slot_getattr(slot, agg.attnum, &isnull);
+        if (isnull)
+            continue;
+
+        if (agg.kind == AK_COUNT)
+            acc.count++;
+        else if (cmpfuncs[a] != NULL)
+            update_value(acc, a, value);
+        else if (agg.type == FLOAT4OID)
+            update_float(acc, agg, DatumGetFloat4(value));
+        else if (agg.type == FLOAT8OID)
+            update_float(acc, agg, DatumGetFloat8(value));
+        else
+            update_integer(acc, agg, datum_to_int64(agg.type, value));
+    }
+}
+
+Datum
+GroupAggregator::key_datum(Oid type, int64 part)
+{
+    if (is_string_type(type))
+    {
+        const std::string &s = strings[part];
+
+        return PointerGetDatum(cstring_to_text_with_len(s.c_str(), s.length()));
+    }
+    if (is_float_type(type))
+    {
+        double  v;
+
+        memcpy(&v, &part, sizeof(v));
+        return type == FLOAT4OID ? Float4GetDatum((float) v) : Float8GetDatum(v);
+    }
+    return int64_to_datum(type, part);
+}
+
+/*
+ * result
+ *      Final (or, in partial mode, transition) value of the aggregate.
+ */
+Datum
+GroupAggregator::result(const Accum &acc, size_t a, bool *isnull)
+{
+    const AggregateSpec &agg = aggs[a];
+
+    *isnull = false;
+    switch (agg.kind)
+    {
+        case AK_COUNT_STAR:
+        case AK_COUNT:
+            return Int64GetDatum(acc.count);
+
+        case AK_MIN:
+        case AK_MAX:
+            *isnull = acc.isnull;
+            if (acc.isnull)
+                return (Datum) 0;
+            if (cmpfuncs[a] != NULL)
+                return acc.value;
+            if (is_float_type(agg.type))
+                return agg.type == FLOAT4OID ?
+                    Float4GetDatum((float) acc.fvalue) : Float8GetDatum(acc.fvalue);
+            return int64_to_datum(agg.type, acc.ivalue);
+
+        case AK_SUM:
+            *isnull = acc.count == 0;
+            if (acc.count == 0)
+                return (Datum) 0;
+            switch (agg.type)
+            {
+                case FLOAT4OID:
+                    return Float4GetDatum((float) acc.fsum);
+                case FLOAT8OID:
+                    return Float8GetDatum(acc.fsum);
+#ifdef HAVE_INT128
+                case INT8OID:
+                    return int128_to_numeric(acc.bigsum);
+#endif
+                default:
+                    return Int64GetDatum(acc.isum);
+            }
+
+        case AK_AVG:
+            if (partial)
+            {
+                /* Transition arrays of int4_avg_accum() and float8_accum() */
+                Datum   values[3];
+
+                if (is_float_type(agg.type))
+                {
+                    values[0] = Float8GetDatum((double) acc.count);
+                    values[1] = Float8GetDatum(acc.fsum);
+                    values[2] = Float8GetDatum(acc.fsumsq);
+                    return PointerGetDatum(construct_array(values, 3, FLOAT8OID,
+                                                           sizeof(float8),
+                                                           FLOAT8PASSBYVAL, 'd'));
+                }
+                values[0] = Int64GetDatum(acc.count);
+                values[1] = Int64GetDatum(acc.isum);
+                return PointerGetDatum(construct_array(values, 2, INT8OID,
+                                                       sizeof(int64),
+                                                       FLOAT8PASSBYVAL, 'd'));
+            }
+
+            *isnull = acc.count == 0;
+            if (acc.count == 0)
+                return (Datum) 0;
+            if (is_float_type(agg.type))
+                return Float8GetDatum(acc.fsum / acc.count);
+#ifdef HAVE_INT128
+            if (agg.type == INT8OID)
+                return DirectFunctionCall2(numeric_div,
+                                           int128_to_numeric(acc.bigsum),
+                                           DirectFunctionCall1(int8_numeric,
+                                                               Int64GetDatum(acc.count)));
+#endif
+            return DirectFunctionCall2(numeric_div,
+                                       DirectFunctionCall1(int8_numeric,
+                                                           Int64GetDatum(acc.isum)),
+                                       DirectFunctionCall1(int8_numeric,
+                                                           Int64GetDatum(acc.count)));
+
+        default:
+            return (Datum) 0;
+    }
+}
+
+/*
+ * next
+ *      Store the next group into the slot. Returns false if there are no
+ *      more groups. Values are allocated in the current memory context.
+ */
+bool
+GroupAggregator::next(TupleTableSlot *slot)
+{
+    size_t      g;
+
+    if (output_group >= group_keys.size())
+        return false;
+    g = output_group++;
+
+    for (size_t a = 0; a < aggs.size(); a++)
+    {
+        if (aggs[a].kind == AK_GROUP_KEY)
+        {
+            const std::string &key = group_keys[g];
+            size_t      k = 0;
+            int64       part;
+
+            while (keys[k] != aggs[a].attnum)
+                k++;
+
+            slot->tts_isnull[a] = key[k * KEY_PART_SIZE] != 0;
+            memcpy(&part, key.data() + k * KEY_PART_SIZE + 1, sizeof(int64));
+            slot->tts_values[a] = slot->tts_isnull[a] ?
+                (Datum) 0 : key_datum(key_types[k], part);
+            continue;
+        }
+
+        slot->tts_values[a] = result(accums[g * aggs.size() + a], a,
+                                     &slot->tts_isnull[a]);
+    }
+
+    return true;
+}
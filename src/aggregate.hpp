@@ -0,0 +1,150 @@
+/*-------------------------------------------------------------------------
+ *
+ * aggregate.hpp
+ *		  Aggregation done by the foreign scan for parquet_s3_fdw
+ *
+ * Portions Copyright (c) 2021, TOSHIBA CORPORATION
+ *
+ * IDENTIFICATION
+ *		  contrib/parquet_s3_fdw/src/aggregate.hpp
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PARQUET_FDW_AGGREGATE_HPP
+#define PARQUET_FDW_AGGREGATE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "reader.hpp"
+
+extern "C"
+{
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/tupdesc.h"
+#include "executor/tuptable.h"
+}
+
+
+enum AggregateKind
+{
+    AK_COUNT_STAR = 0,
+    AK_COUNT,
+    AK_MIN,
+    AK_MAX,
+    AK_SUM,
+    AK_AVG,
+    AK_GROUP_KEY    /* not an aggregate, outputs the grouping column */
+};
+
+/*
+ * Aggregate computed by the scan itself, see parquetGetForeignUpperPaths().
+ * The initial value is the result for the row groups answered from metadata.
+ */
+struct AggregateSpec
+{
+    AggregateKind   kind;
+    AttrNumber      attnum;     /* argument, except for COUNT(*) */
+    Oid             type;       /* argument type, except for COUNT */
+    Oid             collid;
+    int64           count;      /* COUNT */
+    Datum           value;      /* MIN/MAX */
+    bool            isnull;
+};
+
+/*
+ * GroupAggregator
+ *      Hash aggregation of the rows of a scan. Rows are either consumed a row
+ *      group at a time straight from arrow arrays or one by one from tuple
+ *      slots; both ways may be mixed. Groups are kept in memory.
+ *
+ *      In partial mode the transition values of the aggregates are returned
+ *      instead of the final ones, so that they can be combined by a Finalize
+ *      Aggregate node.
+ */
+class GroupAggregator
+{
+private:
+    /* Running values of an aggregate for a group */
+    struct Accum
+    {
+        int64       count;      /* rows, or values seen by SUM/AVG */
+        int64       isum;       /* SUM/AVG of smallint and integer */
+#ifdef HAVE_INT128
+        int128      bigsum;     /* SUM/AVG of bigint */
+#endif
+        double      fsum;       /* SUM/AVG of real and double precision */
+        double      fsumsq;     /* see float8_accum() */
+        int64       ivalue;     /* MIN/MAX of integer-like types */
+        double      fvalue;     /* MIN/MAX of floats */
+        Datum       value;      /* MIN/MAX of other types */
+        bool        isnull;     /* no MIN/MAX value yet */
+    };
+
+    MemoryContext               cxt;
+    TupleDesc                   tuple_desc;
+    std::vector<AttrNumber>     keys;
+    std::vector<Oid>            key_types;
+    std::vector<AggregateSpec>  aggs;
+    std::vector<FmgrInfo *>     cmpfuncs;   /* MIN/MAX of other types */
+    std::vector<int16>          typlens;
+    std::vector<bool>           typbyvals;
+    bool                        partial;
+
+    /*
+     * Groups are identified by the concatenation of their key values, each
+     * represented as a null flag and an int64 (see key_parts()). Strings are
+     * represented by their number in "strings".
+     */
+    std::unordered_map<std::string, int32>  groups;
+    std::vector<std::string>                group_keys;
+    std::vector<Accum>                      accums;     /* per group and aggregate */
+    std::unordered_map<std::string, int64>  string_ids;
+    std::vector<std::string>                strings;
+
+    /*
+     * Approximate memory used by the groups and by the strings of their keys,
+     * which must stay within work_mem.
+     */
+    Size                        group_mem;
+    Size                        string_mem;
+    Size                        mem_limit;
+
+    size_t                      output_group;
+
+private:
+    int32 lookup_group(const std::string &key);
+    int64 string_id(const char *data, size_t len);
+    void check_memory();
+    void init_accum(Accum &acc, const AggregateSpec &agg);
+    bool column_supported(const arrow::ChunkedArray *column, Oid type);
+    void key_parts(const arrow::ChunkedArray *column, Oid type,
+                   int64 *parts, uint8_t *nulls, size_t stride);
+    void accumulate(size_t a, const arrow::ChunkedArray *column,
+                    const int32 *gids);
+    static void update_integer(Accum &acc, const AggregateSpec &agg, int64 v);
+    static void update_float(Accum &acc, const AggregateSpec &agg, double v);
+    void update_value(Accum &acc, size_t a, Datum value);
+    Datum key_datum(Oid type, int64 part);
+    Datum result(const Accum &acc, size_t a, bool *isnull);
+
+public:
+    GroupAggregator(MemoryContext cxt, TupleDesc tuple_desc,
+                    const std::vector<AttrNumber> &keys,
+                    const std::vector<AggregateSpec> &aggs, bool partial);
+
+    bool consume(const RowGroupBatch &batch);
+    void consume(TupleTableSlot *slot);
+    bool next(TupleTableSlot *slot);
+    void reset();
+
+    friend Size aggregate_group_size(int nkeys, int naggs);
+};
+
+bool aggregate_key_supported(Oid type);
+bool aggregate_supported(AggregateKind kind, Oid type, bool partial);
+Size aggregate_group_size(int nkeys, int naggs);
+
+#endif
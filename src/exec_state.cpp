@@ -15,9 +15,29 @@
 #include "heap.hpp"
 
 #include <sys/time.h>
-#include <functional>
 #include <list>
 
+extern "C"
+{
+#include "catalog/pg_type.h"
+#include "executor/executor.h"
+#include "utils/memutils.h"
+}
+
+/*
+ * Number of key ranges per parallel participant in parallel merge. More
+ * ranges than participants let the faster ones take over the remaining work.
+ */
+#define MERGE_RANGES_PER_WORKER 4
+
+/*
+ * After this many consecutive rows for which the merge found no run of the
+ * winning reader it probes less and less often, up to once per
+ * MERGE_RUN_MAX_BACKOFF rows, so that interleaved files are merged about as
+ * fast as without looking for runs.
+ */
+#define MERGE_RUN_MISSES 4
+#define MERGE_RUN_MAX_BACKOFF 1024
 
 #if PG_VERSION_NUM < 110000
 #define MakeTupleTableSlotCompat(tupleDesc) MakeSingleTupleTableSlot(tupleDesc)
@@ -42,6 +62,25 @@
     } while(0)
 
 
+/*
+ * next_rowgroup
+ *      Read the next row group as a whole. Its rows can then be read one by
+ *      one with next_rowgroup_row(). Only supported by the plain (non merging)
+ *      execution states.
+ */
+bool
+ParquetS3FdwExecutionState::next_rowgroup(RowGroupBatch &)
+{
+    throw std::runtime_error("reading whole row groups is not supported by the execution state");
+}
+
+bool
+ParquetS3FdwExecutionState::next_rowgroup_row(TupleTableSlot *)
+{
+    throw std::runtime_error("reading whole row groups is not supported by the execution state");
+}
+
+
 class TrivialExecutionStateS3 : public ParquetS3FdwExecutionState
 {
 public:
@@ -49,6 +88,14 @@ public:
     {
         return false;
     }
+    bool next_rowgroup(RowGroupBatch &)
+    {
+        return false;
+    }
+    bool next_rowgroup_row(TupleTableSlot *)
+    {
+        return false;
+    }
     void rescan(void) {}
     void add_file(const char *, List *)
     {
@@ -98,8 +145,8 @@ public:
                              bool schemaless,
                              std::set<std::string> slcols,
                              std::set<std::string> sorted_cols)
-        : cxt(cxt), tuple_desc(tuple_desc), relid(relid), attrs_used(attrs_used),
-          use_mmap(use_mmap), use_threads(use_threads),
+        : reader(NULL), cxt(cxt), tuple_desc(tuple_desc), relid(relid),
+          attrs_used(attrs_used), use_mmap(use_mmap), use_threads(use_threads),
           dirname(dirname), s3_client(s3_client), schemaless(schemaless),
           slcols(slcols), sorted_cols(sorted_cols)
     { }
@@ -120,11 +167,32 @@ public:
         return res == RS_SUCCESS;
     }
 
+    bool next_rowgroup(RowGroupBatch &batch)
+    {
+        return reader->next_rowgroup(batch) == RS_SUCCESS;
+    }
+
+    bool next_rowgroup_row(TupleTableSlot *slot)
+    {
+        if (reader->next_rowgroup_row(slot) != RS_SUCCESS)
+            return false;
+
+        ExecStoreVirtualTuple(slot);
+        return true;
+    }
+
     void rescan(void)
     {
         reader->rescan();
     }
 
+    void set_row_filters(const std::vector<RowFilter> &filters)
+    {
+        this->row_filters = filters;
+        if (reader)
+            reader->set_row_filters(filters);
+    }
+
     void add_file(const char *filename, List *rowgroups)
     {
         ListCell           *lc;
@@ -141,6 +209,8 @@ public:
         else
             reader->open();
         reader->set_schemaless_info(schemaless, slcols, sorted_cols);
+        reader->set_row_filters(row_filters);
+        reader->set_limit(limit_rows);
         reader->create_column_mapping(tuple_desc, relid, attrs_used);
     }
 
@@ -170,6 +240,7 @@ private:
     {
         std::string         filename;
         std::vector<int>    rowgroups;
+        std::vector<int32>  sizes;      /* compressed kB, if known */
     };
 private:
     ParquetReader          *reader;
@@ -192,29 +263,56 @@ private:
     std::set<std::string>   sorted_cols;
 
 private:
+    /*
+     * get_next_reader
+     *      Replace the current reader with the one for the next portion of
+     *      work. In parallel query that is a single row group claimed from
+     *      the coordinator's queue; the current reader is reused if the row
+     *      group belongs to the same file.
+     */
     ParquetReader *get_next_reader()
     {
         ParquetReader *r;
+        std::vector<int> rowgroups;
 
         if (coord)
         {
-            coord->lock();
-            cur_reader = coord->next_reader();
-            coord->unlock();
+            ParallelCoordinator::WorkItem item;
+
+            if (!coord->next_item(&item))
+            {
+                delete reader;
+                return NULL;
+            }
+
+            rowgroups.push_back(files[item.reader].rowgroups[item.rowgroup]);
+            if (reader && reader->id() == item.reader)
+            {
+                reader->set_rowgroups_list(rowgroups);
+                reader->rescan();
+                return reader;
+            }
+            cur_reader = item.reader;
         }
+        else if (cur_reader < files.size())
+            rowgroups = files[cur_reader].rowgroups;
+
+        delete reader;
+        reader = NULL;
 
-        if (cur_reader >= files.size() || cur_reader < 0)
+        if (cur_reader >= files.size())
             return NULL;
 
         r = create_parquet_reader(files[cur_reader].filename.c_str(), cxt, cur_reader);
-        r->set_rowgroups_list(files[cur_reader].rowgroups);
+        r->set_rowgroups_list(rowgroups);
         r->set_options(use_threads, use_mmap);
-        r->set_coordinator(coord);
         if (s3_client)
             r->open(dirname, s3_client);
         else
             r->open();
         r->set_schemaless_info(schemaless, slcols, sorted_cols);
+        r->set_row_filters(row_filters);
+        r->set_limit(limit_rows);
         r->create_column_mapping(tuple_desc, relid, attrs_used);
 
         cur_reader++;
@@ -263,9 +361,6 @@ public:
         {
             while (true)
             {
-                if (reader)
-                    delete reader;
-
                 reader = this->get_next_reader();
                 if (!reader)
                     return false;
@@ -287,9 +382,47 @@ public:
         return res;
     }
 
+    bool next_rowgroup(RowGroupBatch &batch)
+    {
+        if (unlikely(reader == NULL))
+        {
+            if ((reader = this->get_next_reader()) == NULL)
+                return false;
+        }
+
+        /* Finished reading current reader? Proceed to the next one */
+        while (reader->next_rowgroup(batch) != RS_SUCCESS)
+        {
+            reader = this->get_next_reader();
+            if (!reader)
+                return false;
+        }
+
+        return true;
+    }
+
+    bool next_rowgroup_row(TupleTableSlot *slot)
+    {
+        if (reader == NULL || reader->next_rowgroup_row(slot) != RS_SUCCESS)
+            return false;
+
+        ExecStoreVirtualTuple(slot);
+        return true;
+    }
+
     void rescan(void)
     {
-        reader->rescan();
+        /* Start over from the first file, the reader may be gone already */
+        delete reader;
+        reader = NULL;
+        cur_reader = 0;
+    }
+
+    void set_row_filters(const std::vector<RowFilter> &filters)
+    {
+        this->row_filters = filters;
+        if (reader)
+            reader->set_row_filters(filters);
     }
 
     void add_file(const char *filename, List *rowgroups)
@@ -303,6 +436,25 @@ public:
         files.push_back(fr);
     }
 
+    void set_rowgroup_sizes(List *sizes_list)
+    {
+        ListCell   *lc;
+        size_t      i = 0;
+
+        foreach (lc, sizes_list)
+        {
+            List       *sizes = (List *) lfirst(lc);
+            ListCell   *lc2;
+
+            if (i >= files.size())
+                break;
+            files[i].sizes.clear();
+            foreach (lc2, sizes)
+                files[i].sizes.push_back(lfirst_int(lc2));
+            i++;
+        }
+    }
+
     void set_coordinator(ParallelCoordinator *coord)
     {
         this->coord = coord;
@@ -310,20 +462,33 @@ public:
 
     Size estimate_coord_size()
     {
-        return sizeof(ParallelCoordinator) + sizeof(int32) * files.size();
+        Size    nitems = 0;
+
+        for (auto &file : files)
+            nitems += file.rowgroups.size();
+        return sizeof(ParallelCoordinator) +
+            sizeof(ParallelCoordinator::WorkItem) * nitems;
     }
 
     void init_coord()
     {
-        ParallelCoordinator *coord = (ParallelCoordinator *) this->coord;
-        int32  *nrowgroups;
-        int     i = 0;
+        std::vector<ParallelCoordinator::WorkItem> items;
 
-        nrowgroups = (int32 *) palloc(sizeof(int32) * files.size());
-        for (auto &file : files)
-            nrowgroups[i++] = file.rowgroups.size();
-        coord->init_single(nrowgroups, files.size());
-        pfree(nrowgroups);
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            auto   &file = files[i];
+
+            for (size_t j = 0; j < file.rowgroups.size(); j++)
+            {
+                ParallelCoordinator::WorkItem item;
+
+                item.reader = i;
+                item.rowgroup = j;
+                item.size = j < file.sizes.size() ? file.sizes[j] : 0;
+                items.push_back(item);
+            }
+        }
+        coord->init_queue(items.data(), items.size());
     }
 };
 
@@ -334,6 +499,31 @@ protected:
     {
         int             reader_id;
         TupleTableSlot *slot;
+        Datum           key;        /* first sort key, see fetch_key() */
+        bool            key_isnull;
+    };
+
+    /* Lets the merge tree call compare_slots() inline */
+    struct SlotComparator
+    {
+        MultifileMergeExecutionStateBaseS3 *state;
+
+        bool operator()(const ReaderSlot &a, const ReaderSlot &b) const
+        {
+            return state->compare_slots(a, b);
+        }
+    };
+
+    /*
+     * How compare_slots() compares the slots. Single sort key is kept in
+     * ReaderSlot so that it is not extracted from the slot on every
+     * comparison; keys of integer-like types are compared directly.
+     */
+    enum KeyCompare
+    {
+        KC_GENERIC = 0,
+        KC_SINGLE_KEY,
+        KC_INT_KEY
     };
 
 protected:
@@ -349,14 +539,14 @@ protected:
     ParallelCoordinator *coord;
 
     /*
-     * Heap is used to store tuples in prioritized manner along with file
-     * number. Priority is given to the tuples with minimal key. Once next
-     * tuple is requested it is being taken from the top of the heap and a new
-     * tuple from the same file is read and inserted back into the heap. Then
-     * heap is rebuilt to sustain its properties. The idea is taken from
-     * nodeGatherMerge.c in PostgreSQL but reimplemented using STL.
+     * Loser tree is used to store tuples in prioritized manner along with
+     * file number. Priority is given to the tuples with minimal key. Once
+     * next tuple is requested it is being taken from the winner of the tree
+     * and a new tuple from the same file is read and replaces it. Then the
+     * matches on the way from its leaf to the root are replayed.
      */
-    Heap<ReaderSlot>    slots;
+    LoserTree<ReaderSlot, SlotComparator> slots;
+    KeyCompare          key_compare = KC_GENERIC;
     bool                slots_initialized;
     const char         *dirname;
     Aws::S3::S3Client  *s3_client;
@@ -370,7 +560,7 @@ protected:
      *      false otherwise. The function is stolen from nodeGatherMerge.c
      *      (postgres) and adapted.
      */
-    bool compare_slots(const ReaderSlot &a, const ReaderSlot &b)
+    inline bool compare_slots(const ReaderSlot &a, const ReaderSlot &b)
     {
         TupleTableSlot *s1 = a.slot;
         TupleTableSlot *s2 = b.slot;
@@ -378,7 +568,22 @@ protected:
         Assert(!TupIsNull(s1));
         Assert(!TupIsNull(s2));
 
-        for (auto sort_key: sort_keys)
+        switch (key_compare)
+        {
+            case KC_INT_KEY:
+                /* NULLs go last */
+                if (unlikely(a.key_isnull || b.key_isnull))
+                    return a.key_isnull && !b.key_isnull;
+                return DatumGetInt64(a.key) > DatumGetInt64(b.key);
+            case KC_SINGLE_KEY:
+                return ApplySortComparator(a.key, a.key_isnull,
+                                           b.key, b.key_isnull,
+                                           &sort_keys.front()) > 0;
+            case KC_GENERIC:
+                break;
+        }
+
+        for (auto &sort_key: sort_keys)
         {
             AttrNumber  attno = sort_key.ssup_attno;
             Datum       datum1,
@@ -419,6 +624,54 @@ protected:
         return false;
     }
 
+    /*
+     * init_slots
+     *      Prepare the merge tree for the readers and choose how to compare
+     *      the slots. Integer-like keys are compared as int64 which is what
+     *      their default ordering operators do.
+     */
+    void init_slots()
+    {
+        SlotComparator  cmp = { this };
+
+        key_compare = KC_GENERIC;
+        if (!this->schemaless && sort_keys.size() == 1)
+        {
+            SortSupport ssup = &sort_keys.front();
+
+            key_compare = KC_SINGLE_KEY;
+            if (FLOAT8PASSBYVAL && !ssup->ssup_reverse && !ssup->ssup_nulls_first)
+            {
+                switch (TupleDescAttr(tuple_desc, ssup->ssup_attno - 1)->atttypid)
+                {
+                    case INT2OID:
+                    case INT4OID:
+                    case INT8OID:
+                    case DATEOID:
+                    case TIMESTAMPOID:
+                    case TIMESTAMPTZOID:
+                        key_compare = KC_INT_KEY;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        slots.init(readers.size(), cmp);
+    }
+
+    /*
+     * fetch_key
+     *      Remember the sort key of a freshly read tuple for compare_slots().
+     */
+    inline void fetch_key(ReaderSlot &rs)
+    {
+        if (key_compare != KC_GENERIC)
+            rs.key = slot_getattr(rs.slot, sort_keys.front().ssup_attno,
+                                  &rs.key_isnull);
+    }
+
     void set_coordinator(ParallelCoordinator *coord)
     {
         this->coord = coord;
@@ -463,45 +716,486 @@ protected:
 class MultifileMergeExecutionStateS3 : public MultifileMergeExecutionStateBaseS3
 {
 private:
+    struct PendingReader
+    {
+        int             reader_id;
+        Datum           bound;
+    };
+
     /*
-     * initialize_slots
-     *      Initialize slots binary heap on the first run.
+     * Readers which have not been read from yet, ordered by the bound of the
+     * first sort key taken from row group statistics: the lower one for an
+     * ascending key, the upper one for a descending key. A reader joins the
+     * merge tree only once the merge reaches its bound, so with a LIMIT the
+     * files whose ranges lie past the first N rows are never read.
      */
-    void initialize_slots()
+    std::vector<PendingReader> pending;
+    size_t              next_pending;
+
+    /*
+     * Files are only kept open while their readers are in the merge tree.
+     * The column mapping is created when a file is opened the first time and
+     * survives closing it.
+     */
+    enum ReaderState : uint8_t
     {
-        std::function<bool(const ReaderSlot &, const ReaderSlot &)> cmp =
-            [this] (const ReaderSlot &a, const ReaderSlot &b) { return compare_slots(a, b); };
-        int i = 0;
+        READER_NEW = 0,
+        READER_OPEN,
+        READER_CLOSED
+    };
 
-        slots.init(readers.size(), cmp);
-        for (auto reader: readers)
+    std::vector<uint8_t> reader_state;
+
+    /*
+     * In parallel query the first sort key may be split into ranges by the
+     * coordinator, see init_coord(). The participant merges the rows of one
+     * range at a time, reading only row groups which overlap it.
+     */
+    struct RowGroupBounds
+    {
+        int             rowgroup;
+        bool            known;
+        Datum           min;
+        Datum           max;
+    };
+
+    std::vector<std::vector<int> > rowgroups;   /* per reader */
+    std::vector<std::vector<RowGroupBounds> > rowgroup_bounds;
+    bool                ranged;
+    Datum               range_lower;
+    Datum               range_upper;
+    bool                has_range_lower;
+    bool                has_range_upper;
+
+    /*
+     * Rows of the winning reader which are known to sort before the best key
+     * of the other readers. They are read straight into the result slot
+     * without touching the merge tree; the head is advanced once the run is
+     * over.
+     */
+    uint32              run_rows;
+    bool                head_consumed;
+
+    /* Rows to merge before looking for a run again, see MERGE_RUN_MISSES */
+    uint32              run_misses;
+    uint32              run_backoff;
+    uint32              run_wait;
+
+private:
+    /*
+     * range_sort_key
+     *      First sort key if it can be split into ranges, which requires it
+     *      to be ascending. Statistics are only known for integer-like types
+     *      (see ParquetReader::statistics_type()) whose comparators cannot
+     *      fail, so there is no need to protect them with PG_TRY. The range
+     *      boundaries are copied into shared memory as Datums, so int8 and
+     *      timestamps have to be passed by value for them to mean anything
+     *      to the other participants.
+     */
+    SortSupport range_sort_key()
+    {
+        if (!FLOAT8PASSBYVAL || this->schemaless || sort_keys.empty() ||
+            sort_keys.front().ssup_reverse)
+            return NULL;
+        return &sort_keys.front();
+    }
+
+    /*
+     * collect_rowgroup_bounds
+     *      Fetch statistics of the first sort key for every row group to read.
+     *      Returns false if some of them are unknown.
+     */
+    bool collect_rowgroup_bounds()
+    {
+        SortSupport first_key = range_sort_key();
+        bool        all_known = true;
+
+        if (!first_key)
+            return false;
+
+        rowgroup_bounds.clear();
+        rowgroup_bounds.resize(readers.size());
+        for (size_t i = 0; i < readers.size(); i++)
         {
-            ReaderSlot    rs;
+            bool    was_open = reader_state[i] == READER_OPEN;
 
-            PG_TRY_INLINE(
+            open_reader(i);
+            for (int rowgroup : rowgroups[i])
+            {
+                RowGroupBounds  b;
+
+                b.rowgroup = rowgroup;
+                b.known = readers[i]->rowgroup_bounds(first_key->ssup_attno,
+                                                      rowgroup, &b.min, &b.max);
+                all_known &= b.known;
+                rowgroup_bounds[i].push_back(b);
+            }
+            if (!was_open)
+                close_reader(i);
+        }
+        return all_known;
+    }
+
+    /*
+     * start_next_range
+     *      Claim the next key range from the coordinator and restrict the
+     *      readers to the row groups overlapping it. Returns false if there
+     *      are no ranges left.
+     */
+    bool start_next_range()
+    {
+        SortSupport first_key = range_sort_key();
+
+        if (!coord->next_range(&range_lower, &has_range_lower,
+                               &range_upper, &has_range_upper))
+            return false;
+
+        if (rowgroup_bounds.empty())
+            collect_rowgroup_bounds();
+
+        for (size_t i = 0; i < readers.size(); i++)
+        {
+            std::vector<int> rg;
+
+            for (auto &b : rowgroup_bounds[i])
+            {
+                if (b.known && first_key)
                 {
-                    MemoryContext oldcxt;
+                    if (has_range_lower &&
+                        ApplySortComparator(b.max, false, range_lower, false,
+                                            first_key) < 0)
+                        continue;
+                    if (has_range_upper &&
+                        ApplySortComparator(b.min, false, range_upper, false,
+                                            first_key) >= 0)
+                        continue;
+                }
+                rg.push_back(b.rowgroup);
+            }
+            readers[i]->set_rowgroups_list(rg);
+            readers[i]->rescan();
+        }
 
-                    oldcxt = MemoryContextSwitchTo(cxt);
-                    rs.slot = MakeTupleTableSlotCompat(tuple_desc);
-                    MemoryContextSwitchTo(oldcxt);
-                }, "failed to create a TupleTableSlot"
+        slots.clear();
+        initialize_slots();
+        return true;
+    }
+
+    /*
+     * key_in_range
+     *      Compare the first sort key of the slot with the current range.
+     *      Returns -1 if the key is below the range, 1 if above and 0 if it
+     *      is within the range.
+     */
+    int key_in_range(TupleTableSlot *s)
+    {
+        SortSupport first_key = range_sort_key();
+        Datum       key;
+        bool        isnull;
+
+        key = slot_getattr(s, first_key->ssup_attno, &isnull);
+        if (has_range_lower &&
+            ApplySortComparator(key, isnull, range_lower, false, first_key) < 0)
+            return -1;
+        if (has_range_upper &&
+            ApplySortComparator(key, isnull, range_upper, false, first_key) >= 0)
+            return 1;
+        return 0;
+    }
+
+    /*
+     * advance_head
+     *      Try to read another record from the same reader as in the head
+     *      slot. In case of success the new record replaces the head and the
+     *      matches of its leaf get replayed. Else if there are no more records
+     *      in the reader then its leaf is emptied, the matches replayed and
+     *      its file closed.
+     */
+    void advance_head()
+    {
+        ReaderSlot &head = slots.head();
+
+        if (readers[head.reader_id]->next(head.slot) == RS_SUCCESS)
+        {
+            ExecStoreVirtualTuple(head.slot);
+            fetch_key(head);
+            PG_TRY_INLINE({ slots.update_head(); }, "failed to update the merge tree");
+        }
+        else
+        {
+#if PG_VERSION_NUM < 110000
+            /* Release slot resources */
+            PG_TRY_INLINE(
+                {
+                    ExecDropSingleTupleTableSlot(head.slot);
+                }, "failed to drop a tuple slot"
             );
+#endif
+            int     reader_id = head.reader_id;
 
-            if (reader->next(rs.slot) == RS_SUCCESS)
+            slots.pop();
+            close_reader(reader_id);
+        }
+    }
+
+    /*
+     * open_reader
+     *      Open the file of the reader unless it is open already.
+     */
+    void open_reader(int reader_id)
+    {
+        ParquetReader  *r = readers[reader_id];
+
+        if (reader_state[reader_id] == READER_OPEN)
+            return;
+
+        if (s3_client)
+            r->open(dirname, s3_client);
+        else
+            r->open();
+
+        if (reader_state[reader_id] == READER_NEW)
+        {
+            r->set_schemaless_info(schemaless, slcols, sorted_cols);
+            r->create_column_mapping(tuple_desc, relid, attrs_used);
+        }
+        reader_state[reader_id] = READER_OPEN;
+    }
+
+    /*
+     * close_reader
+     *      Close the file of a reader which is not in the merge tree.
+     */
+    void close_reader(int reader_id)
+    {
+        if (reader_state[reader_id] != READER_OPEN)
+            return;
+
+        readers[reader_id]->close();
+        reader_state[reader_id] = READER_CLOSED;
+    }
+
+    /*
+     * start_reader
+     *      Read the first record of the reader and put it into its leaf of the
+     *      merge tree. Only if the tree is already built the matches of the
+     *      leaf get replayed.
+     */
+    void start_reader(int reader_id, bool built)
+    {
+        ReaderSlot    rs;
+
+        open_reader(reader_id);
+
+        PG_TRY_INLINE(
             {
-                ExecStoreVirtualTuple(rs.slot);
-                rs.reader_id = i;
-                slots.append(rs);
+                MemoryContext oldcxt;
+
+                oldcxt = MemoryContextSwitchTo(cxt);
+                rs.slot = MakeTupleTableSlotCompat(tuple_desc);
+                MemoryContextSwitchTo(oldcxt);
+            }, "failed to create a TupleTableSlot"
+        );
+
+        if (readers[reader_id]->next(rs.slot) == RS_SUCCESS)
+        {
+            ExecStoreVirtualTuple(rs.slot);
+            rs.reader_id = reader_id;
+            fetch_key(rs);
+            if (built)
+                PG_TRY_INLINE({ slots.insert(reader_id, rs); },
+                              "failed to update the merge tree");
+            else
+                slots.append(reader_id, rs);
+        }
+        else
+            close_reader(reader_id);
+    }
+
+    /*
+     * initialize_slots
+     *      Initialize the merge tree on the first run.
+     */
+    void initialize_slots()
+    {
+        SortSupport first_key = NULL;
+
+        /*
+         * Row group statistics can only bound a non-null key. The bounds are
+         * compared as int64, see ParquetReader::lower_bound().
+         */
+        if (FLOAT8PASSBYVAL && !this->schemaless && !sort_keys.empty())
+            first_key = &sort_keys.front();
+
+        init_slots();
+        pending.clear();
+        next_pending = 0;
+        run_rows = 0;
+        head_consumed = false;
+        run_misses = 0;
+        run_backoff = 0;
+        run_wait = 0;
+
+        for (size_t i = 0; i < readers.size(); ++i)
+        {
+            PendingReader   p;
+            bool            bounded = false;
+
+            /* Statistics are in the footer, the file has to be opened */
+            if (first_key)
+            {
+                open_reader(i);
+                bounded = first_key->ssup_reverse ?
+                    readers[i]->upper_bound(first_key->ssup_attno, &p.bound) :
+                    readers[i]->lower_bound(first_key->ssup_attno, &p.bound);
             }
-            ++i;
+
+            if (bounded)
+            {
+                p.reader_id = i;
+                pending.push_back(p);
+                close_reader(i);
+            }
+            else
+                start_reader(i, false);
         }
+
+        /* ApplySortComparator() takes care of descending keys */
+        PG_TRY_INLINE(
+            {
+                std::stable_sort(pending.begin(), pending.end(),
+                    [first_key] (const PendingReader &a, const PendingReader &b)
+                    {
+                        return ApplySortComparator(a.bound, false,
+                                                   b.bound, false,
+                                                   first_key) < 0;
+                    });
+            }, "failed to sort files by statistics"
+        );
+
         if (this->schemaless)
             get_schemaless_sortkeys();
-        PG_TRY_INLINE({ slots.heapify(); }, "heapify failed");
+        PG_TRY_INLINE({ slots.build(); }, "failed to build the merge tree");
         slots_initialized = true;
     }
 
+    /*
+     * start_pending_readers
+     *      Move pending readers into the merge tree while it is empty or
+     *      their bound does not sort after the current head key.
+     */
+    void start_pending_readers()
+    {
+        SortSupport first_key = &sort_keys.front();
+
+        while (next_pending < pending.size())
+        {
+            PendingReader &p = pending[next_pending];
+
+            if (!slots.empty())
+            {
+                Datum   head_key;
+                bool    isnull;
+                int     compare;
+
+                PG_TRY_INLINE(
+                    {
+                        head_key = slot_getattr(slots.head().slot,
+                                                first_key->ssup_attno,
+                                                &isnull);
+                        compare = ApplySortComparator(p.bound, false,
+                                                      head_key, isnull,
+                                                      first_key);
+                    }, "failed to compare a file bound"
+                );
+                if (compare > 0)
+                    break;
+            }
+
+            next_pending++;
+            start_reader(p.reader_id, true);
+        }
+    }
+
+    /*
+     * run_length
+     *      Number of the next rows of the head reader which sort before any
+     *      row of the other readers, of the pending readers and of the next
+     *      key range. Only integer-like single sort keys are considered.
+     */
+    uint32 run_length()
+    {
+        const ReaderSlot   &head = slots.head();
+        ReaderSlot         *second;
+        int64               limit = PG_INT64_MAX;
+
+        if (head.key_isnull)
+            return 0;
+
+        /* If second is NULL, the rest of the readers only have NULLs left */
+        if ((second = slots.second()) != NULL && !second->key_isnull)
+        {
+            limit = DatumGetInt64(second->key);
+
+            /* Equal keys of a lower reader go first, see LoserTree */
+            if (second->reader_id < head.reader_id)
+            {
+                if (limit == PG_INT64_MIN)
+                    return 0;
+                limit--;
+            }
+        }
+
+        if (next_pending < pending.size())
+        {
+            int64   bound = DatumGetInt64(pending[next_pending].bound);
+
+            if (bound == PG_INT64_MIN)
+                return 0;
+            limit = Min(limit, bound - 1);
+        }
+
+        if (ranged && has_range_upper)
+        {
+            int64   upper = DatumGetInt64(range_upper);
+
+            if (upper == PG_INT64_MIN)
+                return 0;
+            limit = Min(limit, upper - 1);
+        }
+
+        return readers[head.reader_id]->key_run_length(sort_keys.front().ssup_attno,
+                                                       limit);
+    }
+
+    /*
+     * next_run
+     *      Look for a run of the head reader unless the recent attempts
+     *      failed, see MERGE_RUN_MISSES. Returns true if a run was found.
+     */
+    bool next_run()
+    {
+        if (run_wait > 0)
+        {
+            run_wait--;
+            return false;
+        }
+
+        if ((run_rows = run_length()) > 0)
+        {
+            run_misses = 0;
+            run_backoff = 0;
+            return true;
+        }
+
+        if (++run_misses >= MERGE_RUN_MISSES)
+        {
+            run_backoff = Min(Max(run_backoff * 2, 1), MERGE_RUN_MAX_BACKOFF);
+            run_wait = run_backoff;
+        }
+        return false;
+    }
+
 public:
     MultifileMergeExecutionStateS3(MemoryContext cxt,
                                  const char *dirname,
@@ -526,6 +1220,13 @@ public:
         this->use_threads = use_threads;
         this->use_mmap = use_mmap;
         this->slots_initialized = false;
+        this->next_pending = 0;
+        this->ranged = false;
+        this->run_rows = 0;
+        this->head_consumed = false;
+        this->run_misses = 0;
+        this->run_backoff = 0;
+        this->run_wait = 0;
         this->schemaless = schemaless;
         this->slcols = slcols;
         this->sorted_cols = sorted_cols;
@@ -546,10 +1247,69 @@ public:
     bool next(TupleTableSlot *slot, bool /* fake=false */)
     {
         if (unlikely(!slots_initialized))
-            initialize_slots();
+        {
+            /* Readers only read the row groups of the claimed key range */
+            if (coord && coord->is_ranged() && range_sort_key())
+            {
+                ranged = true;
+                for (auto reader: readers)
+                    reader->set_coordinator(NULL);
+                if (!start_next_range())
+                    return false;
+            }
+            else
+                initialize_slots();
+        }
 
-        if (unlikely(slots.empty()))
-            return false;
+        /* Keep returning the rows of the current run */
+        if (run_rows > 0)
+        {
+            run_rows--;
+            ExecClearTuple(slot);
+            if (readers[slots.head().reader_id]->next(slot) == RS_SUCCESS)
+            {
+                ExecStoreVirtualTuple(slot);
+                return true;
+            }
+            run_rows = 0;
+        }
+        if (head_consumed)
+        {
+            head_consumed = false;
+            advance_head();
+        }
+
+        while (true)
+        {
+            if (next_pending < pending.size())
+                start_pending_readers();
+
+            if (unlikely(slots.empty()))
+            {
+                if (ranged && start_next_range())
+                    continue;
+                return false;
+            }
+
+            if (ranged)
+            {
+                int     pos = key_in_range(slots.head().slot);
+
+                /* Rows of the overlapping row groups outside of the range */
+                if (pos < 0)
+                {
+                    advance_head();
+                    continue;
+                }
+                if (pos > 0)
+                {
+                    if (!start_next_range())
+                        return false;
+                    continue;
+                }
+            }
+            break;
+        }
 
         /* Copy slot with the smallest key into the resulting slot */
         const ReaderSlot &head = slots.head();
@@ -561,39 +1321,47 @@ public:
         );
 
         /*
-         * Try to read another record from the same reader as in the head slot.
-         * In case of success the new record makes it into the heap and the
-         * heap gets reheapified. Else if there are no more records in the
-         * reader then current head is removed from the heap and heap gets
-         * reheapified.
+         * If the following rows of the same reader still sort first return
+         * them as they are, the merge tree gets updated after the run.
          */
-        if (readers[head.reader_id]->next(head.slot) == RS_SUCCESS)
-        {
-            ExecStoreVirtualTuple(head.slot);
-            PG_TRY_INLINE({ slots.heapify_head(); }, "heapify failed");
-        }
+        if (key_compare == KC_INT_KEY && next_run())
+            head_consumed = true;
         else
-        {
-#if PG_VERSION_NUM < 110000
-            /* Release slot resources */
-            PG_TRY_INLINE(
-                {
-                    ExecDropSingleTupleTableSlot(head.slot);
-                }, "failed to drop a tuple slot"
-            );
-#endif
-            slots.pop();
-        }
+            advance_head();
         return true;
     }
 
     void rescan(void)
     {
-        /* TODO: clean binheap */
+        /*
+         * The merge tree, the pending readers and the run state are all set
+         * up from scratch by initialize_slots() or start_next_range() on the
+         * next call to next(), emptying the tree here just drops the slots
+         * of the previous scan.
+         */
         for (auto reader: readers)
             reader->rescan();
         slots.clear();
+        pending.clear();
+        next_pending = 0;
+        run_rows = 0;
+        head_consumed = false;
         slots_initialized = false;
+
+        /* The coordinator gets reinitialized by the leader */
+        if (ranged)
+        {
+            for (size_t i = 0; i < readers.size(); i++)
+                readers[i]->set_rowgroups_list(rowgroups[i]);
+            ranged = false;
+        }
+    }
+
+    void set_row_filters(const std::vector<RowFilter> &filters)
+    {
+        this->row_filters = filters;
+        for (auto reader: readers)
+            reader->set_row_filters(filters);
     }
 
     void add_file(const char *filename, List *rowgroups)
@@ -606,16 +1374,75 @@ public:
         foreach (lc, rowgroups)
             rg.push_back(lfirst_int(lc));
 
+        /* The file gets opened once it is needed, see open_reader() */
         r = create_parquet_reader(filename, cxt, reader_id);
         r->set_rowgroups_list(rg);
         r->set_options(use_threads, use_mmap);
-        if (s3_client)
-            r->open(dirname, s3_client);
-        else
-            r->open();
-        r->set_schemaless_info(schemaless, slcols, sorted_cols);
-        r->create_column_mapping(tuple_desc, relid, attrs_used);
+        r->set_row_filters(row_filters);
+        r->set_limit(limit_rows);
         readers.push_back(r);
+        reader_state.push_back(READER_NEW);
+        this->rowgroups.push_back(rg);
+    }
+
+    Size estimate_coord_size()
+    {
+        Size    nranges = (parallel_workers + 1) * MERGE_RANGES_PER_WORKER;
+
+        return sizeof(ParallelCoordinator) +
+            Max(readers.size() * sizeof(int32), nranges * sizeof(Datum));
+    }
+
+    /*
+     * init_coord
+     *      Split the first sort key into ranges holding about the same number
+     *      of row groups, judging by their min values. Fall back to sharing
+     *      out the row groups of every file if statistics are incomplete.
+     */
+    void init_coord()
+    {
+        SortSupport first_key = range_sort_key();
+        std::vector<Datum> mins;
+        std::vector<Datum> bounds;
+        size_t      nranges;
+
+        if (!collect_rowgroup_bounds())
+        {
+            coord->init_multi(readers.size());
+            return;
+        }
+
+        for (auto &reader_bounds : rowgroup_bounds)
+            for (auto &b : reader_bounds)
+                mins.push_back(b.min);
+
+        std::sort(mins.begin(), mins.end(),
+                  [first_key] (Datum a, Datum b)
+                  {
+                      return ApplySortComparator(a, false, b, false, first_key) < 0;
+                  });
+
+        nranges = Min(mins.size(), (size_t) (parallel_workers + 1) *
+                                   MERGE_RANGES_PER_WORKER);
+        for (size_t i = 1; i < nranges; i++)
+        {
+            Datum   bound = mins[i * mins.size() / nranges];
+
+            /* Skip empty ranges */
+            if (ApplySortComparator(bound, false, mins[0], false, first_key) <= 0 ||
+                (!bounds.empty() &&
+                 ApplySortComparator(bound, false, bounds.back(), false, first_key) <= 0))
+                continue;
+            bounds.push_back(bound);
+        }
+
+        if (bounds.empty())
+            coord->init_multi(readers.size());
+        else
+        {
+            Assert(TupleDescAttr(tuple_desc, first_key->ssup_attno - 1)->attbyval);
+            coord->init_ranges(bounds.data(), bounds.size());
+        }
     }
 };
 
@@ -639,17 +1466,15 @@ private:
 private:
     /*
      * initialize_slots
-     *      Initialize slots binary heap on the first run.
+     *      Initialize the merge tree on the first run.
      */
     void initialize_slots()
     {
-        std::function<bool(const ReaderSlot &, const ReaderSlot &)> cmp =
-            [this] (const ReaderSlot &a, const ReaderSlot &b) { return compare_slots(a, b); };
         int i = 0;
 
         this->ts_active.resize(readers.size(), 0);
 
-        slots.init(readers.size(), cmp);
+        init_slots();
         for (auto reader: readers)
         {
             ReaderSlot    rs;
@@ -672,13 +1497,14 @@ private:
             {
                 ExecStoreVirtualTuple(rs.slot);
                 rs.reader_id = i;
-                slots.append(rs);
+                fetch_key(rs);
+                slots.append(i, rs);
             }
             ++i;
         }
         if (this->schemaless)
             get_schemaless_sortkeys();
-        PG_TRY_INLINE({ slots.heapify(); }, "heapify failed");
+        PG_TRY_INLINE({ slots.build(); }, "failed to build the merge tree");
         slots_initialized = true;
     }
 
@@ -783,7 +1609,7 @@ public:
             return false;
 
         /* Copy slot with the smallest key into the resulting slot */
-        const ReaderSlot &head = slots.head();
+        ReaderSlot &head = slots.head();
         PG_TRY_INLINE(
             {
                 ExecCopySlot(slot, head.slot);
@@ -793,10 +1619,10 @@ public:
 
         /*
          * Try to read another record from the same reader as in the head slot.
-         * In case of success the new record makes it into the heap and the
-         * heap gets reheapified. If next() returns RS_INACTIVE try to reopen
+         * In case of success the new record replaces the head and the matches
+         * of its leaf get replayed. If next() returns RS_INACTIVE try to reopen
          * reader and retry. If there are no more records in the reader then
-         * current head is removed from the heap and heap gets reheapified.
+         * current head is removed from the merge tree.
          */
         while (true) {
             ReadStatus status = readers[head.reader_id]->next(head.slot);
@@ -805,7 +1631,8 @@ public:
             {
                 case RS_SUCCESS:
                     ExecStoreVirtualTuple(head.slot);
-                    PG_TRY_INLINE({ slots.heapify_head(); }, "heapify failed");
+                    fetch_key(head);
+                    PG_TRY_INLINE({ slots.update_head(); }, "failed to update the merge tree");
                     return true;
 
                 case RS_INACTIVE:
@@ -830,7 +1657,7 @@ public:
 
     void rescan(void)
     {
-        /* TODO: clean binheap */
+        /* initialize_slots() rebuilds the merge tree on the next call to next() */
         for (auto reader: readers)
             reader->rescan();
         slots.clear();
@@ -850,12 +1677,159 @@ public:
         r = create_parquet_reader(filename, cxt, reader_id, true);
         r->set_rowgroups_list(rg);
         r->set_options(use_threads, use_mmap);
+        r->set_row_filters(row_filters);
         readers.push_back(r);
     }
 
-    void set_coordinator(ParallelCoordinator * /* coord */)
+    void set_row_filters(const std::vector<RowFilter> &filters)
     {
-        Assert(false);  /* not supported, should never happen */
+        this->row_filters = filters;
+        for (auto reader: readers)
+            reader->set_row_filters(filters);
+    }
+};
+
+/*
+ * AggregateExecutionStateS3
+ *      Computes a pushed down aggregation over the rows returned by the
+ *      underlying scan and returns a row per group. Row groups whose rows are
+ *      all checked by the row filters are aggregated straight from arrow
+ *      arrays, the other ones row by row. The scan only reads the row groups
+ *      which cannot be answered from metadata.
+ */
+class AggregateExecutionStateS3 : public ParquetS3FdwExecutionState
+{
+private:
+    ParquetS3FdwExecutionState *scan;
+    MemoryContext       cxt;
+    MemoryContext       out_cxt;    /* values of the returned row */
+    TupleTableSlot     *scan_slot;
+    GroupAggregator     aggregator;
+    ExprState          *quals;
+    bool                quals_filtered;
+    ExprContext        *econtext;
+    bool                aggregated;
+
+    /* Feed all the rows of the scan into the aggregator */
+    void aggregate()
+    {
+        RowGroupBatch   batch;
+
+        while (scan->next_rowgroup(batch))
+        {
+            /*
+             * Without quals, or with quals entirely evaluated by the row
+             * filters, the selection is all there is to check.
+             */
+            if ((quals == NULL || (quals_filtered && batch.filtered)) &&
+                aggregator.consume(batch))
+                continue;
+
+            for (;;)
+            {
+                bool    passed = false;
+
+                ExecClearTuple(scan_slot);
+                if (!scan->next_rowgroup_row(scan_slot))
+                    break;
+
+                PG_TRY_INLINE(
+                    {
+                        econtext->ecxt_scantuple = scan_slot;
+                        passed = (quals == NULL || ExecQual(quals, econtext));
+                        ResetExprContext(econtext);
+                    }, "failed to evaluate quals");
+
+                if (passed)
+                    aggregator.consume(scan_slot);
+            }
+        }
+        aggregated = true;
+    }
+
+public:
+    AggregateExecutionStateS3(ParquetS3FdwExecutionState *scan,
+                              MemoryContext cxt,
+                              TupleDesc tuple_desc,
+                              std::vector<AttrNumber> keys,
+                              std::vector<AggregateSpec> aggs,
+                              bool partial,
+                              ExprState *quals,
+                              bool quals_filtered,
+                              ExprContext *econtext)
+        : scan(scan), cxt(cxt), out_cxt(NULL), scan_slot(NULL),
+          aggregator(cxt, tuple_desc, keys, aggs, partial), quals(quals),
+          quals_filtered(quals_filtered), econtext(econtext), aggregated(false)
+    {
+        MemoryContext oldcxt = MemoryContextSwitchTo(cxt);
+
+        PG_TRY_INLINE(
+            {
+                scan_slot = MakeTupleTableSlotCompat(tuple_desc);
+                out_cxt = AllocSetContextCreate(cxt, "parquet_s3_fdw aggregate output",
+                                                ALLOCSET_DEFAULT_SIZES);
+            }, "failed to initialize aggregates");
+        MemoryContextSwitchTo(oldcxt);
+    }
+
+    ~AggregateExecutionStateS3()
+    {
+        delete scan;
+    }
+
+    bool next(TupleTableSlot *slot, bool /* fake */)
+    {
+        MemoryContext oldcxt;
+        bool        found;
+
+        if (!aggregated)
+            aggregate();
+
+        MemoryContextReset(out_cxt);
+        PG_TRY_INLINE(
+            {
+                oldcxt = MemoryContextSwitchTo(out_cxt);
+                found = aggregator.next(slot);
+                MemoryContextSwitchTo(oldcxt);
+            }, "failed to compute aggregates");
+
+        if (found)
+            ExecStoreVirtualTuple(slot);
+
+        return found;
+    }
+
+    void rescan(void)
+    {
+        scan->rescan();
+        aggregator.reset();
+        aggregated = false;
+    }
+
+    void set_row_filters(const std::vector<RowFilter> &filters)
+    {
+        this->row_filters = filters;
+        scan->set_row_filters(filters);
+    }
+
+    void add_file(const char *filename, List *rowgroups)
+    {
+        scan->add_file(filename, rowgroups);
+    }
+
+    void set_coordinator(ParallelCoordinator *coord)
+    {
+        scan->set_coordinator(coord);
+    }
+
+    Size estimate_coord_size()
+    {
+        return scan->estimate_coord_size();
+    }
+
+    void init_coord()
+    {
+        scan->init_coord();
     }
 };
 
@@ -899,3 +1873,18 @@ ParquetS3FdwExecutionState *create_parquet_execution_state(ReaderType reader_typ
             throw std::runtime_error("unknown reader type");
     }
 }
+
+ParquetS3FdwExecutionState *create_aggregate_execution_state(ParquetS3FdwExecutionState *scan,
+                                                             MemoryContext cxt,
+                                                             TupleDesc tuple_desc,
+                                                             std::vector<AttrNumber> keys,
+                                                             std::vector<AggregateSpec> aggs,
+                                                             bool partial,
+                                                             ExprState *quals,
+                                                             bool quals_filtered,
+                                                             ExprContext *econtext)
+{
+    return new AggregateExecutionStateS3(scan, cxt, tuple_desc, keys, aggs,
+                                         partial, quals, quals_filtered,
+                                         econtext);
+}
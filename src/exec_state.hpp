@@ -17,6 +17,7 @@
 #include <list>
 #include <set>
 
+#include "aggregate.hpp"
 #include "reader.hpp"
 
 extern "C"
@@ -24,6 +25,7 @@ extern "C"
 #include "postgres.h"
 #include "access/tupdesc.h"
 #include "executor/tuptable.h"
+#include "nodes/execnodes.h"
 }
 
 
@@ -38,11 +40,52 @@ enum ReaderType
 
 class ParquetS3FdwExecutionState
 {
+protected:
+    /* Restrictions passed to the readers to skip rows early */
+    std::vector<RowFilter> row_filters;
+
+    /* LIMIT the scan is expected to stop at, passed to the readers */
+    int64       limit_rows = 0;
+
+    /* Row groups answered from metadata by pushed down aggregation */
+    int         metadata_rowgroups = 0;
+
+    /* Number of workers the parallel scan was planned for */
+    int         parallel_workers = 0;
+
 public:
     virtual ~ParquetS3FdwExecutionState() {};
+    virtual void set_row_filters(const std::vector<RowFilter> &filters)
+    {
+        this->row_filters = filters;
+    }
+    std::vector<RowFilter> &get_row_filters()
+    {
+        return this->row_filters;
+    }
+    void set_limit(int64 rows)
+    {
+        this->limit_rows = rows;
+    }
+    void set_parallel_workers(int n)
+    {
+        this->parallel_workers = n;
+    }
+    void set_metadata_rowgroups(int n)
+    {
+        this->metadata_rowgroups = n;
+    }
+    int get_metadata_rowgroups()
+    {
+        return this->metadata_rowgroups;
+    }
     virtual bool next(TupleTableSlot *slot, bool fake=false) = 0;
+    virtual bool next_rowgroup(RowGroupBatch &batch);
+    virtual bool next_rowgroup_row(TupleTableSlot *slot);
     virtual void rescan(void) = 0;
     virtual void add_file(const char *filename, List *rowgroups) = 0;
+    /* Compressed row group sizes per added file, used to balance workers */
+    virtual void set_rowgroup_sizes(List * /* sizes_list */) {}
     virtual void set_coordinator(ParallelCoordinator *coord) = 0;
     virtual Size estimate_coord_size() = 0;
     virtual void init_coord() = 0;
@@ -63,5 +106,15 @@ ParquetS3FdwExecutionState *create_parquet_execution_state(ReaderType reader_typ
                                                          std::set<std::string> slcols,
                                                          std::set<std::string> sorted_cols);
 
+ParquetS3FdwExecutionState *create_aggregate_execution_state(ParquetS3FdwExecutionState *scan,
+                                                             MemoryContext cxt,
+                                                             TupleDesc tuple_desc,
+                                                             std::vector<AttrNumber> keys,
+                                                             std::vector<AggregateSpec> aggs,
+                                                             bool partial,
+                                                             ExprState *quals,
+                                                             bool quals_filtered,
+                                                             ExprContext *econtext);
+
 
 #endif
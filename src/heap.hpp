@@ -16,62 +16,100 @@
 
 #include <algorithm>
 #include <cstddef>
-#include <functional>
+#include <cstdint>
+#include <vector>
 
-
-template<class T>
-class Heap
+extern "C"
+{
+#include "postgres.h"
+}
+
+/*
+ * LoserTree
+ *      Tournament tree used to merge k sorted streams. Every inner node keeps
+ *      the loser of the match played in it and _tree[0] keeps the overall
+ *      winner, so that replacing the winner takes a single comparison per
+ *      level on the way from its leaf to the root, while sifting down a
+ *      binary heap takes two. Leaves of exhausted streams lose every match.
+ *      The winners of the inner nodes are kept as well so that a stream can
+ *      join the tree later on without playing all the matches again.
+ *
+ *      Leaf i is node k + i of the implicit tree, the parent of node n is
+ *      n / 2. Cmp is a functor type so that the comparison gets inlined;
+ *      cmp(a, b) returns true if a > b. Equal values are won by the lower
+ *      leaf, which makes the merge stable.
+ */
+template<class T, class Cmp>
+class LoserTree
 {
 private:
-    typedef std::function<bool(const T&, const T&)> cmp_func;
-
-    T      *_data;
-    size_t  _size;
-    size_t  _capacity;
-    cmp_func _cmp;
+    std::vector<T>          _data;      /* leaves */
+    std::vector<uint8_t>    _filled;    /* whether the leaf holds a value */
+    std::vector<size_t>     _tree;      /* winner and losers, see above */
+    std::vector<size_t>     _winners;   /* winners of the inner nodes */
+    size_t  _k;                         /* number of leaves */
+    size_t  _size;                      /* number of filled leaves */
+    Cmp     _cmp;
 private:
-    void heapify_down(size_t parent)
+    /* Whether leaf a wins over leaf b */
+    inline bool wins(size_t a, size_t b)
     {
-        while (true)
-        {
-            size_t smallest = parent;
-            size_t left = parent * 2 + 1;
-            size_t right = parent * 2 + 2;
+        if (!_filled[a])
+            return false;
+        if (!_filled[b])
+            return true;
+        return a < b ? !_cmp(_data[a], _data[b]) : _cmp(_data[b], _data[a]);
+    }
+
+    /* Winner of the subtree rooted at the node */
+    inline size_t node_winner(size_t node)
+    {
+        return node >= _k ? node - _k : _winners[node];
+    }
 
-            if (left < _size && _cmp(_data[smallest], _data[left]))
-                smallest = left;
-            if (right < _size && _cmp(_data[smallest], _data[right]))
-                smallest = right;
+    /* Play the match of the inner node between the winners of its children */
+    inline void play(size_t node)
+    {
+        size_t  a = node_winner(2 * node);
+        size_t  b = node_winner(2 * node + 1);
 
-            if (parent == smallest)
-                break;
+        if (wins(b, a))
+            std::swap(a, b);
+        _winners[node] = a;
+        _tree[node] = b;
+    }
+
+    /* Play the matches on the way from the winner's leaf to the root */
+    inline void replay(size_t leaf)
+    {
+        size_t  winner = leaf;
 
-            std::swap(_data[parent], _data[smallest]);
-            parent = smallest;
+        for (size_t node = (_k + leaf) / 2; node > 0; node /= 2)
+        {
+            if (wins(_tree[node], winner))
+                std::swap(_tree[node], winner);
+            _winners[node] = winner;
         }
+        _tree[0] = winner;
     }
 public:
-    Heap() :
-        _data(nullptr), _size(0), _capacity(0)
+    LoserTree() :
+        _k(0), _size(0)
     { }
 
-    ~Heap()
-    {
-        if (_data)
-            delete _data;
-    }
-
     T& operator[](int idx)
     {
         return _data[idx];
     }
 
-    void init(size_t capacity, cmp_func cmp)
+    void init(size_t capacity, Cmp cmp)
     {
-        if (_data)
-            delete _data;
-        _data = new T[capacity];
-        _capacity = capacity;
+        _data.resize(capacity);
+        _filled.assign(capacity, false);
+        _tree.assign(capacity > 0 ? capacity : 1, 0);
+        _winners.assign(capacity > 0 ? capacity : 1, 0);
+        _k = capacity;
+        _size = 0;
         _cmp = cmp;
     }
 
@@ -87,51 +125,89 @@ public:
 
     void clear()
     {
+        _filled.assign(_k, false);
         _size = 0;
     }
 
     /*
-     * Push a new element into heap but do not heapify. Used for initialization.
+     * Put a new value into an empty leaf but do not replay the matches.
+     * build() must be called before head() is accessed.
      */
-    void append(const T &new_value)
+    void append(size_t leaf, const T &new_value)
     {
-        /* TODO: assert _size <= _capacity */
-        _data[_size++] = new_value;
+        Assert(leaf < _k && !_filled[leaf]);
+        _data[leaf] = new_value;
+        _filled[leaf] = true;
+        _size++;
     }
 
     /*
-     * Rearrange entire heap
+     * Put a new value into an empty leaf of the built tree and play the
+     * matches on the way from it to the root again.
      */
-    void heapify()
+    void insert(size_t leaf, const T &new_value)
     {
-        for (int i = _size / 2 - 1; i >= 0; i--) {
-            heapify_down(i);
-        }
+        append(leaf, new_value);
+        for (size_t node = (_k + leaf) / 2; node > 0; node /= 2)
+            play(node);
+        _tree[0] = node_winner(1);
+    }
+
+    /*
+     * Play all the matches from scratch
+     */
+    void build()
+    {
+        if (_k == 0)
+            return;
+
+        for (size_t node = _k - 1; node > 0; node--)
+            play(node);
+        _tree[0] = node_winner(1);
     }
 
     T& head()
     {
-        /* TODO: assert */
-        return _data[0];
+        Assert(!empty());
+        return _data[_tree[0]];
+    }
+
+    /*
+     * The best value but the winner, or NULL if there is none. It is the best
+     * of the values which lost to the winner on the way to the root.
+     */
+    T* second()
+    {
+        size_t  best = _k;
+
+        if (_size < 2)
+            return NULL;
+
+        for (size_t node = (_k + _tree[0]) / 2; node > 0; node /= 2)
+        {
+            if (_filled[_tree[node]] && (best == _k || wins(_tree[node], best)))
+                best = _tree[node];
+        }
+        return best < _k ? &_data[best] : NULL;
     }
 
     /*
-     * Rearrange the heap after head node was changed
+     * Replay the matches after the value of the winner was changed
      */
-    void heapify_head()
+    void update_head()
     {
-        heapify_down(0);
+        replay(_tree[0]);
     }
 
     /*
-     * Drop head node and rearrange the heap
+     * Empty the winner's leaf and replay the matches
      */
     void pop()
     {
         if (_size > 0) {
-            std::swap(_data[0], _data[_size - 1]);
+            _filled[_tree[0]] = false;
             _size--;
-            heapify_down(0);
+            replay(_tree[0]);
         }
     }
 };
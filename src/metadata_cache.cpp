@@ -0,0 +1,384 @@
+/*-------------------------------------------------------------------------
+ *
+ * metadata_cache.cpp
+ *		  Shared memory cache of Parquet file footers for parquet_s3_fdw
+ *
+ * Serialized FileMetaData of the files opened by any backend are kept in
+ * a fixed size shared memory area, so that other backends (and new
+ * connections) can skip fetching and reading footers again. Entries are
+ * keyed by the path of the file plus its size and version (ETag for S3
+ * objects, modification time for local files), so a modified file never
+ * hits a stale footer.
+ *
+ * The area is used as a ring buffer: new footers are appended after the
+ * previous ones and overwrite the oldest ones once the end is reached. An
+ * entry whose data has been overwritten is simply treated as missing.
+ *
+ * The cache requires parquet_s3_fdw to be listed in shared_preload_libraries
+ * and parquet_s3_fdw.metadata_cache_size to be greater than zero. Otherwise
+ * footers are read from the files every time as before.
+ *
+ * Portions Copyright (c) 2020, TOSHIBA CORPORATION
+ *
+ * IDENTIFICATION
+ *		  contrib/parquet_s3_fdw/src/metadata_cache.cpp
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <sys/stat.h>
+
+#include "arrow/io/memory.h"
+#include "parquet/exception.h"
+#include "parquet/file_reader.h"
+#include "parquet/metadata.h"
+
+#include "parquet_s3_fdw.hpp"
+
+extern "C"
+{
+#include "postgres.h"
+
+#include "common/hashfn.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+}
+
+#define METADATA_CACHE_TRANCHE		"parquet_s3_fdw metadata cache"
+
+/* GUC variable */
+int			parquet_s3_metadata_cache_size = 64;	/* MB */
+
+typedef struct MetadataCacheKey
+{
+	uint64		h1;
+	uint64		h2;
+} MetadataCacheKey;
+
+typedef struct MetadataCacheEntry
+{
+	MetadataCacheKey key;		/* hash key (must be first) */
+	uint64		offset;			/* logical offset of the record in the ring */
+	uint32		idlen;			/* length of the file identity */
+	uint32		len;			/* length of the serialized FileMetaData */
+} MetadataCacheEntry;
+
+typedef struct MetadataCacheShared
+{
+	LWLock	   *lock;
+	uint64		capacity;		/* size of data[] */
+	uint64		write_pos;		/* logical offset of the next record */
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} MetadataCacheShared;
+
+static MetadataCacheShared *metadata_cache = NULL;
+static HTAB *metadata_cache_hash = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static uint64
+metadata_cache_capacity(void)
+{
+	return (uint64) parquet_s3_metadata_cache_size * 1024 * 1024;
+}
+
+static long
+metadata_cache_max_entries(void)
+{
+	return Max(1024, (long) (metadata_cache_capacity() / 8192));
+}
+
+static Size
+metadata_cache_shmem_size(void)
+{
+	Size		size;
+
+	size = add_size(offsetof(MetadataCacheShared, data), metadata_cache_capacity());
+	size = add_size(size, hash_estimate_size(metadata_cache_max_entries(),
+											 sizeof(MetadataCacheEntry)));
+	return size;
+}
+
+static void
+metadata_cache_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(metadata_cache_shmem_size());
+	RequestNamedLWLockTranche(METADATA_CACHE_TRANCHE, 1);
+}
+
+static void
+metadata_cache_shmem_startup(void)
+{
+	bool		found;
+	HASHCTL		info;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	metadata_cache = (MetadataCacheShared *)
+		ShmemInitStruct(METADATA_CACHE_TRANCHE,
+						offsetof(MetadataCacheShared, data) + metadata_cache_capacity(),
+						&found);
+	if (!found)
+	{
+		metadata_cache->lock = &(GetNamedLWLockTranche(METADATA_CACHE_TRANCHE))->lock;
+		metadata_cache->capacity = metadata_cache_capacity();
+		metadata_cache->write_pos = 0;
+	}
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(MetadataCacheKey);
+	info.entrysize = sizeof(MetadataCacheEntry);
+	metadata_cache_hash = ShmemInitHash(METADATA_CACHE_TRANCHE " hash",
+										metadata_cache_max_entries(),
+										metadata_cache_max_entries(),
+										&info,
+										HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * parquet_s3_metadata_cache_init
+ *		Reserve shared memory for the cache. Called from _PG_init(), does
+ *		nothing unless the library is being preloaded.
+ */
+extern "C" void
+parquet_s3_metadata_cache_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress ||
+		parquet_s3_metadata_cache_size <= 0)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = metadata_cache_shmem_request;
+#else
+	metadata_cache_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = metadata_cache_shmem_startup;
+}
+
+static MetadataCacheKey
+metadata_cache_key(const std::string &identity)
+{
+	MetadataCacheKey key;
+
+	key.h1 = hash_bytes_extended((const unsigned char *) identity.data(), identity.size(), 0);
+	key.h2 = hash_bytes_extended((const unsigned char *) identity.data(), identity.size(), 0x5bd1e995);
+	return key;
+}
+
+/* Whether the record of the entry has not been overwritten yet */
+static bool
+metadata_cache_entry_valid(MetadataCacheEntry *entry)
+{
+	uint64		end = entry->offset + entry->idlen + entry->len;
+	uint64		write_pos = metadata_cache->write_pos;
+
+	return end <= write_pos &&
+		(write_pos <= metadata_cache->capacity ||
+		 entry->offset >= write_pos - metadata_cache->capacity);
+}
+
+/*
+ * parquetMetadataCacheLookup
+ *		Return the cached footer of the file with the given identity, or NULL
+ *		if it is not cached.
+ */
+std::shared_ptr<parquet::FileMetaData>
+parquetMetadataCacheLookup(const std::string &identity)
+{
+	MetadataCacheKey key;
+	MetadataCacheEntry *entry;
+	std::string	serialized;
+	uint32_t	len;
+
+	if (metadata_cache == NULL)
+		return nullptr;
+
+	key = metadata_cache_key(identity);
+
+	LWLockAcquire(metadata_cache->lock, LW_SHARED);
+	entry = (MetadataCacheEntry *) hash_search(metadata_cache_hash, &key, HASH_FIND, NULL);
+	if (entry != NULL && metadata_cache_entry_valid(entry) &&
+		entry->idlen == identity.size())
+	{
+		const char *rec = metadata_cache->data + entry->offset % metadata_cache->capacity;
+
+		if (memcmp(rec, identity.data(), entry->idlen) == 0)
+			serialized.assign(rec + entry->idlen, entry->len);
+	}
+	LWLockRelease(metadata_cache->lock);
+
+	if (serialized.empty())
+		return nullptr;
+
+	len = serialized.size();
+	try
+	{
+		return parquet::FileMetaData::Make(serialized.data(), &len);
+	}
+	catch (const parquet::ParquetException &e)
+	{
+		return nullptr;
+	}
+}
+
+/* Forget entries whose records have been overwritten. Lock must be held. */
+static void
+metadata_cache_purge(void)
+{
+	HASH_SEQ_STATUS scan;
+	MetadataCacheEntry *entry;
+
+	hash_seq_init(&scan, metadata_cache_hash);
+	while ((entry = (MetadataCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (!metadata_cache_entry_valid(entry))
+			hash_search(metadata_cache_hash, &entry->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * parquetMetadataCacheStore
+ *		Put the footer of the file with the given identity into the cache.
+ */
+void
+parquetMetadataCacheStore(const std::string &identity,
+						  const std::shared_ptr<parquet::FileMetaData> &metadata)
+{
+	std::shared_ptr<arrow::io::BufferOutputStream> sink;
+	std::shared_ptr<arrow::Buffer> buffer;
+	MetadataCacheKey key;
+	MetadataCacheEntry *entry;
+	bool		found;
+	uint64		total;
+	uint64		pos;
+
+	if (metadata_cache == NULL || metadata == nullptr)
+		return;
+
+	/* Serialize outside of the lock, it may throw */
+	PARQUET_ASSIGN_OR_THROW(sink, arrow::io::BufferOutputStream::Create());
+	metadata->WriteTo(sink.get());
+	PARQUET_ASSIGN_OR_THROW(buffer, sink->Finish());
+
+	/* Do not let a single huge footer flush the whole cache */
+	total = identity.size() + buffer->size();
+	if (total > metadata_cache->capacity / 4)
+		return;
+
+	key = metadata_cache_key(identity);
+
+	LWLockAcquire(metadata_cache->lock, LW_EXCLUSIVE);
+
+	entry = (MetadataCacheEntry *) hash_search(metadata_cache_hash, &key, HASH_FIND, NULL);
+	if (entry != NULL && metadata_cache_entry_valid(entry))
+	{
+		/* Somebody has been faster */
+		LWLockRelease(metadata_cache->lock);
+		return;
+	}
+
+	/* Records never wrap around, skip the tail of the ring if needed */
+	pos = metadata_cache->write_pos;
+	if (pos % metadata_cache->capacity + total > metadata_cache->capacity)
+		pos += metadata_cache->capacity - pos % metadata_cache->capacity;
+
+	memcpy(metadata_cache->data + pos % metadata_cache->capacity,
+		   identity.data(), identity.size());
+	memcpy(metadata_cache->data + pos % metadata_cache->capacity + identity.size(),
+		   buffer->data(), buffer->size());
+	metadata_cache->write_pos = pos + MAXALIGN(total);
+
+	entry = (MetadataCacheEntry *) hash_search(metadata_cache_hash, &key, HASH_ENTER_NULL, &found);
+	if (entry == NULL)
+	{
+		metadata_cache_purge();
+		entry = (MetadataCacheEntry *) hash_search(metadata_cache_hash, &key, HASH_ENTER_NULL, &found);
+	}
+	if (entry != NULL)
+	{
+		entry->offset = pos;
+		entry->idlen = identity.size();
+		entry->len = buffer->size();
+	}
+
+	LWLockRelease(metadata_cache->lock);
+}
+
+/*
+ * parquetOpenLocalFile
+ *		Open a local Parquet file, reusing its cached footer if possible.
+ */
+std::unique_ptr<parquet::ParquetFileReader>
+parquetOpenLocalFile(const std::string &filename, bool use_mmap)
+{
+	std::unique_ptr<parquet::ParquetFileReader> reader;
+	std::shared_ptr<parquet::FileMetaData> metadata;
+	std::string	identity;
+	struct stat	st;
+
+	if (metadata_cache == NULL || stat(filename.c_str(), &st) != 0)
+		return parquet::ParquetFileReader::OpenFile(filename, use_mmap);
+
+	identity = filename + ":" + std::to_string(st.st_size) + ":" +
+			   std::to_string(st.st_mtim.tv_sec) + "." +
+			   std::to_string(st.st_mtim.tv_nsec);
+
+	metadata = parquetMetadataCacheLookup(identity);
+	reader = parquet::ParquetFileReader::OpenFile(filename, use_mmap,
+												  parquet::default_reader_properties(),
+												  metadata);
+	if (metadata == nullptr)
+		parquetMetadataCacheStore(identity, reader->metadata());
+
+	return reader;
+}
+
+/*
+ * parquetOpenS3File
+ *		Open a Parquet file on S3, reusing its cached footer if possible. The
+ *		size and ETag of the object are used to identify its version.
+ */
+std::unique_ptr<parquet::ParquetFileReader>
+parquetOpenS3File(const std::shared_ptr<S3RandomAccessFile> &input,
+				  const char *dname, const char *fname)
+{
+	std::unique_ptr<parquet::ParquetFileReader> reader;
+	std::shared_ptr<parquet::FileMetaData> metadata;
+	std::string	identity;
+
+	if (metadata_cache == NULL)
+		return parquet::ParquetFileReader::Open(input);
+
+	arrow::Result<int64_t> size = input->GetSize();
+	if (!size.ok() || input->ETag().empty())
+		return parquet::ParquetFileReader::Open(input);
+
+	identity = std::string("s3://") + dname + "/" + fname + ":" +
+			   std::to_string(*size) + ":" + input->ETag().c_str();
+
+	metadata = parquetMetadataCacheLookup(identity);
+	reader = parquet::ParquetFileReader::Open(input,
+											  parquet::default_reader_properties(),
+											  metadata);
+	if (metadata == nullptr)
+		parquetMetadataCacheStore(identity, reader->metadata());
+
+	return reader;
+}
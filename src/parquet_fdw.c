@@ -33,6 +33,7 @@ PG_MODULE_MAGIC;
 void		_PG_init(void);
 extern void parquet_s3_init();
 extern void parquet_s3_shutdown();
+extern void parquet_s3_metadata_cache_init(void);
 
 /* FDW routines */
 extern void parquetGetForeignRelSize(PlannerInfo *root,
@@ -48,6 +49,11 @@ extern ForeignScan *parquetGetForeignPlan(PlannerInfo *root,
 										  List *tlist,
 										  List *scan_clauses,
 										  Plan *outer_plan);
+extern void parquetGetForeignUpperPaths(PlannerInfo *root,
+										UpperRelationKind stage,
+										RelOptInfo *input_rel,
+										RelOptInfo *output_rel,
+										void *extra);
 extern TupleTableSlot *parquetIterateForeignScan(ForeignScanState *node);
 extern void parquetBeginForeignScan(ForeignScanState *node, int eflags);
 extern void parquetEndForeignScan(ForeignScanState *node);
@@ -113,6 +119,23 @@ extern Datum parquet_fdw_validator_impl(PG_FUNCTION_ARGS);
 extern bool parquet_fdw_use_threads;
 extern bool enable_multifile;
 extern bool enable_multifile_merge;
+extern char *parquet_s3_block_cache_dir;
+extern int	parquet_s3_block_cache_block_size;
+extern int	parquet_s3_block_cache_size;
+extern int	parquet_s3_metadata_cache_size;
+extern int	parquet_s3_list_concurrency;
+extern int	parquet_s3_prefetch_depth;
+extern int	parquet_s3_prefetch_memory;
+extern int	parquet_s3_batch_size;
+extern bool parquet_s3_enable_row_filter;
+extern bool parquet_s3_enable_page_index;
+extern bool parquet_s3_enable_bloom_filter;
+extern bool parquet_s3_enable_parameterized_paths;
+extern bool parquet_s3_enable_aggregate_pushdown;
+extern bool parquet_s3_enable_limit_pushdown;
+extern bool parquet_s3_enable_parallel_workers_estimate;
+
+extern bool check_enable_bloom_filter(bool *newval, void **extra, GucSource source);
 
 void
 _PG_init(void)
@@ -152,6 +175,187 @@ _PG_init(void)
 							NULL,
 							NULL,
 							NULL);
+
+	DefineCustomStringVariable("parquet_s3_fdw.block_cache_dir",
+							   "Directory of the local cache of S3 object blocks",
+							   "The cache is disabled if empty.",
+							   &parquet_s3_block_cache_dir,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.block_cache_block_size",
+							"Size of a block of the local S3 block cache",
+							NULL,
+							&parquet_s3_block_cache_block_size,
+							1024,
+							64,
+							64 * 1024,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.block_cache_size",
+							"Maximum size of the local S3 block cache",
+							NULL,
+							&parquet_s3_block_cache_size,
+							1024,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.metadata_cache_size",
+							"Size of the shared memory cache of Parquet file footers",
+							"Requires parquet_s3_fdw to be loaded by shared_preload_libraries.",
+							&parquet_s3_metadata_cache_size,
+							64,
+							0,
+							MAX_KILOBYTES / 1024,
+							PGC_POSTMASTER,
+							GUC_UNIT_MB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.list_concurrency",
+							"Maximum number of concurrent S3 listing requests",
+							NULL,
+							&parquet_s3_list_concurrency,
+							8,
+							1,
+							64,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.prefetch_depth",
+							"Number of row groups read ahead in background",
+							"Zero disables the read-ahead.",
+							&parquet_s3_prefetch_depth,
+							1,
+							0,
+							16,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.prefetch_memory",
+							"Maximum estimated size of row groups read ahead by a session",
+							NULL,
+							&parquet_s3_prefetch_memory,
+							256,
+							0,
+							MAX_KILOBYTES / 1024,
+							PGC_USERSET,
+							GUC_UNIT_MB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("parquet_s3_fdw.batch_size",
+							"Number of rows read from a row group at a time",
+							"Zero means that row groups are read as a whole.",
+							&parquet_s3_batch_size,
+							0,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_row_filter",
+							 "Enables evaluation of simple conditions on Parquet data before rows are built",
+							 NULL,
+							 &parquet_s3_enable_row_filter,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_page_index",
+							 "Enables row group filtering by Parquet page indexes",
+							 NULL,
+							 &parquet_s3_enable_page_index,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_bloom_filter",
+							 "Enables row group filtering by Parquet bloom filters",
+							 NULL,
+							 &parquet_s3_enable_bloom_filter,
+							 parquet_s3_enable_bloom_filter,
+							 PGC_USERSET,
+							 0,
+							 check_enable_bloom_filter,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_parameterized_paths",
+							 "Enables scan paths parameterized by join clauses",
+							 NULL,
+							 &parquet_s3_enable_parameterized_paths,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_aggregate_pushdown",
+							 "Enables computing aggregates by the scan, using Parquet metadata where possible",
+							 NULL,
+							 &parquet_s3_enable_aggregate_pushdown,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_limit_pushdown",
+							 "Enables reading only about as many rows as a LIMIT asks for at first",
+							 NULL,
+							 &parquet_s3_enable_limit_pushdown,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("parquet_s3_fdw.enable_parallel_workers_estimate",
+							 "Enables choosing the number of parallel workers by the size of the row groups to read",
+							 NULL,
+							 &parquet_s3_enable_parallel_workers_estimate,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	parquet_s3_metadata_cache_init();
 }
 
 PG_FUNCTION_INFO_V1(parquet_s3_fdw_validator);
@@ -179,6 +383,7 @@ parquet_s3_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->GetForeignRelSize = parquetGetForeignRelSize;
 	fdwroutine->GetForeignPaths = parquetGetForeignPaths;
 	fdwroutine->GetForeignPlan = parquetGetForeignPlan;
+	fdwroutine->GetForeignUpperPaths = parquetGetForeignUpperPaths;
 	fdwroutine->BeginForeignScan = parquetBeginForeignScan;
 	fdwroutine->IterateForeignScan = parquetIterateForeignScan;
 	fdwroutine->ReScanForeignScan = parquetReScanForeignScan;
@@ -25,11 +25,18 @@
 #include "arrow/api.h"
 #include "arrow/io/api.h"
 #include "arrow/array.h"
+#include "arrow/util/config.h"
 #include "parquet/arrow/reader.h"
 #include "parquet/arrow/schema.h"
 #include "parquet/exception.h"
 #include "parquet/file_reader.h"
+#include "parquet/page_index.h"
 #include "parquet/statistics.h"
+#if ARROW_VERSION_MAJOR >= 13
+#include "parquet/bloom_filter.h"
+#include "parquet/bloom_filter_reader.h"
+#define PARQUET_S3_HAVE_BLOOM_FILTER
+#endif
 
 #include "parquet_s3_fdw.hpp"
 #include "heap.hpp"
@@ -49,12 +56,15 @@ extern "C"
 #include "access/sysattr.h"
 #include "access/nbtree.h"
 #include "access/reloptions.h"
+#include "catalog/pg_aggregate.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_type.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_attribute.h"
+#include "catalog/pg_namespace.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
 #include "executor/tuptable.h"
 #include "foreign/foreign.h"
@@ -65,24 +75,29 @@ extern "C"
 #include "nodes/makefuncs.h"
 #include "nodes/parsenodes.h"
 #include "optimizer/appendinfo.h"
+#include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "optimizer/inherit.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_func.h"
 #include "parser/parse_type.h"
 #include "parser/parsetree.h"
 #include "parser/scansup.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
 #include "utils/jsonb.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/memdebug.h"
 #include "utils/regproc.h"
 #include "utils/rel.h"
+#include "utils/selfuncs.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
 #include "utils/typcache.h"
@@ -128,6 +143,35 @@ static const char *ParquetCompressionTypeList[] = {
 
 bool enable_multifile;
 bool enable_multifile_merge;
+bool parquet_s3_enable_row_filter = true;
+bool parquet_s3_enable_page_index = true;
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+bool parquet_s3_enable_bloom_filter = true;
+#else
+bool parquet_s3_enable_bloom_filter = false;
+#endif
+bool parquet_s3_enable_parameterized_paths = false;
+bool parquet_s3_enable_aggregate_pushdown = false;
+bool parquet_s3_enable_limit_pushdown = true;
+bool parquet_s3_enable_parallel_workers_estimate = false;
+
+/*
+ * check_enable_bloom_filter
+ *      GUC check hook of parquet_s3_fdw.enable_bloom_filter. Bloom filters
+ *      cannot be read with libparquet older than 13.0.0.
+ */
+extern "C" bool
+check_enable_bloom_filter(bool *newval, void **extra, GucSource source)
+{
+#ifndef PARQUET_S3_HAVE_BLOOM_FILTER
+    if (*newval)
+    {
+        GUC_check_errdetail("Bloom filters require libparquet 13.0.0 or later.");
+        return false;
+    }
+#endif
+    return true;
+}
 
 
 static void find_cmp_func(FmgrInfo *finfo, Oid type1, Oid type2);
@@ -148,8 +192,14 @@ struct RowGroupFilter
     Oid         atttype;   /* Explicit cast type in schemaless mode
                                In non-schemaless NULL is expectation  */
     bool        is_column;  /* for schemaless actual column `exist` operator */
+    bool        is_or;      /* matches if any of args does (IN lists, ORs) */
+    std::vector<RowGroupFilter> args;
 };
 
+static bool minmax_matches_filter(const std::string &min, const std::string &max,
+                                  const arrow::DataType *arrow_type,
+                                  RowGroupFilter *filter);
+
 /*
  * Indexes of FDW-private information stored in fdw_private lists.
  *
@@ -182,7 +232,31 @@ enum FdwScanPrivateIndex
     /* Path to directory having Parquet files to read */
     FdwScanPrivateDirName,
     /* Foreign Table Id */
-    FdwScanPrivateForeignTableId
+    FdwScanPrivateForeignTableId,
+    /*
+     * The rest is only used by pushed down aggregation:
+     * List of aggregates (each a List of kind, attnum, collation and
+     * a NULL Const of the argument type)
+     */
+    FdwScanPrivateAggregates,
+    /* Restrictions of the scanned foreign table */
+    FdwScanPrivateScanQuals,
+    /* Range table index of the scanned foreign table in the quals */
+    FdwScanPrivateScanRelid,
+    /* Oid of the scanned foreign table */
+    FdwScanPrivateRelationId,
+    /* Whether row groups may be answered from metadata (integer Value) */
+    FdwScanPrivateUseMetadata,
+    /* List of attribute numbers of the grouping columns */
+    FdwScanPrivateGroupKeys,
+    /* Whether transition values are returned (as an integer Value node) */
+    FdwScanPrivatePartialAggregates,
+    /* Number of rows the scan is expected to stop after, 0 if unknown */
+    FdwScanPrivateLimitRows,
+    /* List of Lists of compressed row group sizes in kB (per filename) */
+    FdwScanPrivateRowGroupSizes,
+    /* Number of workers of the parallel path (as an integer Value node) */
+    FdwScanPrivateParallelWorkers
 };
 
 /*
@@ -196,8 +270,10 @@ struct ParquetFdwPlanState
     bool        use_mmap;
     bool        use_threads;
     int32       max_open_files;
+    int32       parallel_workers;   /* table option, -1 if not set */
     bool        files_in_order;
     List       *rowgroups;      /* List of Lists (per filename) */
+    List       *rowgroup_sizes; /* compressed sizes in kB, same shape */
     uint64      matched_rows;
     ReaderType  type;
     char       *dirname;
@@ -207,6 +283,15 @@ struct ParquetFdwPlanState
     Aws::S3::S3Client *s3client;
     char       *selector_function_name;
     List       *key_columns;
+
+    /* Pushed down aggregation, see parquetGetForeignUpperPaths() */
+    List       *aggs;
+    List       *scan_quals;
+    Index       scan_relid;
+    Oid         relid;
+    bool        use_metadata;
+    List       *group_keys;
+    bool        partial;
 };
 
 static void get_filenames_in_dir(ParquetFdwPlanState *fdw_private);
@@ -370,6 +455,222 @@ schemaless_extract_rowgroup_filters(List *scan_clauses,
     }
 }
 
+/*
+ * extract_rowgroup_filter
+ *      Convert a clause into row group filters which all must match. Returns
+ *      false if the clause cannot be used to filter out row groups.
+ */
+static bool
+extract_rowgroup_filter(Expr *clause, std::vector<RowGroupFilter> &filters)
+{
+    OpExpr     *expr;
+    Expr       *left, *right;
+    int         strategy;
+    bool        is_key = false;
+    Const      *c;
+    Var        *v;
+    Oid         opno;
+
+    if (IsA(clause, RestrictInfo))
+        clause = ((RestrictInfo *) clause)->clause;
+
+    if (IsA(clause, OpExpr))
+    {
+        expr = (OpExpr *) clause;
+
+        /* Only interested in binary opexprs */
+        if (list_length(expr->args) != 2)
+            return false;
+
+        left = (Expr *) linitial(expr->args);
+        right = (Expr *) lsecond(expr->args);
+
+        /*
+         * Looking for expressions like "EXPR OP CONST" or "CONST OP EXPR"
+         *
+         * XXX Currently only Var as expression is supported. Will be
+         * extended in future.
+         */
+        if (IsA(right, Const))
+        {
+            if (!IsA(left, Var))
+                return false;
+            v = (Var *) left;
+            c = (Const *) right;
+            opno = expr->opno;
+        }
+        else if (IsA(left, Const))
+        {
+            /* reverse order (CONST OP VAR) */
+            if (!IsA(right, Var))
+                return false;
+            v = (Var *) right;
+            c = (Const *) left;
+            opno = get_commutator(expr->opno);
+        }
+        else
+            return false;
+
+        /* Not a btree family operator? */
+        if ((strategy = get_strategy(v->vartype, opno, BTREE_AM_OID)) == 0)
+        {
+            /*
+             * Maybe it's a gin family operator? (We only support
+             * jsonb 'exists' operator at the moment)
+             */
+            if ((strategy = get_strategy(v->vartype, opno, GIN_AM_OID)) == 0
+                || strategy != JsonbExistsStrategyNumber)
+                return false;
+            is_key = true;
+        }
+    }
+    else if (IsA(clause, ScalarArrayOpExpr))
+    {
+        /*
+         * "VAR OP ANY (ARRAY)" matches if any of the "VAR OP ELEM" does,
+         * "VAR OP ALL (ARRAY)" only if all of them do.
+         */
+        ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) clause;
+        RowGroupFilter  any {};
+        ArrayType      *arr;
+        Datum          *values;
+        bool           *nulls;
+        int             nvalues;
+        int16           elmlen;
+        bool            elmbyval;
+        char            elmalign;
+        Oid             elmtype;
+
+        if (list_length(saop->args) != 2)
+            return false;
+
+        left = (Expr *) linitial(saop->args);
+        right = (Expr *) lsecond(saop->args);
+
+        if (!IsA(left, Var) || !IsA(right, Const) || ((Const *) right)->constisnull)
+            return false;
+
+        v = (Var *) left;
+        c = (Const *) right;
+
+        if (v->varattno < 0)
+            return false;
+
+        if ((strategy = get_strategy(v->vartype, saop->opno, BTREE_AM_OID)) == 0)
+            return false;
+
+        arr = DatumGetArrayTypeP(c->constvalue);
+        elmtype = ARR_ELEMTYPE(arr);
+        get_typlenbyvalalign(elmtype, &elmlen, &elmbyval, &elmalign);
+        deconstruct_array(arr, elmtype, elmlen, elmbyval, elmalign,
+                          &values, &nulls, &nvalues);
+
+        any.is_or = true;
+        for (int i = 0; i < nvalues; i++)
+        {
+            /* Comparisons with NULL are never true, skip them */
+            if (nulls[i])
+                continue;
+
+            RowGroupFilter f
+            {
+                .attnum = v->varattno,
+                .is_key = false,
+                .value = makeConst(elmtype, -1, c->constcollid, elmlen,
+                                   values[i], false, elmbyval),
+                .strategy = strategy,
+            };
+
+            if (saop->useOr)
+                any.args.push_back(f);
+            else
+                filters.push_back(f);
+        }
+
+        if (saop->useOr)
+            filters.push_back(any);
+        return true;
+    }
+    else if (is_orclause(clause))
+    {
+        /* Any of the arguments may match */
+        RowGroupFilter  any {};
+        ListCell       *lc;
+
+        any.is_or = true;
+        foreach (lc, ((BoolExpr *) clause)->args)
+        {
+            std::vector<RowGroupFilter> arg;
+
+            /* Can't tell anything if some of the arguments is unknown */
+            if (!extract_rowgroup_filter((Expr *) lfirst(lc), arg) || arg.empty())
+                return false;
+
+            /*
+             * "A AND B" can't match where A doesn't, so it's enough to keep
+             * the first filter.
+             */
+            if (arg[0].is_or)
+                any.args.insert(any.args.end(), arg[0].args.begin(), arg[0].args.end());
+            else
+                any.args.push_back(arg[0]);
+        }
+
+        filters.push_back(any);
+        return true;
+    }
+    else if (IsA(clause, Var))
+    {
+        /*
+         * Trivial expression containing only a single boolean Var. This
+         * also covers cases "BOOL_VAR = true"
+         */
+        v = (Var *) clause;
+        strategy = BTEqualStrategyNumber;
+        c = (Const *) makeBoolConst(true, false);
+    }
+    else if (IsA(clause, BoolExpr))
+    {
+        /*
+         * Similar to previous case but for expressions like "!BOOL_VAR" or
+         * "BOOL_VAR = false"
+         */
+        BoolExpr *boolExpr = (BoolExpr *) clause;
+
+        if (boolExpr->args && list_length(boolExpr->args) != 1)
+            return false;
+
+        if (!IsA(linitial(boolExpr->args), Var))
+            return false;
+
+        v = (Var *) linitial(boolExpr->args);
+        strategy = BTEqualStrategyNumber;
+        c = (Const *) makeBoolConst(false, false);
+    }
+    else
+        return false;
+
+    /*
+     * System columns should not be extract to filter, since
+     * we don't make any effort to ensure that local and
+     * remote values match (tableoid, in particular, almost
+     * certainly doesn't match).
+     */
+    if (v->varattno < 0)
+        return false;
+
+    RowGroupFilter f
+    {
+        .attnum = v->varattno,
+        .is_key = is_key,
+        .value = c,
+        .strategy = strategy,
+    };
+
+    filters.push_back(f);
+    return true;
+}
+
 /*
  * extract_rowgroup_filters
  *      Build a list of expressions we can use to filter out row groups.
@@ -381,116 +682,257 @@ extract_rowgroup_filters(List *scan_clauses,
     ListCell *lc;
 
     foreach (lc, scan_clauses)
+    {
+        Expr   *clause = (Expr *) lfirst(lc);
+
+        /* potentially inserting elements may throw exceptions */
+        try {
+            std::vector<RowGroupFilter> f;
+
+            if (extract_rowgroup_filter(clause, f))
+                filters.insert(filters.end(), f.begin(), f.end());
+        } catch (std::exception &e) {
+            elog(ERROR, "parquet_s3_fdw: extracting row filters failed");
+        }
+    }
+}
+
+/*
+ * get_row_filter_strategy
+ *      Find btree strategy of the operator for the column type. "<>" is
+ *      represented as negated equality.
+ */
+static bool
+get_row_filter_strategy(Oid type, Oid opno, RowFilter &filter)
+{
+    Oid         negator;
+
+    if (!OidIsValid(opno))
+        return false;
+
+    if ((filter.strategy = get_strategy(type, opno, BTREE_AM_OID)) != 0)
+        return true;
+
+    negator = get_negator(opno);
+    if (OidIsValid(negator) &&
+        get_strategy(type, negator, BTREE_AM_OID) == BTEqualStrategyNumber)
+    {
+        filter.strategy = BTEqualStrategyNumber;
+        filter.negate = true;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * is_row_filter_param
+ *      Check whether the expression yields the same value for the whole scan
+ *      so it can be computed once per scan or rescan: Params (external or
+ *      supplied by the outer side of a nested loop) and stable expressions
+ *      of them.
+ */
+static bool
+is_row_filter_param(Expr *expr)
+{
+    return !contain_var_clause((Node *) expr) &&
+           !contain_volatile_functions((Node *) expr) &&
+           !contain_subplans((Node *) expr);
+}
+
+/*
+ * extract_row_filters
+ *      Build a list of restrictions the readers can check on arrow arrays
+ *      before the rows are materialized. The clauses remain in the plan
+ *      quals, so anything not recognized here is simply left to the executor.
+ *
+ *      Values compared with parameters are prepared for evaluation in ps and
+ *      computed by set_row_filter_params() later.
+ */
+static void
+extract_row_filters(List *quals, Index scanrelid, PlanState *ps,
+                    std::vector<RowFilter> &filters)
+{
+    MemoryContext param_cxt = NULL;
+    ListCell   *lc;
+
+    foreach (lc, quals)
     {
         Expr       *clause = (Expr *) lfirst(lc);
-        OpExpr     *expr;
-        Expr       *left, *right;
-        int         strategy;
-        bool        is_key = false;
-        Const      *c;
-        Var        *v;
-        Oid         opno;
+        Var        *v = NULL;
+        RowFilter   f;
 
         if (IsA(clause, RestrictInfo))
             clause = ((RestrictInfo *) clause)->clause;
 
         if (IsA(clause, OpExpr))
         {
-            expr = (OpExpr *) clause;
+            OpExpr     *expr = (OpExpr *) clause;
+            Expr       *left, *right;
+            Expr       *val;
+            Const      *c;
+            Oid         opno;
 
-            /* Only interested in binary opexprs */
             if (list_length(expr->args) != 2)
                 continue;
 
             left = (Expr *) linitial(expr->args);
             right = (Expr *) lsecond(expr->args);
 
-            /*
-             * Looking for expressions like "EXPR OP CONST" or "CONST OP EXPR"
-             *
-             * XXX Currently only Var as expression is supported. Will be
-             * extended in future.
-             */
-            if (IsA(right, Const))
+            if (IsA(left, Var) && is_row_filter_param(right))
             {
-                if (!IsA(left, Var))
-                    continue;
                 v = (Var *) left;
-                c = (Const *) right;
+                val = right;
                 opno = expr->opno;
             }
-            else if (IsA(left, Const))
+            else if (is_row_filter_param(left) && IsA(right, Var))
             {
                 /* reverse order (CONST OP VAR) */
-                if (!IsA(right, Var))
-                    continue;
                 v = (Var *) right;
-                c = (Const *) left;
+                val = left;
                 opno = get_commutator(expr->opno);
             }
             else
                 continue;
 
-            /* Not a btree family operator? */
-            if ((strategy = get_strategy(v->vartype, opno, BTREE_AM_OID)) == 0)
+            if (!get_row_filter_strategy(v->vartype, opno, f))
+                continue;
+
+            f.collid = expr->inputcollid;
+            if (!IsA(val, Const))
             {
-                /*
-                 * Maybe it's a gin family operator? (We only support
-                 * jsonb 'exists' operator at the moment)
-                 */
-                if ((strategy = get_strategy(v->vartype, opno, GIN_AM_OID)) == 0
-                    || strategy != JsonbExistsStrategyNumber)
-                    continue;
-                is_key = true;
+                f.valtype = exprType((Node *) val);
+                f.param = ExecInitExpr(val, ps);
+                f.unknown = true;
+            }
+            else if ((c = (Const *) val)->constisnull)
+            {
+                /* Strict operator, the clause is never true */
+                f.valtype = c->consttype;
+                f.has_null = true;
+                f.use_or = false;
+            }
+            else
+            {
+                f.valtype = c->consttype;
+                f.values.push_back(c->constvalue);
             }
         }
-        else if (IsA(clause, Var))
+        else if (IsA(clause, ScalarArrayOpExpr))
         {
-            /*
-             * Trivial expression containing only a single boolean Var. This
-             * also covers cases "BOOL_VAR = true"
-             */
-            v = (Var *) clause;
-            strategy = BTEqualStrategyNumber;
-            c = (Const *) makeBoolConst(true, false);
+            ScalarArrayOpExpr *expr = (ScalarArrayOpExpr *) clause;
+            Expr       *left, *right;
+            Const      *c;
+
+            if (list_length(expr->args) != 2)
+                continue;
+
+            left = (Expr *) linitial(expr->args);
+            right = (Expr *) lsecond(expr->args);
+
+            if (!IsA(left, Var) || !is_row_filter_param(right))
+                continue;
+
+            v = (Var *) left;
+
+            if (!get_row_filter_strategy(v->vartype, expr->opno, f))
+                continue;
+
+            f.use_or = expr->useOr;
+            f.collid = expr->inputcollid;
+            if (!IsA(right, Const))
+            {
+                f.valtype = get_element_type(exprType((Node *) right));
+                f.param = ExecInitExpr(right, ps);
+                f.unknown = true;
+            }
+            else if ((c = (Const *) right)->constisnull)
+            {
+                f.valtype = get_element_type(c->consttype);
+                f.has_null = true;
+                f.use_or = false;
+            }
+            else
+            {
+                ArrayType  *arr = DatumGetArrayTypeP(c->constvalue);
+                Datum      *values;
+                bool       *nulls;
+                int         nvalues;
+                int16       elmlen;
+                bool        elmbyval;
+                char        elmalign;
+
+                f.valtype = ARR_ELEMTYPE(arr);
+                get_typlenbyvalalign(f.valtype, &elmlen, &elmbyval, &elmalign);
+                deconstruct_array(arr, f.valtype, elmlen, elmbyval, elmalign,
+                                  &values, &nulls, &nvalues);
+
+                for (int i = 0; i < nvalues; i++)
+                {
+                    if (nulls[i])
+                        f.has_null = true;
+                    else
+                        f.values.push_back(values[i]);
+                }
+            }
         }
-        else if (IsA(clause, BoolExpr))
+        else if (IsA(clause, NullTest))
         {
-            /*
-             * Similar to previous case but for expressions like "!BOOL_VAR" or
-             * "BOOL_VAR = false"
-             */
-            BoolExpr *boolExpr = (BoolExpr *) clause;
+            NullTest   *nt = (NullTest *) clause;
 
-            if (boolExpr->args && list_length(boolExpr->args) != 1)
+            if (!IsA(nt->arg, Var))
                 continue;
 
-            if (!IsA(linitial(boolExpr->args), Var))
+            v = (Var *) nt->arg;
+            f.kind = nt->nulltesttype == IS_NULL ? RF_IS_NULL : RF_IS_NOT_NULL;
+        }
+        else if (IsA(clause, Var))
+        {
+            /* Single boolean Var */
+            v = (Var *) clause;
+            f.strategy = BTEqualStrategyNumber;
+            f.valtype = BOOLOID;
+            f.values.push_back(BoolGetDatum(true));
+        }
+        else if (is_notclause(clause))
+        {
+            Expr   *arg = get_notclausearg(clause);
+
+            if (!IsA(arg, Var))
                 continue;
 
-            v = (Var *) linitial(boolExpr->args);
-            strategy = BTEqualStrategyNumber;
-            c = (Const *) makeBoolConst(false, false);
+            v = (Var *) arg;
+            f.strategy = BTEqualStrategyNumber;
+            f.valtype = BOOLOID;
+            f.values.push_back(BoolGetDatum(false));
         }
         else
             continue;
 
-        /*
-         * System columns should not be extract to filter, since
-         * we don't make any effort to ensure that local and
-         * remote values match (tableoid, in particular, almost
-         * certainly doesn't match).
-         */
-        if (v->varattno < 0)
+        if ((Index) v->varno != scanrelid || v->varlevelsup != 0 || v->varattno <= 0)
             continue;
 
-        RowGroupFilter f
+        f.attnum = v->varattno;
+
+        /* Strings are compared by the btree support function of their type */
+        if (f.kind == RF_COMPARE &&
+            (v->vartype == TEXTOID || v->vartype == BYTEAOID))
         {
-            .attnum = v->varattno,
-            .is_key = is_key,
-            .value = c,
-            .strategy = strategy,
-        };
+            if (f.valtype != v->vartype)
+                continue;
+
+            f.cmpfunc = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
+            find_cmp_func(f.cmpfunc, v->vartype, f.valtype);
+        }
+
+        if (f.param != NULL)
+        {
+            if (param_cxt == NULL)
+                param_cxt = AllocSetContextCreate(CurrentMemoryContext,
+                                                  "parquet_s3_fdw parameter values",
+                                                  ALLOCSET_SMALL_SIZES);
+            f.param_cxt = param_cxt;
+        }
 
         /* potentially inserting elements may throw exceptions */
         try {
@@ -501,24 +943,113 @@ extract_rowgroup_filters(List *scan_clauses,
     }
 }
 
-static Const *
-convert_const(Const *c, Oid dst_oid)
+/*
+ * set_row_filter_params
+ *      Compute the values of the row filters compared with parameters.
+ *
+ *      Parameters supplied by other plan nodes (PARAM_EXEC) are only set once
+ *      the node is (re)scanned by its parent, so if the scan depends on any of
+ *      them the filters are left unknown until the first rescan.
+ */
+static void
+set_row_filter_params(std::vector<RowFilter> &filters, PlanState *ps, bool rescan)
 {
-    Oid         funcid;
-    CoercionPathType ct;
+    ExprContext    *econtext = ps->ps_ExprContext;
+    MemoryContext   param_cxt = NULL;
+    bool            error = false;
 
-    ct = find_coercion_pathway(dst_oid, c->consttype,
-                               COERCION_EXPLICIT, &funcid);
-    switch (ct)
+    if (!rescan && !bms_is_empty(ps->plan->allParam))
+        return;
+
+    for (auto &f : filters)
     {
-        case COERCION_PATH_FUNC:
-            {
-                FmgrInfo    finfo;
-                Const      *newc;
-                int16       typlen;
-                bool        typbyval;
+        MemoryContext   oldcxt;
+        Datum           value;
+        bool            isnull;
 
-                get_typlenbyval(dst_oid, &typlen, &typbyval);
+        if (f.param == NULL)
+            continue;
+
+        /* All the filters share the same context, release the old values */
+        if (param_cxt == NULL)
+        {
+            param_cxt = f.param_cxt;
+            MemoryContextReset(param_cxt);
+        }
+
+        f.values.clear();
+        f.has_null = false;
+        f.unknown = false;
+
+        value = ExecEvalExprSwitchContext(f.param, econtext, &isnull);
+        if (isnull)
+        {
+            /* Strict operator, the clause is never true */
+            f.has_null = true;
+            continue;
+        }
+
+        oldcxt = MemoryContextSwitchTo(param_cxt);
+        try
+        {
+            int16       typlen;
+            bool        typbyval;
+            char        typalign;
+
+            get_typlenbyvalalign(f.valtype, &typlen, &typbyval, &typalign);
+
+            /* Array of values for "= ANY(...)" and the like */
+            if (exprType((Node *) f.param->expr) != f.valtype)
+            {
+                ArrayType  *arr = DatumGetArrayTypeP(value);
+                Datum      *values;
+                bool       *nulls;
+                int         nvalues;
+
+                deconstruct_array(arr, f.valtype, typlen, typbyval, typalign,
+                                  &values, &nulls, &nvalues);
+
+                for (int i = 0; i < nvalues; i++)
+                {
+                    if (nulls[i])
+                        f.has_null = true;
+                    else
+                        f.values.push_back(datumCopy(values[i], typbyval, typlen));
+                }
+            }
+            else
+                f.values.push_back(datumCopy(value, typbyval, typlen));
+        }
+        catch (std::exception &e)
+        {
+            error = true;
+        }
+        MemoryContextSwitchTo(oldcxt);
+
+        if (error)
+            elog(ERROR, "parquet_s3_fdw: computing row filter parameters failed");
+    }
+    ResetExprContext(econtext);
+}
+
+static Const *
+convert_const(Const *c, Oid dst_oid)
+{
+    Oid         funcid;
+    CoercionPathType ct;
+
+    ct = find_coercion_pathway(dst_oid, c->consttype,
+                               COERCION_EXPLICIT, &funcid);
+    switch (ct)
+    {
+        case COERCION_PATH_FUNC:
+            {
+                FmgrInfo    finfo;
+                Const      *newc;
+                int16       typlen;
+                bool        typbyval;
+
+                get_typlenbyval(dst_oid, &typlen, &typbyval);
 
                 newc = makeConst(dst_oid,
                                  0,
@@ -587,11 +1118,6 @@ row_group_matches_filter(parquet::Statistics *stats,
                          const arrow::DataType *arrow_type,
                          RowGroupFilter *filter)
 {
-    FmgrInfo finfo;
-    Datum    val;
-    int      collid = filter->value->constcollid;
-    int      strategy = filter->strategy;
-
     if (arrow_type->id() == arrow::Type::MAP && filter->is_key)
     {
         /*
@@ -612,6 +1138,248 @@ row_group_matches_filter(parquet::Statistics *stats,
         filter->value = convert_const(filter->value,
                                       to_postgres_type(arrow_type->id()));
     }
+
+    return minmax_matches_filter(stats->EncodeMin(), stats->EncodeMax(),
+                                 arrow_type, filter);
+}
+
+/*
+ * Ranges [first, last) of row numbers within a row group
+ */
+typedef std::vector<std::pair<int64, int64>> RowRanges;
+
+/*
+ * page_index_row_ranges
+ *      Find rows of the row group that belong to pages whose min/max values
+ *      (from the page index) match the filter. Returns false if the column
+ *      has no usable page index.
+ */
+static bool
+page_index_row_ranges(parquet::RowGroupPageIndexReader *page_index,
+                      int column_index, int64 num_rows,
+                      const arrow::DataType *arrow_type,
+                      RowGroupFilter *filter, RowRanges &ranges)
+{
+    std::shared_ptr<parquet::ColumnIndex>   col_index;
+    std::shared_ptr<parquet::OffsetIndex>   offset_index;
+
+    /* Malformed page index is not a reason to fail the query */
+    try
+    {
+        col_index = page_index->GetColumnIndex(column_index);
+        offset_index = page_index->GetOffsetIndex(column_index);
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    if (!col_index || !offset_index)
+        return false;
+
+    const auto &locations = offset_index->page_locations();
+    const auto &null_pages = col_index->null_pages();
+    const auto &min_values = col_index->encoded_min_values();
+    const auto &max_values = col_index->encoded_max_values();
+
+    if (null_pages.size() != locations.size() ||
+        min_values.size() != locations.size() ||
+        max_values.size() != locations.size())
+        return false;
+
+    for (size_t p = 0; p < locations.size(); p++)
+    {
+        int64   first = locations[p].first_row_index;
+        int64   last = p + 1 < locations.size() ?
+                            locations[p + 1].first_row_index : num_rows;
+
+        /* Comparisons never match pages of nulls */
+        if (null_pages[p])
+            continue;
+
+        if (!minmax_matches_filter(min_values[p], max_values[p], arrow_type, filter))
+            continue;
+
+        if (!ranges.empty() && ranges.back().second == first)
+            ranges.back().second = last;
+        else
+            ranges.emplace_back(first, last);
+    }
+
+    return true;
+}
+
+static RowRanges
+intersect_row_ranges(const RowRanges &a, const RowRanges &b)
+{
+    RowRanges   res;
+    size_t      i = 0,
+                j = 0;
+
+    while (i < a.size() && j < b.size())
+    {
+        int64   first = Max(a[i].first, b[j].first);
+        int64   last = Min(a[i].second, b[j].second);
+
+        if (first < last)
+            res.emplace_back(first, last);
+
+        if (a[i].second < b[j].second)
+            i++;
+        else
+            j++;
+    }
+
+    return res;
+}
+
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+/*
+ * bloom_filter_may_contain
+ *      Check the value against the bloom filter of the column. The value is
+ *      hashed the way the writer hashes values of the column physical type,
+ *      so whenever the conversion is not exact we have to assume it's there.
+ */
+static bool
+bloom_filter_may_contain(parquet::BloomFilter *bloom,
+                         const arrow::DataType *arrow_type,
+                         Datum value, Oid valtype)
+{
+    int64       ival;
+
+    switch (valtype)
+    {
+        case INT2OID:
+            ival = DatumGetInt16(value);
+            break;
+        case INT4OID:
+            ival = DatumGetInt32(value);
+            break;
+        case INT8OID:
+            ival = DatumGetInt64(value);
+            break;
+        default:
+            ival = 0;
+    }
+
+    switch (arrow_type->id())
+    {
+        case arrow::Type::INT8:
+        case arrow::Type::INT16:
+        case arrow::Type::INT32:
+            if (valtype != INT2OID && valtype != INT4OID && valtype != INT8OID)
+                return true;
+            /* Such value cannot be in the column, but let the quals decide */
+            if (ival < PG_INT32_MIN || ival > PG_INT32_MAX)
+                return true;
+            return bloom->FindHash(bloom->Hash((int32_t) ival));
+        case arrow::Type::INT64:
+            if (valtype != INT2OID && valtype != INT4OID && valtype != INT8OID)
+                return true;
+            return bloom->FindHash(bloom->Hash((int64_t) ival));
+        case arrow::Type::FLOAT:
+        case arrow::Type::DOUBLE:
+            {
+                double  dval;
+
+                if (valtype == FLOAT4OID)
+                    dval = DatumGetFloat4(value);
+                else if (valtype == FLOAT8OID)
+                    dval = DatumGetFloat8(value);
+                else
+                    return true;
+
+                /* Equal values with different bit patterns (-0.0, NaNs) */
+                if (dval == 0 || isnan(dval))
+                    return true;
+
+                if (arrow_type->id() == arrow::Type::DOUBLE)
+                    return bloom->FindHash(bloom->Hash(dval));
+                if (valtype != FLOAT4OID)
+                    return true;
+                return bloom->FindHash(bloom->Hash((float) dval));
+            }
+        case arrow::Type::DATE32:
+            if (valtype != DATEOID)
+                return true;
+            /* See read_primitive_type() for the conversion */
+            ival = (int64) DatumGetDateADT(value) +
+                   (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
+            return bloom->FindHash(bloom->Hash((int32_t) ival));
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+            {
+                struct varlena *v;
+                parquet::ByteArray ba;
+
+                if (valtype != to_postgres_type(arrow_type->id()))
+                    return true;
+
+                v = (struct varlena *) DatumGetPointer(value);
+                ba = parquet::ByteArray(VARSIZE_ANY_EXHDR(v),
+                                        (const uint8_t *) VARDATA_ANY(v));
+                return bloom->FindHash(bloom->Hash(&ba));
+            }
+        default:
+            return true;
+    }
+}
+
+/*
+ * bloom_filter_matches
+ *      Check if the bloom filter of the column of the row group (if there is
+ *      one) may contain the value of equality filter.
+ */
+static bool
+bloom_filter_matches(parquet::RowGroupBloomFilterReader *bloom_reader,
+                     int column_index, const arrow::DataType *arrow_type,
+                     RowGroupFilter *filter)
+{
+    std::unique_ptr<parquet::BloomFilter> bloom;
+
+    if (filter->value->constisnull)
+        return true;
+
+    /* Byte comparison is only valid for deterministic collations */
+    if (arrow_type->id() == arrow::Type::STRING &&
+        OidIsValid(filter->value->constcollid) &&
+        !get_collation_isdeterministic(filter->value->constcollid))
+        return true;
+
+    /* Unreadable bloom filter only means we cannot skip anything */
+    try
+    {
+        bloom = bloom_reader->GetColumnBloomFilter(column_index);
+    }
+    catch (const std::exception &)
+    {
+        return true;
+    }
+
+    if (!bloom)
+        return true;
+
+    return bloom_filter_may_contain(bloom.get(), arrow_type,
+                                    filter->value->constvalue,
+                                    filter->value->consttype);
+}
+#endif
+
+/*
+ * minmax_matches_filter
+ *      Check whether values within [min, max] (plain encoded) may satisfy
+ *      the filter.
+ */
+static bool
+minmax_matches_filter(const std::string &min, const std::string &max,
+                      const arrow::DataType *arrow_type,
+                      RowGroupFilter *filter)
+{
+    FmgrInfo finfo;
+    Datum    val;
+    int      collid = filter->value->constcollid;
+    int      strategy = filter->strategy;
+
     val = filter->value->constvalue;
 
     find_cmp_func(&finfo,
@@ -626,7 +1394,6 @@ row_group_matches_filter(parquet::Statistics *stats,
                 Datum   lower;
                 int     cmpres;
                 bool    satisfies;
-                std::string min = std::move(stats->EncodeMin());
 
                 lower = bytes_to_postgres_type(min.c_str(), min.length(),
                                                arrow_type);
@@ -647,7 +1414,6 @@ row_group_matches_filter(parquet::Statistics *stats,
                 Datum   upper;
                 int     cmpres;
                 bool    satisfies;
-                std::string max = std::move(stats->EncodeMax());
 
                 upper = bytes_to_postgres_type(max.c_str(), max.length(),
                                                arrow_type);
@@ -667,8 +1433,6 @@ row_group_matches_filter(parquet::Statistics *stats,
             {
                 Datum   lower,
                         upper;
-                std::string min = std::move(stats->EncodeMin());
-                std::string max = std::move(stats->EncodeMax());
 
                 lower = bytes_to_postgres_type(min.c_str(), min.length(),
                                                arrow_type);
@@ -794,6 +1558,224 @@ parquet_s3_column_is_existed(parquet::arrow::SchemaManifest manifest, char *colu
     return false;
 }
 
+/*
+ * attribute_column_name
+ *      Name of the parquet column the attribute is mapped to.
+ */
+static char *
+attribute_column_name(Relation rel, AttrNumber attnum)
+{
+    List       *options;
+    ListCell   *lc;
+    TupleDesc   tupleDesc = RelationGetDescr(rel);
+    char       *pg_colname;
+
+    pg_colname = NameStr(TupleDescAttr(tupleDesc, attnum - 1)->attname);
+
+    /* If column_name option is used, get column name from the defined option */
+    options = GetForeignColumnOptions(RelationGetRelid(rel), attnum);
+    foreach (lc, options)
+    {
+        DefElem *def = (DefElem *)lfirst(lc);
+
+        if (strcmp(def->defname, ATTRIBUTE_OPTION_COLUMN_NAME) == 0)
+        {
+            pg_colname = defGetString(def);
+            break;
+        }
+    }
+
+    return pg_colname;
+}
+
+/*
+ * Row group being checked by extract_rowgroups_list()
+ */
+struct RowGroupCheck
+{
+    parquet::RowGroupMetaData          *meta;
+    parquet::RowGroupPageIndexReader   *page_index;
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+    parquet::RowGroupBloomFilterReader *bloom;
+#endif
+};
+
+static RowRanges
+union_row_ranges(const RowRanges &a, const RowRanges &b)
+{
+    RowRanges   res;
+    size_t      i = 0,
+                j = 0;
+
+    while (i < a.size() || j < b.size())
+    {
+        const auto &next = (j >= b.size() || (i < a.size() && a[i].first < b[j].first)) ?
+                                a[i++] : b[j++];
+
+        if (!res.empty() && res.back().second >= next.first)
+            res.back().second = Max(res.back().second, next.second);
+        else
+            res.push_back(next);
+    }
+
+    return res;
+}
+
+/*
+ * rowgroup_filter_rows
+ *      Check the filter against the row group statistics, page index and
+ *      bloom filter. Returns the rows of the row group which may match the
+ *      filter, i.e. either none, all or those within matching pages.
+ */
+static RowRanges
+rowgroup_filter_rows(RowGroupFilter &filter, RowGroupCheck &rg,
+                     parquet::arrow::SchemaManifest &manifest,
+                     Relation rel, bool schemaless)
+{
+    RowRanges   rows;
+    char       *pg_colname;
+
+    if (filter.is_or)
+    {
+        for (auto &arg : filter.args)
+            rows = union_row_ranges(rows, rowgroup_filter_rows(arg, rg, manifest,
+                                                               rel, schemaless));
+        return rows;
+    }
+
+    rows.emplace_back(0, rg.meta->num_rows());
+
+    if (schemaless)
+    {
+        /* In schemaless mode, attname has already existed  */
+        pg_colname = filter.attname;
+    }
+    else
+        pg_colname = attribute_column_name(rel, filter.attnum);
+
+    /*
+     * Search for the column with the same name as filtered attribute
+     */
+    for (auto &schema_field : manifest.schema_fields)
+    {
+        MemoryContext   ccxt = CurrentMemoryContext;
+        bool            error = false;
+        char            errstr[ERROR_STR_LEN];
+        auto           &field = schema_field.field;
+        int             column_index;
+
+        /* Skip complex objects (lists, structs except maps) */
+        if (schema_field.column_index == -1
+            && field->type()->id() != arrow::Type::MAP)
+            continue;
+
+        bool            is_string = field->type()->id() == arrow::Type::STRING;
+        bool            check_bloom = false;
+
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+        check_bloom = rg.bloom && !filter.is_key &&
+                      filter.strategy == BTEqualStrategyNumber;
+#endif
+
+        /*
+         * Skip string comparison due to Collation mismatch between
+         * Arrow and PostgreSQL. Bloom filters compare bytes though.
+         */
+        if (is_string && !check_bloom)
+            continue;
+
+        if (field->name().length() > NAMEDATALEN - 1)
+            throw Error("parquet column name '%s' is too long (max: %d)",
+                        field->name().c_str(), NAMEDATALEN - 1);
+
+        if (strcmp(pg_colname, field->name().c_str()) != 0)
+            continue;
+
+        /* in schemaless mode, skip filter if parquet column type is not match with actual column (explicit cast) type */
+        if (schemaless)
+        {
+            int arrow_type = field->type().get()->id();
+
+            if (!(filter.atttype == to_postgres_type(arrow_type) ||
+                  (filter.atttype == JSONBOID &&
+                   arrow_type == arrow::Type::MAP)))
+                continue;
+        }
+
+        if (field->type()->id() == arrow::Type::MAP)
+        {
+            /*
+             * Extract `key` column of the map.
+             * See `create_column_mapping()` for some details on
+             * map structure.
+             */
+            Assert(schema_field.children.size() == 1);
+            auto &strct = schema_field.children[0];
+
+            Assert(strct.children.size() == 2);
+            auto &key = strct.children[0];
+            column_index = key.column_index;
+        }
+        else
+            column_index = schema_field.column_index;
+
+        /* Found it! */
+        std::shared_ptr<parquet::Statistics>  stats;
+        auto column = rg.meta->ColumnChunk(column_index);
+        stats = column->statistics();
+
+        PG_TRY();
+        {
+            if (!is_string && stats &&
+                !row_group_matches_filter(stats.get(),
+                                          field->type().get(),
+                                          &filter))
+                rows.clear();
+            else if (rg.page_index && !is_string &&
+                     field->type()->id() != arrow::Type::MAP)
+            {
+                RowRanges   pages;
+
+                /*
+                 * Row group min/max may span values no single page has.
+                 * Also, rows matching different filters may lie in
+                 * different pages.
+                 */
+                if (page_index_row_ranges(rg.page_index, column_index,
+                                          rg.meta->num_rows(),
+                                          field->type().get(),
+                                          &filter, pages))
+                    rows = std::move(pages);
+            }
+
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+            if (!rows.empty() && check_bloom &&
+                !bloom_filter_matches(rg.bloom, column_index,
+                                      field->type().get(), &filter))
+                rows.clear();
+#endif
+        }
+        PG_CATCH();
+        {
+            ErrorData *errdata;
+
+            MemoryContextSwitchTo(ccxt);
+            error = true;
+            errdata = CopyErrorData();
+            FlushErrorState();
+
+            strncpy(errstr, errdata->message, ERROR_STR_LEN - 1);
+            FreeErrorData(errdata);
+        }
+        PG_END_TRY();
+        if (error)
+            throw Error("parquet_s3_fdw: row group filter match failed: %s", errstr);
+        break;
+    }  /* loop over columns */
+
+    return rows;
+}
+
 /*
  * extract_rowgroups_list
  *      Analyze query predicates and using min/max statistics determine which
@@ -808,6 +1790,7 @@ extract_rowgroups_list(const char *filename,
                        std::list<RowGroupFilter> &filters,
                        uint64 *matched_rows,
                        uint64 *total_rows,
+                       List **rowgroup_sizes,
                        bool schemaless) noexcept
 {
     std::unique_ptr<parquet::arrow::FileReader> reader;
@@ -833,7 +1816,7 @@ extract_rowgroups_list(const char *filename,
         {
             status = parquet::arrow::FileReader::Make(
                     arrow::default_memory_pool(),
-                    parquet::ParquetFileReader::OpenFile(filename, false),
+                    parquetOpenLocalFile(filename, false),
                     &reader);
         }
 
@@ -850,158 +1833,122 @@ extract_rowgroups_list(const char *filename,
         if (!status.ok())
             throw Error("parquet_s3_fdw: error creating arrow schema ('%s')", filename);
 
-        /* Check each row group whether it matches the filters */
-        for (int r = 0; r < reader->num_row_groups(); r++)
-        {
-            bool match = true;
-            auto rowgroup = meta->RowGroup(r);
+        /*
+         * Page indexes (column and offset indexes) let us look at min/max
+         * values of individual pages. Files written without them simply
+         * have no page index reader.
+         */
+        std::shared_ptr<parquet::PageIndexReader> page_index_reader;
+
+        if (parquet_s3_enable_page_index && !filters.empty())
+        {
+            try
+            {
+                page_index_reader = reader->parquet_reader()->GetPageIndexReader();
+            }
+            catch (const std::exception &)
+            {
+                page_index_reader = nullptr;
+            }
+        }
+
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+        /* Bloom filters are only useful for equality */
+        parquet::BloomFilterReader *bloom_reader = NULL;
+
+        if (parquet_s3_enable_bloom_filter && !filters.empty())
+        {
+            try
+            {
+                bloom_reader = &reader->parquet_reader()->GetBloomFilterReader();
+            }
+            catch (const std::exception &)
+            {
+                bloom_reader = NULL;
+            }
+        }
+#endif
+
+        /* Check each row group whether it matches the filters */
+        for (int r = 0; r < reader->num_row_groups(); r++)
+        {
+            bool match = true;
+            auto rowgroup = meta->RowGroup(r);
+            std::shared_ptr<parquet::RowGroupPageIndexReader> page_index;
+            RowRanges   rows;
 
             /* Skip empty rowgroups */
             if (!rowgroup->num_rows())
                 continue;
 
-            for (auto &filter : filters)
+            if (page_index_reader)
             {
-                AttrNumber      attnum;
-                char           *pg_colname;
-
-                if (schemaless)
+                try
                 {
-                    /* In schemaless mode, attname has already existed  */
-                    pg_colname = filter.attname;
-
-                    if (filter.is_column == true)
-                    {
-                        /*
-                         * Check column existed for condition: v ? column
-                         * If column is not existed, exclude current file from file list.
-                         */
-                        if ((match = parquet_s3_column_is_existed(manifest, pg_colname)) == false)
-                        {
-                            elog(DEBUG1, "parquet_s3_fdw: skip file %s", filename);
-                            return NIL;
-                        }
-                        continue;
-                    }
+                    page_index = page_index_reader->RowGroup(r);
                 }
-                else
+                catch (const std::exception &)
                 {
-                    List        *options;
-                    ListCell    *lc;
-                    TupleDesc   tupleDesc = RelationGetDescr(rel);
-
-                    attnum = filter.attnum - 1;
-                    pg_colname = NameStr(TupleDescAttr(tupleDesc, attnum)->attname);
+                    page_index = nullptr;
+                }
+            }
 
-                    /* If column_name option is used, get column name from the defined option */
-                    options = GetForeignColumnOptions(RelationGetRelid(rel), attnum + 1);
-                    foreach (lc, options)
-                    {
-                        DefElem *def = (DefElem *)lfirst(lc);
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+            std::shared_ptr<parquet::RowGroupBloomFilterReader> bloom;
 
-                        if (strcmp(def->defname, ATTRIBUTE_OPTION_COLUMN_NAME) == 0)
-                        {
-                            pg_colname = defGetString(def);
-                            break;
-                        }
-                    }
+            if (bloom_reader)
+            {
+                try
+                {
+                    bloom = bloom_reader->RowGroup(r);
                 }
-
-                /*
-                 * Search for the column with the same name as filtered attribute
-                 */
-                for (auto &schema_field : manifest.schema_fields)
+                catch (const std::exception &)
                 {
-                    MemoryContext   ccxt = CurrentMemoryContext;
-                    bool            error = false;
-                    char            errstr[ERROR_STR_LEN];
-                    auto           &field = schema_field.field;
-                    int             column_index;
-
-                    /* Skip complex objects (lists, structs except maps) */
-                    if (schema_field.column_index == -1
-                        && field->type()->id() != arrow::Type::MAP)
-                        continue;
-
-                    /* Skip string comparison due to Collation mismatch between Arrow and PostgreSQL */
-                    if (field->type()->id() == arrow::Type::STRING)
-                        continue;
-
-                    if (field->name().length() > NAMEDATALEN - 1)
-                        throw Error("parquet column name '%s' is too long (max: %d)",
-                                    field->name().c_str(), NAMEDATALEN - 1);
-
-                    if (strcmp(pg_colname, field->name().c_str()) != 0)
-                        continue;
-
-                    /* in schemaless mode, skip filter if parquet column type is not match with actual column (explicit cast) type */
-                    if (schemaless)
-                    {
-                        int arrow_type = field->type().get()->id();
+                    bloom = nullptr;
+                }
+            }
+#endif
 
-                        if (!(filter.atttype == to_postgres_type(arrow_type) ||
-                              (filter.atttype == JSONBOID &&
-                               arrow_type == arrow::Type::MAP)))
-                            continue;
-                    }
+            /* Rows which may match all the filters checked so far */
+            rows.emplace_back(0, rowgroup->num_rows());
 
-                    if (field->type()->id() == arrow::Type::MAP)
-                    {
-                        /*
-                         * Extract `key` column of the map.
-                         * See `create_column_mapping()` for some details on
-                         * map structure.
-                         */
-                        Assert(schema_field.children.size() == 1);
-                        auto &strct = schema_field.children[0];
-
-                        Assert(strct.children.size() == 2);
-                        auto &key = strct.children[0];
-                        column_index = key.column_index;
-                    }
-                    else
-                        column_index = schema_field.column_index;
+            RowGroupCheck rg {};
 
-                    /* Found it! */
-                    std::shared_ptr<parquet::Statistics>  stats;
-                    auto column = rowgroup->ColumnChunk(column_index);
-                    stats = column->statistics();
+            rg.meta = rowgroup.get();
+            rg.page_index = page_index.get();
+#ifdef PARQUET_S3_HAVE_BLOOM_FILTER
+            rg.bloom = bloom.get();
+#endif
 
-                    PG_TRY();
-                    {
-                        /*
-                         * If at least one filter doesn't match rowgroup exclude
-                         * the current row group and proceed with the next one.
-                         */
-                        if (stats && !row_group_matches_filter(stats.get(),
-                                                               field->type().get(),
-                                                               &filter))
-                        {
-                            match = false;
-                            elog(DEBUG1, "parquet_s3_fdw: skip rowgroup %d", r + 1);
-                        }
-                    }
-                    PG_CATCH();
+            for (auto &filter : filters)
+            {
+                /*
+                 * Check column existed for condition: v ? column
+                 * If column is not existed, exclude current file from file list.
+                 */
+                if (schemaless && filter.is_column == true)
+                {
+                    if ((match = parquet_s3_column_is_existed(manifest, filter.attname)) == false)
                     {
-                        ErrorData *errdata;
-
-                        MemoryContextSwitchTo(ccxt);
-                        error = true;
-                        errdata = CopyErrorData();
-                        FlushErrorState();
-
-                        strncpy(errstr, errdata->message, ERROR_STR_LEN - 1);
-                        FreeErrorData(errdata);
+                        elog(DEBUG1, "parquet_s3_fdw: skip file %s", filename);
+                        return NIL;
                     }
-                    PG_END_TRY();
-                    if (error)
-                        throw Error("parquet_s3_fdw: row group filter match failed: %s", errstr);
-                    break;
-                }  /* loop over columns */
+                    continue;
+                }
 
-                if (!match)
+                /*
+                 * If at least one filter doesn't match rowgroup exclude
+                 * the current row group and proceed with the next one.
+                 */
+                rows = intersect_row_ranges(rows,
+                                            rowgroup_filter_rows(filter, rg, manifest,
+                                                                 rel, schemaless));
+                if (rows.empty())
+                {
+                    match = false;
+                    elog(DEBUG1, "parquet_s3_fdw: skip rowgroup %d", r + 1);
                     break;
-
+                }
             }  /* loop over filters */
 
             /* All the filters match this rowgroup */
@@ -1009,6 +1956,9 @@ extract_rowgroups_list(const char *filename,
             {
                 /* TODO: PG_TRY */
                 rowgroups = lappend_int(rowgroups, r);
+                *rowgroup_sizes = lappend_int(*rowgroup_sizes,
+                                              (int) Min(rowgroup->total_compressed_size() / 1024,
+                                                        PG_INT32_MAX));
                 *matched_rows += rowgroup->num_rows();
             }
             *total_rows += rowgroup->num_rows();
@@ -1067,7 +2017,7 @@ extract_parquet_fields(const char *path, const char *dirname, Aws::S3::S3Client
         {
             status = parquet::arrow::FileReader::Make(
                         arrow::default_memory_pool(),
-                        parquet::ParquetFileReader::OpenFile(path, false),
+                        parquetOpenLocalFile(path, false),
                         &reader);
         }
         if (!status.ok())
@@ -1554,6 +2504,7 @@ get_table_options(Oid relid, ParquetFdwPlanState *fdw_private)
     fdw_private->use_mmap = false;
     fdw_private->use_threads = false;
     fdw_private->max_open_files = 0;
+    fdw_private->parallel_workers = -1;
     fdw_private->files_in_order = false;
     fdw_private->schemaless = false;
     fdw_private->key_columns = NIL;
@@ -1599,6 +2550,14 @@ get_table_options(Oid relid, ParquetFdwPlanState *fdw_private)
             fdw_private->max_open_files = pg_strtoint32(defGetString(def));
 #else
             fdw_private->max_open_files = string_to_int32(defGetString(def));
+#endif
+        }
+        else if (strcmp(def->defname, "parallel_workers") == 0)
+        {
+#if PG_VERSION_NUM >= 150000
+            fdw_private->parallel_workers = pg_strtoint32(defGetString(def));
+#else
+            fdw_private->parallel_workers = string_to_int32(defGetString(def));
 #endif
         }
         else if (strcmp(def->defname, "files_in_order") == 0)
@@ -1691,12 +2650,15 @@ parquetGetForeignRelSize(PlannerInfo *root,
     foreach (lc, filenames_orig)
     {
         char *filename = strVal(lfirst(lc));
+        List *sizes = NIL;
         List *rowgroups = extract_rowgroups_list(filename, fdw_private->dirname, fdw_private->s3client,
-                                                 rel, filters, &matched_rows, &total_rows, fdw_private->schemaless);
+                                                 rel, filters, &matched_rows, &total_rows, &sizes,
+                                                 fdw_private->schemaless);
 
         if (rowgroups)
         {
             fdw_private->rowgroups = lappend(fdw_private->rowgroups, rowgroups);
+            fdw_private->rowgroup_sizes = lappend(fdw_private->rowgroup_sizes, sizes);
             fdw_private->filenames = lappend(fdw_private->filenames, lfirst(lc));
         }
     }
@@ -1766,6 +2728,47 @@ extract_used_attributes(RelOptInfo *baserel)
     }
 }
 
+/*
+ * get_parallel_workers
+ *      Number of workers to plan for a parallel scan of the matched row
+ *      groups. The parallel_workers table option takes precedence. Otherwise,
+ *      if enabled, it is derived from the compressed size of the row groups
+ *      the same way compute_parallel_worker() does from heap pages, so that
+ *      small scans are not parallelized at all.
+ */
+static int
+get_parallel_workers(RelOptInfo *baserel, ParquetFdwPlanState *fdw_private)
+{
+    ListCell   *lc;
+    int         nrowgroups = 0;
+    double      pages = 0;
+    int         num_workers;
+
+    foreach (lc, fdw_private->rowgroups)
+        nrowgroups += list_length((List *) lfirst(lc));
+
+    if (fdw_private->parallel_workers >= 0)
+        num_workers = Min(fdw_private->parallel_workers,
+                          max_parallel_workers_per_gather);
+    else if (parquet_s3_enable_parallel_workers_estimate)
+    {
+        foreach (lc, fdw_private->rowgroup_sizes)
+        {
+            ListCell   *lc2;
+
+            foreach (lc2, (List *) lfirst(lc))
+                pages += (double) lfirst_int(lc2) * 1024 / BLCKSZ;
+        }
+        num_workers = compute_parallel_worker(baserel, pages, -1,
+                                              max_parallel_workers_per_gather);
+    }
+    else
+        num_workers = max_parallel_workers_per_gather;
+
+    /* Row groups are the unit of work, the leader takes one too */
+    return Max(Min(num_workers, nrowgroups - 1), 0);
+}
+
 /*
  * cost_merge
  *      Calculate the cost of merging nfiles files. The entire logic is stolen
@@ -1839,7 +2842,7 @@ schemaless_get_sorted_column_type(Aws::S3::S3Client *s3_client, List *file_list,
             {
                 status = parquet::arrow::FileReader::Make(
                         arrow::default_memory_pool(),
-                        parquet::ParquetFileReader::OpenFile(filename, false),
+                        parquetOpenLocalFile(filename, false),
                         &reader);
             }
 
@@ -2066,6 +3069,108 @@ schemaless_build_path_key(PlannerInfo *root, RelOptInfo *baserel, ParquetFdwPlan
     return pathkeys;
 }
 
+/*
+ * ec_member_matches_column
+ *      Callback for generate_implied_equalities_for_column(), accepts plain
+ *      columns of the foreign table.
+ */
+static bool
+ec_member_matches_column(PlannerInfo * /* root */, RelOptInfo *rel,
+                         EquivalenceClass * /* ec */, EquivalenceMember *em,
+                         void * /* arg */)
+{
+    Var        *var = (Var *) em->em_expr;
+
+    return IsA(var, Var) && (Index) var->varno == rel->relid &&
+           var->varlevelsup == 0 && var->varattno > 0;
+}
+
+/*
+ * add_parameterized_paths
+ *      Add paths parameterized by the relations referenced in join clauses.
+ *      In a nested loop the values coming from the outer side are then known
+ *      when the scan starts and are used to skip row groups and rows, see
+ *      set_row_filter_params().
+ */
+static void
+add_parameterized_paths(PlannerInfo *root, RelOptInfo *baserel,
+                        ParquetFdwPlanState *fdw_private,
+                        Cost startup_cost, Cost run_cost, bool is_multi)
+{
+    List       *clauses = NIL;
+    List       *required_outers = NIL;
+    ListCell   *lc;
+
+    /* Join clauses the scan can evaluate itself */
+    foreach (lc, baserel->joininfo)
+    {
+        RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+        if (join_clause_is_movable_to(rinfo, baserel))
+            clauses = lappend(clauses, rinfo);
+    }
+
+    /* Equalities implied by equivalence classes */
+    if (baserel->has_eclass_joins)
+        clauses = list_concat(clauses,
+                              generate_implied_equalities_for_column(root, baserel,
+                                                                     ec_member_matches_column,
+                                                                     NULL,
+                                                                     baserel->lateral_referencers));
+
+    foreach (lc, clauses)
+    {
+        RestrictInfo   *rinfo = (RestrictInfo *) lfirst(lc);
+        ParquetFdwPlanState *private_param;
+        ParamPathInfo  *param_info;
+        Relids          required_outer;
+        Path           *path;
+        ListCell       *lc2;
+        bool            found = false;
+        double          fraction;
+
+        required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+        required_outer = bms_del_member(required_outer, baserel->relid);
+        if (bms_is_empty(required_outer))
+            continue;
+
+        /* One path per distinct set of outer relations */
+        foreach (lc2, required_outers)
+        {
+            if (bms_equal((Relids) lfirst(lc2), required_outer))
+            {
+                found = true;
+                break;
+            }
+        }
+        if (found)
+            continue;
+        required_outers = lappend(required_outers, required_outer);
+
+        param_info = get_baserel_parampathinfo(root, baserel, required_outer);
+
+        private_param = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
+        memcpy(private_param, fdw_private, sizeof(ParquetFdwPlanState));
+
+        /* Expect the reading to shrink along with the number of matching rows */
+        fraction = Min(1.0, param_info->ppi_rows / Max(baserel->rows, 1.0));
+
+        path = (Path *) create_foreignscan_path(root, baserel,
+                                                NULL,	/* default pathtarget */
+                                                param_info->ppi_rows,
+                                                startup_cost,
+                                                startup_cost + run_cost * fraction,
+                                                NULL,   /* no pathkeys */
+                                                required_outer,
+                                                NULL,	/* no extra plan */
+                                                (List *) private_param);
+        if (!enable_multifile && is_multi)
+            path->total_cost += disable_cost;
+
+        add_path(baserel, path);
+    }
+}
+
 extern "C" void
 parquetGetForeignPaths(PlannerInfo *root,
                        RelOptInfo *baserel,
@@ -2082,6 +3187,7 @@ parquetGetForeignPaths(PlannerInfo *root,
     ListCell   *lc;
     ListCell   *lc2;
     bool        schemaless;
+    int         num_workers;
 
     fdw_private = (ParquetFdwPlanState *) baserel->fdw_private;
     schemaless = fdw_private->schemaless;
@@ -2126,148 +3232,973 @@ parquetGetForeignPaths(PlannerInfo *root,
             int32       typmod;
             Var        *var;
 
-            if (root_pathkey->pk_eclass->ec_has_volatile)
-                break;
+            if (root_pathkey->pk_eclass->ec_has_volatile)
+                break;
+
+            if ((attnum = get_attnum(relid, (char *)lfirst(lc))) == InvalidAttrNumber)
+                elog(ERROR, "parquet_s3_fdw: invalid attribute name '%s'", (char *)lfirst(lc));
+
+            /* Build an expression (simple var) for the attribute */
+            get_atttypetypmodcoll(relid, attnum, &typid, &typmod, &collid);
+            var = makeVar(baserel->relid, attnum, typid, typmod, collid, 0);
+
+            pathkeys = create_path_key_from_sorted_option(root, root_pathkey, typid,
+                                                          baserel->relids, (Expr *) var, pathkeys);
+        }
+    }
+
+    foreign_path = (Path *) create_foreignscan_path(root, baserel,
+                                                    NULL,	/* default pathtarget */
+                                                    baserel->rows,
+                                                    startup_cost,
+                                                    total_cost,
+                                                    NULL,   /* no pathkeys */
+                                                    baserel->lateral_relids,
+                                                    NULL,	/* no extra plan */
+                                                    (List *) fdw_private);
+    if (!enable_multifile && is_multi)
+        foreign_path->total_cost += disable_cost;
+
+    add_path(baserel, (Path *) foreign_path);
+
+    if (fdw_private->type == RT_TRIVIAL)
+        return;
+
+    if (parquet_s3_enable_parameterized_paths && !schemaless)
+        add_parameterized_paths(root, baserel, fdw_private,
+                                startup_cost, run_cost, is_multi);
+
+    /* Create a separate path with pathkeys for sorted parquet files. */
+    if (is_sorted)
+    {
+        Path                   *path;
+        ParquetFdwPlanState    *private_sort;
+
+        private_sort = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
+        memcpy(private_sort, fdw_private, sizeof(ParquetFdwPlanState));
+
+        path = (Path *) create_foreignscan_path(root, baserel,
+                                                NULL,	/* default pathtarget */
+                                                baserel->rows,
+                                                startup_cost,
+                                                total_cost,
+                                                pathkeys,
+                                                baserel->lateral_relids,
+                                                NULL,	/* no extra plan */
+                                                (List *) private_sort);
+
+        /* For multifile case calculate the cost of merging files */
+        if (is_multi)
+        {
+            private_sort->type = private_sort->max_open_files > 0 ?
+                RT_CACHING_MULTI_MERGE : RT_MULTI_MERGE;
+
+            cost_merge((Path *) path, list_length(private_sort->filenames),
+                       startup_cost, total_cost, private_sort->matched_rows);
+
+            if (!enable_multifile_merge)
+                path->total_cost += disable_cost;
+        }
+        add_path(baserel, path);
+    }
+
+    /* Parallel paths */
+    if (baserel->consider_parallel > 0 &&
+        (num_workers = get_parallel_workers(baserel, fdw_private)) > 0)
+    {
+        ParquetFdwPlanState *private_parallel;
+        bool use_pathkeys = false;
+
+        private_parallel = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
+        memcpy(private_parallel, fdw_private, sizeof(ParquetFdwPlanState));
+        private_parallel->type = is_multi ? RT_MULTI : RT_SINGLE;
+
+        /* For mutifile reader only use pathkeys when files are in order */
+        use_pathkeys = is_sorted && (!is_multi || (is_multi && fdw_private->files_in_order));
+
+        /*
+         * Row groups are handed out to the workers largest first, unless
+         * each worker needs to read them in file order to keep them sorted.
+         */
+        if (use_pathkeys)
+            private_parallel->rowgroup_sizes = NIL;
+
+        Path *path = (Path *)
+                 create_foreignscan_path(root, baserel,
+                                         NULL,	/* default pathtarget */
+                                         baserel->rows,
+                                         startup_cost,
+                                         total_cost,
+                                         use_pathkeys ? pathkeys : NULL,
+                                         baserel->lateral_relids,
+                                         NULL,	/* no extra plan */
+                                         (List *) private_parallel);
+
+        path->rows = path->rows / (num_workers + 1);
+        path->total_cost       = startup_cost + run_cost / (num_workers + 1);
+        path->parallel_workers = num_workers;
+        path->parallel_aware   = true;
+        path->parallel_safe    = true;
+
+        if (!enable_multifile)
+            path->total_cost += disable_cost;
+
+        add_partial_path(baserel, path);
+
+        /* Multifile Merge parallel path */
+        if (is_multi && is_sorted)
+        {
+            ParquetFdwPlanState *private_parallel_merge;
+
+            private_parallel_merge = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
+            memcpy(private_parallel_merge, fdw_private, sizeof(ParquetFdwPlanState));
+
+            private_parallel_merge->type = private_parallel_merge->max_open_files > 0 ?
+                RT_CACHING_MULTI_MERGE : RT_MULTI_MERGE;
+
+            Path *path = (Path *)
+                     create_foreignscan_path(root, baserel,
+                                             NULL,	/* default pathtarget */
+                                             baserel->rows,
+                                             startup_cost,
+                                             total_cost,
+                                             pathkeys,
+                                             baserel->lateral_relids,
+                                             NULL,	/* no extra plan */
+                                             (List *) private_parallel_merge);
+
+            cost_merge(path, list_length(private_parallel_merge->filenames),
+                       startup_cost, total_cost, private_parallel_merge->matched_rows);
+
+            path->rows = path->rows / (num_workers + 1);
+            path->total_cost = path->startup_cost + path->total_cost / (num_workers + 1);
+            path->parallel_workers = num_workers;
+            path->parallel_aware   = true;
+            path->parallel_safe    = true;
+
+            if (!enable_multifile_merge)
+                path->total_cost += disable_cost;
+
+            add_partial_path(baserel, path);
+        }
+    }
+}
+
+/*
+ * is_exact_statistics_type
+ *      Whether min/max statistics of columns of the type are exact and ordered
+ *      the same way as in PostgreSQL. Strings may be ordered differently
+ *      (collations) and floats may hide NaNs.
+ */
+static bool
+is_exact_statistics_type(Oid type)
+{
+    switch (type)
+    {
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case DATEOID:
+        case TIMESTAMPOID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Restriction checked to find row groups whose rows all satisfy it, see
+ * rowgroup_covered()
+ */
+struct CoveringFilter
+{
+    AttrNumber  attnum;
+    Datum       value;
+    int         strategy;
+    FmgrInfo    cmpfunc;    /* compares the value with the column type */
+};
+
+/*
+ * Aggregate answered from row group metadata
+ */
+struct MetadataAggregate
+{
+    AggregateSpec   spec;
+    FmgrInfo       *cmpfunc;    /* MIN/MAX only */
+};
+
+/*
+ * extract_covering_filters
+ *      Convert restriction clauses into filters telling exactly whether every
+ *      row of a row group satisfies them. Returns false if any of the clauses
+ *      cannot be represented so.
+ */
+static bool
+extract_covering_filters(List *clauses, Index relid,
+                         std::vector<CoveringFilter> &filters)
+{
+    ListCell   *lc;
+
+    foreach (lc, clauses)
+    {
+        Expr       *clause = (Expr *) lfirst(lc);
+        OpExpr     *expr;
+        Expr       *left, *right;
+        Var        *v;
+        Const      *c;
+        Oid         opno;
+        CoveringFilter f;
+
+        if (!IsA(clause, OpExpr))
+            return false;
+
+        expr = (OpExpr *) clause;
+        if (list_length(expr->args) != 2)
+            return false;
+
+        left = (Expr *) linitial(expr->args);
+        right = (Expr *) lsecond(expr->args);
+
+        if (IsA(left, Var) && IsA(right, Const))
+        {
+            v = (Var *) left;
+            c = (Const *) right;
+            opno = expr->opno;
+        }
+        else if (IsA(left, Const) && IsA(right, Var))
+        {
+            /* reverse order (CONST OP VAR) */
+            v = (Var *) right;
+            c = (Const *) left;
+            opno = get_commutator(expr->opno);
+        }
+        else
+            return false;
+
+        if ((Index) v->varno != relid || v->varattno <= 0 || c->constisnull ||
+            !OidIsValid(opno) || !is_exact_statistics_type(v->vartype))
+            return false;
+
+        /* "<>" is never known to hold for all rows */
+        if ((f.strategy = get_strategy(v->vartype, opno, BTREE_AM_OID)) == 0)
+            return false;
+
+        f.attnum = v->varattno;
+        f.value = c->constvalue;
+        find_cmp_func(&f.cmpfunc, c->consttype, v->vartype);
+
+        /* potentially inserting elements may throw exceptions */
+        try {
+            filters.push_back(f);
+        } catch (std::exception &e) {
+            elog(ERROR, "parquet_s3_fdw: extracting row group filters failed");
+        }
+    }
+
+    return true;
+}
+
+/*
+ * find_primitive_column
+ *      Find the leaf column with the given name. Returns -1 if the file has
+ *      no such column and -2 if the column is not of a primitive type.
+ */
+static int
+find_primitive_column(parquet::arrow::SchemaManifest &manifest,
+                      const char *colname,
+                      std::shared_ptr<arrow::DataType> &arrow_type)
+{
+    for (auto &schema_field : manifest.schema_fields)
+    {
+        if (strcmp(colname, schema_field.field->name().c_str()) != 0)
+            continue;
+
+        if (schema_field.column_index == -1)
+            return -2;
+
+        arrow_type = schema_field.field->type();
+        return schema_field.column_index;
+    }
+
+    return -1;
+}
+
+/*
+ * rowgroup_covered
+ *      Check whether every row of the row group satisfies the filter judging
+ *      by the column statistics.
+ */
+static bool
+rowgroup_covered(CoveringFilter &filter, parquet::RowGroupMetaData *meta,
+                 parquet::arrow::SchemaManifest &manifest, Relation rel)
+{
+    std::shared_ptr<arrow::DataType> arrow_type;
+    std::shared_ptr<parquet::Statistics> stats;
+    Oid         atttype = TupleDescAttr(RelationGetDescr(rel), filter.attnum - 1)->atttypid;
+    int         column_index;
+    int         l, u;
+
+    column_index = find_primitive_column(manifest,
+                                         attribute_column_name(rel, filter.attnum),
+                                         arrow_type);
+    if (column_index < 0 || column_index >= meta->num_columns() ||
+        to_postgres_type(arrow_type->id()) != atttype)
+        return false;
+
+    /* Rows with NULLs never satisfy the filter */
+    stats = meta->ColumnChunk(column_index)->statistics();
+    if (!stats || !stats->HasMinMax() || !stats->HasNullCount() ||
+        stats->null_count() > 0)
+        return false;
+
+    std::string min = stats->EncodeMin();
+    std::string max = stats->EncodeMax();
+    Datum       lower = bytes_to_postgres_type(min.c_str(), min.length(),
+                                               arrow_type.get());
+    Datum       upper = bytes_to_postgres_type(max.c_str(), max.length(),
+                                               arrow_type.get());
+
+    l = DatumGetInt32(FunctionCall2Coll(&filter.cmpfunc, InvalidOid,
+                                        filter.value, lower));
+    u = DatumGetInt32(FunctionCall2Coll(&filter.cmpfunc, InvalidOid,
+                                        filter.value, upper));
+
+    switch (filter.strategy)
+    {
+        case BTLessStrategyNumber:
+            return u > 0;
+        case BTLessEqualStrategyNumber:
+            return u >= 0;
+        case BTEqualStrategyNumber:
+            return l == 0 && u == 0;
+        case BTGreaterEqualStrategyNumber:
+            return l <= 0;
+        case BTGreaterStrategyNumber:
+            return l < 0;
+        default:
+            return false;
+    }
+}
+
+/*
+ * rowgroup_aggregate
+ *      Compute the aggregate for the row group from its metadata. Returns
+ *      false if the metadata is not sufficient.
+ */
+static bool
+rowgroup_aggregate(MetadataAggregate &agg, parquet::RowGroupMetaData *meta,
+                   parquet::arrow::SchemaManifest &manifest, Relation rel,
+                   AggregateSpec &res)
+{
+    std::shared_ptr<arrow::DataType> arrow_type;
+    std::shared_ptr<parquet::Statistics> stats;
+    int         column_index;
+    int64       nulls;
+
+    res.count = 0;
+    res.isnull = true;
+
+    if (agg.spec.kind == AK_COUNT_STAR)
+    {
+        res.count = meta->num_rows();
+        return true;
+    }
+
+    column_index = find_primitive_column(manifest,
+                                         attribute_column_name(rel, agg.spec.attnum),
+                                         arrow_type);
+
+    /* Missing columns are read as NULLs */
+    if (column_index == -1)
+        return true;
+    if (column_index < 0 || column_index >= meta->num_columns())
+        return false;
+
+    stats = meta->ColumnChunk(column_index)->statistics();
+    if (!stats || !stats->HasNullCount())
+        return false;
+
+    nulls = stats->null_count();
+    if (agg.spec.kind == AK_COUNT)
+    {
+        res.count = meta->num_rows() - nulls;
+        return true;
+    }
+
+    /* MIN/MAX */
+    if (nulls >= meta->num_rows())
+        return true;
+
+    if (!stats->HasMinMax() || !is_exact_statistics_type(agg.spec.type) ||
+        to_postgres_type(arrow_type->id()) != agg.spec.type)
+        return false;
+
+    std::string value = agg.spec.kind == AK_MIN ? stats->EncodeMin() : stats->EncodeMax();
+
+    res.value = bytes_to_postgres_type(value.c_str(), value.length(),
+                                       arrow_type.get());
+    res.isnull = false;
+    return true;
+}
+
+/*
+ * aggregate_rowgroups_metadata
+ *      Compute the aggregates for those row groups of the file whose rows all
+ *      satisfy the filters using the metadata only. Returns the row groups
+ *      which still need to be read.
+ */
+static List *
+aggregate_rowgroups_metadata(const char *filename,
+                             const char *dirname,
+                             Aws::S3::S3Client *s3_client,
+                             Relation rel,
+                             List *rowgroups,
+                             std::vector<CoveringFilter> &filters,
+                             std::vector<MetadataAggregate> &aggs,
+                             int *nanswered) noexcept
+{
+    std::unique_ptr<parquet::arrow::FileReader> reader;
+    arrow::Status   status;
+    List           *remaining = NIL;
+    ReaderCacheEntry *reader_entry  = NULL;
+    std::string     error;
+    ListCell       *lc;
+
+    try
+    {
+        if (s3_client)
+        {
+            char *dname;
+            char *fname;
+            parquetSplitS3Path(dirname, filename, &dname, &fname);
+            reader_entry = parquetGetFileReader(s3_client, dname, fname);
+            reader = std::move(reader_entry->file_reader->reader);
+            pfree(dname);
+            pfree(fname);
+        }
+        else
+        {
+            status = parquet::arrow::FileReader::Make(
+                    arrow::default_memory_pool(),
+                    parquetOpenLocalFile(filename, false),
+                    &reader);
+        }
+
+        if (!status.ok())
+            throw Error("parquet_s3_fdw: failed to open Parquet file: %s ('%s')",
+                        status.message().c_str(), filename);
+
+        auto meta = reader->parquet_reader()->metadata();
+        parquet::ArrowReaderProperties  props;
+        parquet::arrow::SchemaManifest  manifest;
+        std::vector<AggregateSpec>      values(aggs.size());
+
+        status = parquet::arrow::SchemaManifest::Make(meta->schema(), nullptr,
+                                                      props, &manifest);
+        if (!status.ok())
+            throw Error("parquet_s3_fdw: error creating arrow schema ('%s')", filename);
+
+        foreach (lc, rowgroups)
+        {
+            int     r = lfirst_int(lc);
+            auto    rowgroup = meta->RowGroup(r);
+            bool    answered = true;
+
+            for (auto &filter : filters)
+            {
+                if (!rowgroup_covered(filter, rowgroup.get(), manifest, rel))
+                {
+                    answered = false;
+                    break;
+                }
+            }
+
+            for (size_t i = 0; answered && i < aggs.size(); i++)
+                answered = rowgroup_aggregate(aggs[i], rowgroup.get(), manifest,
+                                              rel, values[i]);
+
+            if (!answered)
+            {
+                remaining = lappend_int(remaining, r);
+                continue;
+            }
+
+            for (size_t i = 0; i < aggs.size(); i++)
+            {
+                AggregateSpec  &acc = aggs[i].spec;
+                AggregateSpec  &val = values[i];
+
+                acc.count += val.count;
+                if (val.isnull)
+                    continue;
+
+                if (!acc.isnull)
+                {
+                    int cmp = DatumGetInt32(FunctionCall2Coll(aggs[i].cmpfunc,
+                                                              acc.collid,
+                                                              val.value,
+                                                              acc.value));
+
+                    if ((acc.kind == AK_MIN && cmp >= 0) ||
+                        (acc.kind == AK_MAX && cmp <= 0))
+                        continue;
+                }
+                acc.value = val.value;
+                acc.isnull = false;
+            }
+            (*nanswered)++;
+        }
+    }
+    catch(const std::exception& e) {
+        error = e.what();
+    }
+    if (reader_entry)
+        reader_entry->file_reader->reader = std::move(reader);
+    if (!error.empty())
+        elog(ERROR,
+             "parquet_s3_fdw: failed to read metadata of Parquet file: %s ('%s')",
+             error.c_str(), filename);
+
+    return remaining;
+}
+
+/*
+ * aggregate_metadata
+ *      Start the aggregates with the values of the row groups which can be
+ *      answered from metadata and remove those row groups from the lists of
+ *      the files to read. Called at executor startup rather than at planning
+ *      time, so that cached plans do not keep values of files which may have
+ *      changed since. Returns the number of the answered row groups.
+ */
+static int
+aggregate_metadata(Oid relid, Index scan_relid, List *scan_quals,
+                   const char *dirname, Aws::S3::S3Client *s3_client,
+                   std::vector<AggregateSpec> &aggs,
+                   List **filenames, List **rowgroups_list)
+{
+    std::vector<CoveringFilter>     filters;
+    std::vector<MetadataAggregate>  magg;
+    List       *remaining_files = NIL;
+    List       *remaining_rowgroups = NIL;
+    int         nanswered = 0;
+    Relation    rel;
+    ListCell   *lc, *lc2;
+
+    if (!extract_covering_filters(scan_quals, scan_relid, filters))
+        return 0;
+
+    try
+    {
+        for (auto &spec : aggs)
+            magg.push_back({spec, NULL});
+    }
+    catch (std::exception &e)
+    {
+        elog(ERROR, "parquet_s3_fdw: scan initialization failed: %s", e.what());
+    }
+
+    /* Built-in MIN/MAX order values by the default btree opclass */
+    for (auto &agg : magg)
+    {
+        if (agg.spec.kind == AK_MIN || agg.spec.kind == AK_MAX)
+            agg.cmpfunc = &lookup_type_cache(agg.spec.type,
+                                             TYPECACHE_CMP_PROC_FINFO)->cmp_proc_finfo;
+    }
+
+    rel = table_open(relid, AccessShareLock);
+    forboth (lc, *filenames, lc2, *rowgroups_list)
+    {
+        char   *filename = strVal(lfirst(lc));
+        List   *rowgroups;
+
+        rowgroups = aggregate_rowgroups_metadata(filename, dirname, s3_client,
+                                                 rel, (List *) lfirst(lc2),
+                                                 filters, magg, &nanswered);
+        if (rowgroups)
+        {
+            remaining_files = lappend(remaining_files, lfirst(lc));
+            remaining_rowgroups = lappend(remaining_rowgroups, rowgroups);
+        }
+    }
+    table_close(rel, NoLock);
+
+    for (size_t i = 0; i < aggs.size(); i++)
+        aggs[i] = magg[i].spec;
+
+    *filenames = remaining_files;
+    *rowgroups_list = remaining_rowgroups;
+    return nanswered;
+}
+
+/*
+ * get_aggregate_spec
+ *      Recognize the aggregates which can be computed by the scan: COUNT(*),
+ *      and COUNT, MIN, MAX, SUM and AVG of a column, of the built-in aggregate
+ *      functions. In partial mode the aggregate must be the partial step of a
+ *      parallel aggregation.
+ */
+static bool
+get_aggregate_spec(Aggref *aggref, Index relid, bool partial,
+                   MetadataAggregate &agg)
+{
+    char       *name;
+    Var        *v;
+
+    if (aggref->aggfilter || aggref->aggdistinct || aggref->aggorder ||
+        aggref->aggkind != AGGKIND_NORMAL || aggref->agglevelsup != 0 ||
+        aggref->aggsplit != (partial ? AGGSPLIT_INITIAL_SERIAL : AGGSPLIT_SIMPLE))
+        return false;
+
+    if (get_func_namespace(aggref->aggfnoid) != PG_CATALOG_NAMESPACE)
+        return false;
+    name = get_func_name(aggref->aggfnoid);
+
+    memset(&agg, 0, sizeof(agg));
+    agg.spec.isnull = true;
+
+    if (aggref->aggstar)
+    {
+        agg.spec.kind = AK_COUNT_STAR;
+        return strcmp(name, "count") == 0;
+    }
+
+    if (list_length(aggref->args) != 1)
+        return false;
+
+    v = (Var *) ((TargetEntry *) linitial(aggref->args))->expr;
+    if (!IsA(v, Var) || (Index) v->varno != relid || v->varattno <= 0 ||
+        v->varlevelsup != 0)
+        return false;
+
+    agg.spec.attnum = v->varattno;
+    agg.spec.type = v->vartype;
+    agg.spec.collid = aggref->inputcollid;
+
+    if (strcmp(name, "count") == 0)
+        agg.spec.kind = AK_COUNT;
+    else if (strcmp(name, "min") == 0 || strcmp(name, "max") == 0)
+    {
+        TypeCacheEntry *tce;
+
+        agg.spec.kind = name[1] == 'i' ? AK_MIN : AK_MAX;
+
+        /* Built-in MIN/MAX order values by the default btree opclass */
+        tce = lookup_type_cache(v->vartype, TYPECACHE_CMP_PROC_FINFO);
+        if (!OidIsValid(tce->cmp_proc))
+            return false;
+        agg.cmpfunc = &tce->cmp_proc_finfo;
+    }
+    else if (strcmp(name, "sum") == 0)
+        agg.spec.kind = AK_SUM;
+    else if (strcmp(name, "avg") == 0)
+        agg.spec.kind = AK_AVG;
+    else
+        return false;
+
+    return aggregate_supported(agg.spec.kind, agg.spec.type, partial);
+}
 
-            if ((attnum = get_attnum(relid, (char *)lfirst(lc))) == InvalidAttrNumber)
-                elog(ERROR, "parquet_s3_fdw: invalid attribute name '%s'", (char *)lfirst(lc));
+/*
+ * get_group_keys
+ *      Collect the attribute numbers of the GROUP BY columns and the columns
+ *      themselves, whether or not they are in the target list. Only plain
+ *      columns compared by the default equality of their type (bytewise, for
+ *      strings under a deterministic collation) are supported.
+ */
+static bool
+get_group_keys(Query *parse, Index relid, List **keys, List **exprs)
+{
+    ListCell   *lc;
 
-            /* Build an expression (simple var) for the attribute */
-            get_atttypetypmodcoll(relid, attnum, &typid, &typmod, &collid);
-            var = makeVar(baserel->relid, attnum, typid, typmod, collid, 0);
+    foreach (lc, parse->groupClause)
+    {
+        SortGroupClause *sgc = (SortGroupClause *) lfirst(lc);
+        TargetEntry *tle = get_sortgroupclause_tle(sgc, parse->targetList);
+        Var        *v = (Var *) tle->expr;
+        TypeCacheEntry *tce;
 
-            pathkeys = create_path_key_from_sorted_option(root, root_pathkey, typid,
-                                                          baserel->relids, (Expr *) var, pathkeys);
+        if (!IsA(v, Var) || (Index) v->varno != relid || v->varattno <= 0 ||
+            v->varlevelsup != 0)
+            return false;
+
+        if (!aggregate_key_supported(v->vartype))
+            return false;
+
+        tce = lookup_type_cache(v->vartype, TYPECACHE_EQ_OPR);
+        if (sgc->eqop != tce->eq_opr)
+            return false;
+
+        if (OidIsValid(v->varcollid) &&
+            !get_collation_isdeterministic(v->varcollid))
+            return false;
+
+        if (!list_member_int(*keys, v->varattno))
+        {
+            *keys = lappend_int(*keys, v->varattno);
+            *exprs = lappend(*exprs, v);
         }
     }
 
-    foreign_path = (Path *) create_foreignscan_path(root, baserel,
-                                                    NULL,	/* default pathtarget */
-                                                    baserel->rows,
-                                                    startup_cost,
-                                                    total_cost,
-                                                    NULL,   /* no pathkeys */
-                                                    baserel->lateral_relids,
-                                                    NULL,	/* no extra plan */
-                                                    (List *) fdw_private);
-    if (!enable_multifile && is_multi)
-        foreign_path->total_cost += disable_cost;
+    return true;
+}
 
-    add_path(baserel, (Path *) foreign_path);
+/*
+ * parquetGetForeignUpperPaths
+ *      Add a path computing the aggregation (COUNT, MIN, MAX, SUM, AVG,
+ *      optionally grouped by plain columns) by the scan itself. Ungrouped
+ *      COUNT, MIN and MAX of row groups whose rows all satisfy the
+ *      restrictions are answered from the row group metadata (number of rows,
+ *      null counts and min/max statistics) without reading any data; only the
+ *      rest is read.
+ *
+ *      At the partial aggregation stage of a parallel plan a partial path is
+ *      added instead, each worker aggregating the row groups it reads.
+ */
+extern "C" void
+parquetGetForeignUpperPaths(PlannerInfo *root,
+                            UpperRelationKind stage,
+                            RelOptInfo *input_rel,
+                            RelOptInfo *output_rel,
+                            void *extra)
+{
+    ParquetFdwPlanState *fdw_private;
+    ParquetFdwPlanState *private_agg;
+    Query          *parse = root->parse;
+    std::vector<CoveringFilter>     filters;
+    std::vector<MetadataAggregate>  aggs;
+    List           *agg_list = NIL;
+    List           *group_keys = NIL;
+    List           *group_exprs = NIL;
+    List           *scan_quals = NIL;
+    List           *filenames;
+    uint64          remaining_rows;
+    bool            partial;
+    int             num_workers = 0;
+    bool            use_metadata = true;
+    double          num_groups = 1;
+    Size            group_size;
+    ListCell       *lc;
+    Cost            startup_cost;
+    Cost            run_cost;
+    Path           *path;
 
-    if (fdw_private->type == RT_TRIVIAL)
+    if (!parquet_s3_enable_aggregate_pushdown ||
+        (stage != UPPERREL_GROUP_AGG && stage != UPPERREL_PARTIAL_GROUP_AGG) ||
+        output_rel->fdw_private != NULL)
         return;
 
-    /* Create a separate path with pathkeys for sorted parquet files. */
-    if (is_sorted)
-    {
-        Path                   *path;
-        ParquetFdwPlanState    *private_sort;
+    if (input_rel->reloptkind != RELOPT_BASEREL ||
+        input_rel->fdw_private == NULL ||
+        !bms_is_empty(input_rel->lateral_relids))
+        return;
 
-        private_sort = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
-        memcpy(private_sort, fdw_private, sizeof(ParquetFdwPlanState));
+    fdw_private = (ParquetFdwPlanState *) input_rel->fdw_private;
+    if (fdw_private->schemaless || fdw_private->type == RT_TRIVIAL)
+        return;
 
-        path = (Path *) create_foreignscan_path(root, baserel,
-                                                NULL,	/* default pathtarget */
-                                                baserel->rows,
-                                                startup_cost,
-                                                total_cost,
-                                                pathkeys,
-                                                baserel->lateral_relids,
-                                                NULL,	/* no extra plan */
-                                                (List *) private_sort);
+    /* Partial aggregation is only useful for the parallel scan */
+    partial = stage == UPPERREL_PARTIAL_GROUP_AGG;
+    if (partial &&
+        (!input_rel->consider_parallel || !output_rel->consider_parallel ||
+         max_parallel_workers_per_gather <= 0))
+        return;
 
-        /* For multifile case calculate the cost of merging files */
-        if (is_multi)
+    /* Aggregation of the whole table, optionally grouped by plain columns */
+    if (!parse->hasAggs || parse->groupingSets || parse->havingQual)
+        return;
+    if (extra &&
+        ((GroupPathExtraData *) extra)->patype != PARTITIONWISE_AGGREGATE_NONE)
+        return;
+    if (!get_group_keys(parse, input_rel->relid, &group_keys, &group_exprs))
+        return;
+
+    foreach (lc, output_rel->reltarget->exprs)
+    {
+        Expr               *expr = (Expr *) lfirst(lc);
+        MetadataAggregate   agg;
+
+        if (IsA(expr, Var))
         {
-            private_sort->type = private_sort->max_open_files > 0 ?
-                RT_CACHING_MULTI_MERGE : RT_MULTI_MERGE;
+            Var    *v = (Var *) expr;
 
-            cost_merge((Path *) path, list_length(private_sort->filenames),
-                       startup_cost, total_cost, private_sort->matched_rows);
+            /* Grouping column */
+            if ((Index) v->varno != input_rel->relid || v->varlevelsup != 0 ||
+                !list_member_int(group_keys, v->varattno))
+                return;
 
-            if (!enable_multifile_merge)
-                path->total_cost += disable_cost;
+            memset(&agg, 0, sizeof(agg));
+            agg.spec.kind = AK_GROUP_KEY;
+            agg.spec.attnum = v->varattno;
+            agg.spec.type = v->vartype;
+            agg.spec.isnull = true;
+        }
+        else if (!IsA(expr, Aggref) ||
+                 !get_aggregate_spec((Aggref *) expr, input_rel->relid,
+                                     partial, agg))
+            return;
+
+        /* Only ungrouped COUNT, MIN and MAX are known from metadata */
+        if (agg.spec.kind != AK_COUNT_STAR && agg.spec.kind != AK_COUNT &&
+            agg.spec.kind != AK_MIN && agg.spec.kind != AK_MAX)
+            use_metadata = false;
+
+        try {
+            aggs.push_back(agg);
+        } catch (std::exception &e) {
+            elog(ERROR, "parquet_s3_fdw: aggregate pushdown failed");
         }
-        add_path(baserel, path);
     }
 
-    /* Parallel paths */
-    if (baserel->consider_parallel > 0)
+    /*
+     * Groups are kept in memory until the scan completes, so the scan should
+     * not be used if they are not expected to fit into work_mem.
+     */
+    if (group_keys != NIL)
     {
-        ParquetFdwPlanState *private_parallel;
-        bool use_pathkeys = false;
+#if PG_VERSION_NUM < 140000
+        num_groups = estimate_num_groups(root, group_exprs, input_rel->rows,
+                                         NULL);
+#else
+        num_groups = estimate_num_groups(root, group_exprs, input_rel->rows,
+                                         NULL, NULL);
+#endif
+        group_size = aggregate_group_size(list_length(group_keys), aggs.size());
+        foreach (lc, group_keys)
+        {
+            AttrNumber  attnum = lfirst_int(lc);
 
-        private_parallel = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
-        memcpy(private_parallel, fdw_private, sizeof(ParquetFdwPlanState));
-        private_parallel->type = is_multi ? RT_MULTI : RT_SINGLE;
+            group_size += input_rel->attr_widths[attnum - input_rel->min_attr];
+        }
+        if (num_groups * group_size > work_mem * 1024.0)
+            return;
+        use_metadata = false;
+    }
 
-        /* For mutifile reader only use pathkeys when files are in order */
-        use_pathkeys = is_sorted && (!is_multi || (is_multi && fdw_private->files_in_order));
+    /* The scan evaluates the restrictions itself */
+    foreach (lc, input_rel->baserestrictinfo)
+    {
+        RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
 
-        Path *path = (Path *)
-                 create_foreignscan_path(root, baserel,
-                                         NULL,	/* default pathtarget */
-                                         baserel->rows,
-                                         startup_cost,
-                                         total_cost,
-                                         use_pathkeys ? pathkeys : NULL,
-                                         baserel->lateral_relids,
-                                         NULL,	/* no extra plan */
-                                         (List *) private_parallel);
+        if (rinfo->pseudoconstant || contain_subplans((Node *) rinfo->clause))
+            return;
+        scan_quals = lappend(scan_quals, rinfo->clause);
+    }
 
-        int num_workers = max_parallel_workers_per_gather;
+    /*
+     * Nothing can be answered from metadata unless all quals are understood.
+     * Workers of a parallel aggregation would each count the answered row
+     * groups. Which row groups are answered is only decided at execution
+     * time, see aggregate_rowgroups_metadata(), so that cached plans do not
+     * keep values of files which may have changed since.
+     */
+    if (partial ||
+        !extract_covering_filters(scan_quals, input_rel->relid, filters))
+        use_metadata = false;
 
-        path->rows = path->rows / (num_workers + 1);
-        path->total_cost       = startup_cost + run_cost / (num_workers + 1);
-        path->parallel_workers = num_workers;
-        path->parallel_aware   = true;
-        path->parallel_safe    = true;
+    filenames = fdw_private->filenames;
+    remaining_rows = fdw_private->matched_rows;
 
-        if (!enable_multifile)
-            path->total_cost += disable_cost;
+    /* Parallel workers need something to read */
+    if (partial &&
+        (filenames == NIL ||
+         (num_workers = get_parallel_workers(input_rel, fdw_private)) <= 0))
+        return;
 
-        add_partial_path(baserel, path);
+    /* Pack the aggregates, the Const tells the type of the argument */
+    for (auto &agg : aggs)
+    {
+        AggregateSpec  &spec = agg.spec;
+        Const          *value;
 
-        /* Multifile Merge parallel path */
-        if (is_multi && is_sorted)
-        {
-            ParquetFdwPlanState *private_parallel_merge;
+        if (spec.kind == AK_COUNT_STAR || spec.kind == AK_COUNT)
+            value = makeNullConst(INT8OID, -1, InvalidOid);
+        else
+            value = makeNullConst(spec.type, -1, InvalidOid);
 
-            private_parallel_merge = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
-            memcpy(private_parallel_merge, fdw_private, sizeof(ParquetFdwPlanState));
+        agg_list = lappend(agg_list, list_make4(makeInteger(spec.kind),
+                                                makeInteger(spec.attnum),
+                                                makeInteger(spec.collid),
+                                                value));
+    }
 
-            private_parallel_merge->type = private_parallel_merge->max_open_files > 0 ?
-                RT_CACHING_MULTI_MERGE : RT_MULTI_MERGE;
+    private_agg = (ParquetFdwPlanState *) palloc(sizeof(ParquetFdwPlanState));
+    memcpy(private_agg, fdw_private, sizeof(ParquetFdwPlanState));
+    private_agg->type = list_length(filenames) == 1 ? RT_SINGLE : RT_MULTI;
+    private_agg->aggs = agg_list;
+    private_agg->scan_quals = scan_quals;
+    private_agg->scan_relid = input_rel->relid;
+    private_agg->relid = planner_rt_fetch(input_rel->relid, root)->relid;
+    private_agg->use_metadata = use_metadata;
+    private_agg->group_keys = group_keys;
+    private_agg->partial = partial;
 
-            Path *path = (Path *)
-                     create_foreignscan_path(root, baserel,
-                                             NULL,	/* default pathtarget */
-                                             baserel->rows,
-                                             startup_cost,
-                                             total_cost,
-                                             pathkeys,
-                                             baserel->lateral_relids,
-                                             NULL,	/* no extra plan */
-                                             (List *) private_parallel_merge);
+    /*
+     * The row groups are read, unless answered from metadata, each of their
+     * rows is checked against the restrictions and added to the aggregates,
+     * without the tuples being passed to an Agg node.
+     */
+    startup_cost = input_rel->baserestrictcost.startup;
+    run_cost = remaining_rows * (cpu_tuple_cost +
+                                 input_rel->baserestrictcost.per_tuple +
+                                 cpu_operator_cost * (aggs.size() +
+                                                      list_length(group_keys)));
+
+    /* Nothing is returned before all the rows are aggregated */
+    startup_cost += run_cost;
+    run_cost = num_groups * cpu_tuple_cost;
+
+    path = (Path *) create_foreign_upper_path(root, output_rel,
+                                              output_rel->reltarget,
+                                              num_groups,
+                                              startup_cost,
+                                              startup_cost + run_cost,
+                                              NIL,  /* no pathkeys */
+                                              NULL, /* no extra plan */
+                                              (List *) private_agg);
+
+    if (partial)
+    {
+        path->startup_cost = input_rel->baserestrictcost.startup +
+            (startup_cost - input_rel->baserestrictcost.startup) / (num_workers + 1);
+        path->total_cost = path->startup_cost + run_cost;
+        path->parallel_workers = num_workers;
+        path->parallel_aware   = true;
+        path->parallel_safe    = true;
+
+        add_partial_path(output_rel, path);
+    }
+    else
+        add_path(output_rel, path);
 
-            int num_workers = max_parallel_workers_per_gather;
+    output_rel->fdw_private = private_agg;
+}
 
-            cost_merge(path, list_length(private_parallel_merge->filenames),
-                       startup_cost, total_cost, private_parallel_merge->matched_rows);
+/*
+ * get_scan_limit
+ *      Number of rows the scan is likely to be asked for, or 0 if unknown.
+ *      Known when the foreign table is the only relation of a query with a
+ *      constant LIMIT (and OFFSET) and the scan returns rows in the requested
+ *      order, so that nothing has to be done on all the rows first. The
+ *      quals are still evaluated on top of the scan, so this is only a hint.
+ */
+static int64
+get_scan_limit(PlannerInfo *root, RelOptInfo *baserel, List *pathkeys)
+{
+    Relids      relids;
 
-            path->rows = path->rows / (num_workers + 1);
-            path->total_cost = path->startup_cost + path->total_cost / (num_workers + 1);
-            path->parallel_workers = num_workers;
-            path->parallel_aware   = true;
-            path->parallel_safe    = true;
+    if (!parquet_s3_enable_limit_pushdown || root->limit_tuples <= 0 ||
+        IS_UPPER_REL(baserel))
+        return 0;
 
-            if (!enable_multifile_merge)
-                path->total_cost += disable_cost;
+    /* Children of an inheritance tree are each asked for the limit at most */
+    relids = IS_OTHER_REL(baserel) ? baserel->top_parent_relids : baserel->relids;
+    if (!bms_equal(relids, root->all_baserels))
+        return 0;
 
-            add_partial_path(baserel, path);
-        }
-    }
+    if (!pathkeys_contained_in(root->query_pathkeys, pathkeys))
+        return 0;
+
+    return (int64) root->limit_tuples;
 }
 
 extern "C" ForeignScan *
@@ -2285,6 +4216,7 @@ parquetGetForeignPlan(PlannerInfo *root,
     List       *attrs_sorted = NIL;
     AttrNumber  attr;
     List       *params = NIL;
+    List       *fdw_scan_tlist = NIL;
     ListCell   *lc;
 
 	/*
@@ -2296,7 +4228,19 @@ parquetGetForeignPlan(PlannerInfo *root,
 	 */
     scan_clauses = extract_actual_clauses(scan_clauses, false);
 
-    parquet_s3_extract_slcols(fdw_private, root, baserel, tlist);
+    /*
+     * Aggregates are computed by the scan itself which evaluates the
+     * restrictions on its own, see parquetGetForeignUpperPaths().
+     */
+    if (IS_UPPER_REL(baserel))
+    {
+        scan_relid = 0;
+        scan_clauses = NIL;
+        fdw_scan_tlist = tlist;
+        foreigntableid = fdw_private->relid;
+    }
+    else
+        parquet_s3_extract_slcols(fdw_private, root, baserel, tlist);
 
     /*
      * We can't just pass arbitrary structure into make_foreignscan() because
@@ -2345,13 +4289,29 @@ parquetGetForeignPlan(PlannerInfo *root,
         params = lappend(params, makeInteger(0));
     }
 
+    /* Aggregate pushdown */
+    params = lappend(params, fdw_private->aggs);
+    params = lappend(params, fdw_private->scan_quals);
+    params = lappend(params, makeInteger(fdw_private->scan_relid));
+    params = lappend(params, makeInteger(fdw_private->relid));
+    params = lappend(params, makeInteger(fdw_private->use_metadata));
+    params = lappend(params, fdw_private->group_keys);
+    params = lappend(params, makeInteger(fdw_private->partial));
+
+    /* LIMIT pushdown, see get_scan_limit() */
+    params = lappend(params, makeInteger((int) Min(get_scan_limit(root, baserel,
+                                                                  best_path->path.pathkeys),
+                                                   PG_INT32_MAX)));
+    params = lappend(params, fdw_private->rowgroup_sizes);
+    params = lappend(params, makeInteger(best_path->path.parallel_workers));
+
 	/* Create the ForeignScan node */
 	return make_foreignscan(tlist,
 							scan_clauses,
 							scan_relid,
 							NIL,	/* no expressions to evaluate */
 							params,
-							NIL,	/* no custom tlist */
+							fdw_scan_tlist,
 							NIL,	/* no remote quals */
 							outer_plan);
 }
@@ -2383,6 +4343,21 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
     bool            schemaless = false;
     std::set<std::string> slcols;
     std::set<std::string> sorted_cols;
+    std::vector<RowFilter> row_filters;
+    List           *aggs_list = NIL;
+    List           *scan_quals = NIL;
+    Index           scan_relid = plan->scan.scanrelid;
+    Oid             agg_relid = InvalidOid;
+    std::vector<AggregateSpec> aggs;
+    List           *group_keys_list = NIL;
+    std::vector<AttrNumber> group_keys;
+    bool            partial_aggs = false;
+    int64           limit_rows = 0;
+    List           *rowgroup_sizes = NIL;
+    int             parallel_workers = 0;
+    ExprState      *agg_quals = NULL;
+    bool            use_metadata = false;
+    int             metadata_rowgroups = 0;
 
     /* Unwrap fdw_private */
     foreach (lc, fdw_private)
@@ -2458,6 +4433,37 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
                 s3client = parquetGetConnectionByTableid(s3tableoid, userid);
                 break;
             }
+            case FdwScanPrivateAggregates:
+                aggs_list = (List *) lfirst(lc);
+                break;
+            case FdwScanPrivateScanQuals:
+                scan_quals = (List *) lfirst(lc);
+                break;
+            case FdwScanPrivateScanRelid:
+                if (aggs_list != NIL)
+                    scan_relid = intVal((Node *) lfirst(lc));
+                break;
+            case FdwScanPrivateRelationId:
+                agg_relid = intVal((Node *) lfirst(lc));
+                break;
+            case FdwScanPrivateUseMetadata:
+                use_metadata = (bool) intVal((Node *) lfirst(lc));
+                break;
+            case FdwScanPrivateGroupKeys:
+                group_keys_list = (List *) lfirst(lc);
+                break;
+            case FdwScanPrivatePartialAggregates:
+                partial_aggs = (bool) intVal((Node *) lfirst(lc));
+                break;
+            case FdwScanPrivateLimitRows:
+                limit_rows = intVal((Node *) lfirst(lc));
+                break;
+            case FdwScanPrivateRowGroupSizes:
+                rowgroup_sizes = (List *) lfirst(lc);
+                break;
+            case FdwScanPrivateParallelWorkers:
+                parallel_workers = intVal((Node *) lfirst(lc));
+                break;
         }
         ++i;
     }
@@ -2465,7 +4471,69 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
     MemoryContext   cxt = estate->es_query_cxt;
     TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
     TupleDesc       tupleDesc = slot->tts_tupleDescriptor;
-    Oid             relid = RelationGetRelid(node->ss.ss_currentRelation);
+    Oid             relid;
+
+    /*
+     * The scan slot of a pushed down aggregation holds the aggregated values,
+     * the rows themselves are read using the descriptor of the relation.
+     */
+    if (aggs_list != NIL)
+    {
+        Relation    rel = table_open(agg_relid, AccessShareLock);
+
+        tupleDesc = CreateTupleDescCopy(RelationGetDescr(rel));
+        relid = agg_relid;
+        table_close(rel, NoLock);
+
+        foreach (lc, aggs_list)
+        {
+            List       *agg_info = (List *) lfirst(lc);
+            Const      *value = (Const *) lfourth(agg_info);
+            AggregateSpec spec;
+
+            spec.kind = (AggregateKind) intVal(linitial(agg_info));
+            spec.attnum = intVal(lsecond(agg_info));
+            spec.collid = intVal(lthird(agg_info));
+            spec.type = value->consttype;
+            spec.isnull = true;
+            spec.count = 0;
+            spec.value = (Datum) 0;
+
+            try {
+                aggs.push_back(spec);
+            } catch (std::exception &e) {
+                elog(ERROR, "parquet_s3_fdw: scan initialization failed: %s", e.what());
+            }
+        }
+
+        foreach (lc, group_keys_list)
+        {
+            try {
+                group_keys.push_back(lfirst_int(lc));
+            } catch (std::exception &e) {
+                elog(ERROR, "parquet_s3_fdw: scan initialization failed: %s", e.what());
+            }
+        }
+
+        if (use_metadata)
+        {
+            metadata_rowgroups = aggregate_metadata(relid, scan_relid, scan_quals,
+                                                    dirname, s3client, aggs,
+                                                    &filenames, &rowgroups_list);
+            rowgroup_sizes = NIL;
+            if (filenames == NIL)
+                reader_type = RT_TRIVIAL;
+        }
+
+        /* Expressions are not compiled for the plan node's scan slot */
+        fix_opfuncids((Node *) scan_quals);
+        agg_quals = ExecInitQual(scan_quals, NULL);
+    }
+    else
+    {
+        relid = RelationGetRelid(node->ss.ss_currentRelation);
+        scan_quals = plan->scan.plan.qual;
+    }
 
     reader_cxt = AllocSetContextCreate(cxt,
                                        "parquet_s3_fdw tuple data",
@@ -2504,7 +4572,8 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
 
             sort_key.ssup_cxt = reader_cxt;
             sort_key.ssup_collation = collid;
-            sort_key.ssup_nulls_first = true;
+            /* NULLS LAST as in the pathkeys, see create_path_key_from_sorted_option() */
+            sort_key.ssup_nulls_first = false;
             sort_key.ssup_attno = attr;
             sort_key.abbreviate = false;
 
@@ -2525,6 +4594,14 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
         }
     }
 
+    /* Restrictions the readers can check before materializing rows */
+    if (parquet_s3_enable_row_filter && !schemaless)
+    {
+        extract_row_filters(scan_quals, scan_relid,
+                            &node->ss.ps, row_filters);
+        set_row_filter_params(row_filters, &node->ss.ps, false);
+    }
+
     try
     {
         festate = create_parquet_execution_state(reader_type, reader_cxt, dirname, s3client, tupleDesc, relid,
@@ -2532,6 +4609,9 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
                                                  use_threads, use_mmap,
                                                  max_open_files, schemaless,
                                                  slcols, sorted_cols);
+        festate->set_row_filters(row_filters);
+        festate->set_limit(limit_rows);
+        festate->set_parallel_workers(parallel_workers);
 
         forboth (lc, filenames, lc2, rowgroups_list)
         {
@@ -2540,6 +4620,23 @@ parquetBeginForeignScan(ForeignScanState *node, int /* eflags */)
 
             festate->add_file(filename, rowgroups);
         }
+        festate->set_rowgroup_sizes(rowgroup_sizes);
+
+        /*
+         * Row groups whose rows are all checked by the row filters need no
+         * evaluation of the quals by the aggregation.
+         */
+        if (aggs_list != NIL)
+        {
+            festate = create_aggregate_execution_state(festate, reader_cxt,
+                                                       tupleDesc, group_keys,
+                                                       aggs, partial_aggs,
+                                                       agg_quals,
+                                                       row_filters.size() ==
+                                                       (size_t) list_length(scan_quals),
+                                                       node->ss.ps.ps_ExprContext);
+            festate->set_metadata_rowgroups(metadata_rowgroups);
+        }
     }
     catch(std::exception &e)
     {
@@ -2658,8 +4755,39 @@ extern "C" void
 parquetReScanForeignScan(ForeignScanState *node)
 {
     ParquetS3FdwExecutionState   *festate = (ParquetS3FdwExecutionState *) node->fdw_state;
+    char                        errstr[ERROR_STR_LEN];
+    bool                        error = false;
+
+    /*
+     * No C++ objects are kept in this frame as PostgreSQL errors would skip
+     * their destructors. Stop reading ahead before the filters change.
+     */
+    try
+    {
+        festate->rescan();
+    }
+    catch (std::exception &e)
+    {
+        strlcpy(errstr, e.what(), ERROR_STR_LEN);
+        error = true;
+    }
+    if (error)
+        elog(ERROR, "parquet_s3_fdw: %s", errstr);
 
-    festate->rescan();
+    /* Parameter values may have changed, recompute the dependent filters */
+    set_row_filter_params(festate->get_row_filters(), &node->ss.ps, true);
+
+    try
+    {
+        festate->set_row_filters(festate->get_row_filters());
+    }
+    catch (std::exception &e)
+    {
+        strlcpy(errstr, e.what(), ERROR_STR_LEN);
+        error = true;
+    }
+    if (error)
+        elog(ERROR, "parquet_s3_fdw: %s", errstr);
 }
 
 static int
@@ -2738,7 +4866,7 @@ parquetAcquireSampleRowsFunc(Relation relation, int /* elevel */,
             {
                 status = parquet::arrow::FileReader::Make(
                             arrow::default_memory_pool(),
-                            parquet::ParquetFileReader::OpenFile(filename, false),
+                            parquetOpenLocalFile(filename, false),
                             &reader);
             }
             if (!status.ok())
@@ -2856,6 +4984,14 @@ parquetExplainForeignScan(ForeignScanState *node, ExplainState *es)
     reader_type = (ReaderType) intVal(list_nth(fdw_private, FdwScanPrivateType));
     rowgroups_list = (List *) list_nth(fdw_private, FdwScanPrivateRowGroups);
 
+    /* Aggregates pushed down, see parquetGetForeignUpperPaths() */
+    if (intVal(list_nth(fdw_private, FdwScanPrivateUseMetadata)) &&
+        node->fdw_state != NULL)
+        ExplainPropertyText("Row groups answered from metadata",
+                            psprintf("%d", ((ParquetS3FdwExecutionState *)
+                                            node->fdw_state)->get_metadata_rowgroups()),
+                            es);
+
     switch (reader_type)
     {
         case RT_TRIVIAL:
@@ -3217,6 +5353,20 @@ parquet_fdw_validator_impl(PG_FUNCTION_ARGS)
             string_to_int32(defGetString(def));
 #endif
         }
+        else if (strcmp(def->defname, "parallel_workers") == 0)
+        {
+            int32   parallel_workers;
+
+#if PG_VERSION_NUM >= 150000
+            parallel_workers = pg_strtoint32(defGetString(def));
+#else
+            parallel_workers = string_to_int32(defGetString(def));
+#endif
+            if (parallel_workers < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("parquet_s3_fdw: parallel_workers must be a non-negative integer")));
+        }
         else if (strcmp(def->defname, "files_in_order") == 0)
         {
             /* Check that bool value is valid */
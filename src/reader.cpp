@@ -11,11 +11,16 @@
  *
  *-------------------------------------------------------------------------
  */
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <list>
+#include <mutex>
 
 #include "arrow/api.h"
 #include "arrow/io/api.h"
 #include "arrow/array.h"
+#include "arrow/util/thread_pool.h"
 #include "parquet/arrow/reader.h"
 #include "parquet/arrow/schema.h"
 #include "parquet/exception.h"
@@ -48,8 +53,145 @@ extern "C"
 
 #define SEGMENT_SIZE (1024 * 1024)
 
+/*
+ * Batch sizes used while the scan is expected to stop after a few rows, see
+ * ParquetReader::set_limit().
+ */
+#define LIMIT_MIN_BATCH_SIZE 1024
+#define LIMIT_MAX_BATCH_SIZE (64 * 1024)
+
 
 bool parquet_fdw_use_threads = true;
+int  parquet_s3_prefetch_depth = 1;
+int  parquet_s3_prefetch_memory = 256;     /* MB */
+int  parquet_s3_batch_size = 0;            /* rows, 0 means whole row group */
+
+/*
+ * Number of threads of the pool reading row groups ahead, shared by all the
+ * readers of the backend.
+ */
+#define PREFETCH_POOL_SIZE 4
+
+/*
+ * Estimated size of the row groups being read ahead by all the readers of
+ * the backend, limited by parquet_s3_fdw.prefetch_memory. Only touched by
+ * the backend thread.
+ */
+static int64 prefetch_bytes_total = 0;
+
+/*
+ * prefetch_pool
+ *      Thread pool the read-ahead of all readers is done by, or nullptr if it
+ *      could not be created.
+ */
+static arrow::internal::ThreadPool *
+prefetch_pool()
+{
+    static std::shared_ptr<arrow::internal::ThreadPool> pool;
+    static bool tried = false;
+
+    if (!tried)
+    {
+        auto result = arrow::internal::ThreadPool::Make(PREFETCH_POOL_SIZE);
+
+        tried = true;
+        if (result.ok())
+            pool = *result;
+    }
+    return pool.get();
+}
+
+/*
+ * SerialReads
+ *      Reads of a single reader run in background one at a time, in the order
+ *      they were submitted, so that the arrow reader is never used
+ *      concurrently. The pool threads only work on the queue while it is not
+ *      empty. Urgent reads, which the backend is about to wait for, go ahead
+ *      of the queued read-ahead.
+ */
+class SerialReads : public std::enable_shared_from_this<SerialReads>
+{
+private:
+    std::mutex                          mutex;
+    std::deque<std::function<void()>>   tasks;
+    bool                                busy = false;
+
+    void run_queued()
+    {
+        while (true)
+        {
+            std::function<void()>   task;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (tasks.empty())
+                {
+                    busy = false;
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    /*
+     * Returns false if the task cannot be run in background. An urgent task
+     * is run right away by the calling thread if no read is in progress, or
+     * else next after the read in progress.
+     */
+    bool submit(std::function<void()> task, bool urgent = false)
+    {
+        auto    pool = prefetch_pool();
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (urgent)
+        {
+            if (busy)
+            {
+                tasks.push_front(std::move(task));
+                return true;
+            }
+
+            busy = true;
+            lock.unlock();
+            task();
+            lock.lock();
+
+            if (tasks.empty())
+                busy = false;
+            else
+            {
+                auto self = shared_from_this();
+
+                if (pool == nullptr ||
+                    !pool->Spawn([self]() { self->run_queued(); }).ok())
+                {
+                    lock.unlock();
+                    run_queued();
+                }
+            }
+            return true;
+        }
+
+        if (pool == nullptr)
+            return false;
+
+        if (!busy)
+        {
+            auto self = shared_from_this();
+
+            if (!pool->Spawn([self]() { self->run_queued(); }).ok())
+                return false;
+            busy = true;
+        }
+        tasks.push_back(std::move(task));
+        return true;
+    }
+};
 
 
 class FastAllocatorS3
@@ -161,9 +303,48 @@ public:
 
 
 ParquetReader::ParquetReader(MemoryContext cxt)
-    : allocator(new FastAllocatorS3(cxt))
+    : allocator(new FastAllocatorS3(cxt)), limit_rows(0),
+      configured_batch_size(parquet_s3_batch_size),
+      dict_cxt(AllocSetContextCreate(cxt, "parquet_s3_fdw dictionary values",
+                                     ALLOCSET_DEFAULT_SIZES))
 {}
 
+/*
+ * take_cached_reader
+ *      Take the arrow reader of reader_entry for this reader. It is kept in
+ *      cached_reader and scanning is done by a reader of the same file and
+ *      footer which reads string columns as dictionaries.
+ */
+void ParquetReader::take_cached_reader()
+{
+    auto    cached = std::move(this->reader_entry->file_reader->reader);
+    auto    dict_reader = parquetMakeDictionaryReader(this->reader_entry->file_reader->file,
+                                                      cached->parquet_reader()->metadata());
+
+    if (dict_reader)
+    {
+        this->reader = std::move(dict_reader);
+        this->cached_reader = std::move(cached);
+    }
+    else
+        this->reader = std::move(cached);
+}
+
+/*
+ * release_cached_reader
+ *      Hand the arrow reader taken by take_cached_reader() back to the cache.
+ */
+void ParquetReader::release_cached_reader()
+{
+    if (!this->reader_entry || !this->reader_entry->file_reader)
+        return;
+
+    if (this->cached_reader)
+        this->reader_entry->file_reader->reader = std::move(this->cached_reader);
+    else if (this->reader)
+        this->reader_entry->file_reader->reader = std::move(this->reader);
+}
+
 int32_t ParquetReader::id()
 {
     return reader_id;
@@ -338,7 +519,7 @@ void ParquetReader::schemaless_create_column_mapping(parquet::arrow::SchemaManif
                 /* Init sortkey data */
                 sort_key.ssup_cxt = allocator->context();
                 sort_key.ssup_collation = DEFAULT_COLLATION_OID;
-                sort_key.ssup_nulls_first = true;
+                sort_key.ssup_nulls_first = false;
                 sort_key.ssup_attno = sorted_col_idx;
                 sort_key.abbreviate = false;
 
@@ -661,6 +842,11 @@ Datum ParquetReader::read_primitive_type(arrow::Array *array,
         case arrow::Type::STRING:
         case arrow::Type::BINARY:
         {
+            /* See parquetDictionaryReaderProperties() */
+            if (array->type_id() == arrow::Type::DICTIONARY)
+                return this->read_dictionary_value((arrow::DictionaryArray *) array,
+                                                   typinfo, i);
+
             arrow::BinaryArray *binarray = (arrow::BinaryArray *) array;
 
             int32_t vallen = 0;
@@ -712,6 +898,127 @@ Datum ParquetReader::read_primitive_type(arrow::Array *array,
     return res;
 }
 
+/*
+ * read_dictionary_value
+ *      Returns the value of dictionary encoded string column. The Datum is
+ *      built (and cast if needed) only once per dictionary entry and is valid
+ *      until reset_dictionary_values() is called.
+ */
+Datum ParquetReader::read_dictionary_value(arrow::DictionaryArray *array,
+                                           const TypeInfo &typinfo,
+                                           int64_t i)
+{
+    const arrow::Array *dict = array->dictionary().get();
+    DictionaryValues   &dv = this->dict_values[{dict, &typinfo}];
+    int64               index = array->GetValueIndex(i);
+
+    if (!dv.dictionary)
+    {
+        dv.dictionary = array->dictionary();
+        dv.values.resize(dict->length());
+        dv.built.resize(dict->length(), false);
+    }
+
+    if (!dv.built[index])
+    {
+        arrow::BinaryArray *binarray = (arrow::BinaryArray *) dict;
+        MemoryContext       oldcxt;
+        int32_t             vallen = 0;
+        const char         *value = reinterpret_cast<const char*>(binarray->GetValue(index, &vallen));
+        Datum               res;
+
+        oldcxt = MemoryContextSwitchTo(this->dict_cxt);
+        try
+        {
+            bytea  *b = (bytea *) palloc(vallen + VARHDRSZ);
+
+            SET_VARSIZE(b, vallen + VARHDRSZ);
+            memcpy(VARDATA(b), value, vallen);
+            res = PointerGetDatum(b);
+
+            if (typinfo.need_cast)
+                res = do_cast(res, typinfo);
+        }
+        catch (...)
+        {
+            MemoryContextSwitchTo(oldcxt);
+            throw;
+        }
+        MemoryContextSwitchTo(oldcxt);
+
+        dv.values[index] = res;
+        dv.built[index] = true;
+    }
+
+    return dv.values[index];
+}
+
+/*
+ * reset_dictionary_values
+ *      Forget the Datums built by read_dictionary_value(). Must be called
+ *      whenever the arrays they were built for are released.
+ */
+void ParquetReader::reset_dictionary_values()
+{
+    if (this->dict_values.empty())
+        return;
+
+    this->dict_values.clear();
+    MemoryContextReset(this->dict_cxt);
+}
+
+/*
+ * filter_rows
+ *      Evaluate the row filters on the columns of the table, which holds the
+ *      rows starting at offset of a row group of total_rows rows. Rows which
+ *      do not pass are cleared in selection, which is filled with ones the
+ *      first time a filter applies. Returns false if some filter could not be
+ *      evaluated and is left to the executor.
+ */
+bool ParquetReader::filter_rows(const arrow::Table &table,
+                                std::vector<uint8_t> &selection,
+                                int64 offset, int64 total_rows)
+{
+    bool    exact = true;
+
+    for (auto &filter : this->row_filters)
+    {
+        int     attr = filter.attnum - 1;
+        int     col;
+        int64   pos = offset;
+
+        if (attr < 0 || attr >= (int) this->map.size() || (col = this->map[attr]) < 0)
+        {
+            exact = false;
+            continue;
+        }
+
+        const auto &column = table.GetColumnByName(types[col].arrow.column_name);
+        if (column == nullptr)
+        {
+            exact = false;
+            continue;
+        }
+
+        if (selection.empty())
+            selection.assign(total_rows, 1);
+
+        for (const auto &chunk : column->chunks())
+        {
+            /* Unsupported filters are left to the executor */
+            if (!evaluate_row_filter(filter, types[col].pg.oid, chunk.get(),
+                                     selection.data() + pos))
+            {
+                exact = false;
+                break;
+            }
+            pos += chunk->length();
+        }
+    }
+
+    return exact;
+}
+
 /*
  * nested_list_to_datum
  *      Returns postgres array build from elements of array. Only one
@@ -1102,145 +1409,895 @@ void ParquetReader::set_schemaless_info(bool schemaless, std::set<std::string> s
     this->sorted_cols = sorted_cols;
 }
 
-std::vector<ParquetReader::preSortedColumnData> ParquetReader::get_current_sorted_cols_data()
+void ParquetReader::set_row_filters(const std::vector<RowFilter> &filters)
 {
-    return this->sorted_cols_data;
+    this->row_filters = filters;
 }
 
-class DefaultParquetReader : public ParquetReader
+/*
+ * set_limit
+ *      Tell the reader that the scan is likely to stop after the given number
+ *      of rows (LIMIT). It is only a hint, all the rows are still returned if
+ *      asked for.
+ */
+void ParquetReader::set_limit(int64 rows)
 {
-private:
-    struct ChunkInfo
-    {
-        int     chunk;      /* current chunk number */
-        int64   pos;        /* current pos within chunk */
-        int64   len;        /* current chunk length */
-
-        ChunkInfo (int64 len) : chunk(0), pos(0), len(len) {}
-    };
-
-    /* Current row group */
-    std::shared_ptr<arrow::Table>   table;
+    this->limit_rows = rows;
+}
 
-    /*
-     * Plain pointers to inner the structures of row group. It's needed to
-     * prevent excessive shared_ptr management.
-     */
-    std::vector<arrow::Array *>     chunks;
+/*
+ * key_run_length
+ *      Readers that cannot tell how many of their next rows sort before the
+ *      limit return 0.
+ */
+uint32 ParquetReader::key_run_length(AttrNumber /* attnum */, int64 /* limit */)
+{
+    return 0;
+}
 
-    int             row_group;          /* current row group index */
-    uint32_t        row;                /* current row within row group */
-    uint32_t        num_rows;           /* total rows in row group */
-    std::vector<ChunkInfo> chunk_info;  /* current chunk and position per-column */
+/*
+ * statistics_type
+ *      Arrow type to decode min/max statistics of the column with, or nullptr
+ *      if they cannot be relied on: only integer-like columns read without a
+ *      cast are ordered the same way by Parquet and PostgreSQL.
+ */
+std::shared_ptr<arrow::DataType>
+ParquetReader::statistics_type(const TypeInfo &typinfo)
+{
+    /* Statistics are kept in terms of the original arrow type */
+    if (typinfo.index < 0 || typinfo.need_cast ||
+        typinfo.pg.oid != to_postgres_type(typinfo.arrow.type_id))
+        return nullptr;
 
-public:
-    /* 
-     * Constructor.
-     * The reader_id parameter is only used for parallel execution of
-     * MultifileExecutionState.
-     */
-    DefaultParquetReader(const char* filename, MemoryContext cxt, int reader_id = -1)
-        : ParquetReader(cxt), row_group(-1), row(0), num_rows(0)
+    switch (typinfo.arrow.type_id)
     {
-        this->reader_entry = NULL;
-        this->filename = filename;
-        this->reader_id = reader_id;
-        this->coordinator = NULL;
-        this->initialized = false;
-        this->schemaless = false;
+        case arrow::Type::BOOL:
+            return arrow::boolean();
+        case arrow::Type::INT8:
+            return arrow::int8();
+        case arrow::Type::INT16:
+            return arrow::int16();
+        case arrow::Type::INT32:
+            return arrow::int32();
+        case arrow::Type::INT64:
+            return arrow::int64();
+        case arrow::Type::DATE32:
+            return arrow::date32();
+        case arrow::Type::TIMESTAMP:
+            return arrow::timestamp(typinfo.arrow.time_precision);
+        default:
+            return nullptr;
     }
+}
 
-    ~DefaultParquetReader()
-    {
-        if (this->reader_entry && this->reader_entry->file_reader && this->reader)
-            this->reader_entry->file_reader->reader = std::move(this->reader);
-    }
+/*
+ * rowgroup_matches_params
+ *      Check row group statistics against the filters compared with
+ *      parameters. Filters with constants are already taken into account by
+ *      the planner when it builds the list of row groups to read.
+ */
+bool ParquetReader::rowgroup_matches_params(int rowgroup)
+{
+    std::unique_ptr<parquet::RowGroupMetaData> rowgroup_meta;
 
-    void open(const char *dirname,
-              Aws::S3::S3Client *s3_client)
+    for (auto &filter : this->row_filters)
     {
-        arrow::Status   status;
-        char *dname;
-        char *fname;
-        parquetSplitS3Path(dirname, filename.c_str(), &dname, &fname);
-        this->reader_entry = parquetGetFileReader(s3_client, dname, fname);
-        elog(DEBUG1, "parquet_s3_fdw: open Parquet file on S3. %s%s", dname, fname);
-        pfree(dname);
-        pfree(fname);
+        std::shared_ptr<parquet::Statistics>    stats;
+        std::shared_ptr<arrow::DataType>        arrow_type;
+        int         attr = filter.attnum - 1;
+        int         col;
 
-        this->reader = std::move(this->reader_entry->file_reader->reader);
+        if (filter.param == nullptr || filter.unknown || filter.kind != RF_COMPARE)
+            continue;
+        if (attr < 0 || (size_t) attr >= this->map.size() || (col = this->map[attr]) < 0)
+            continue;
 
-        /* Enable parallel columns decoding/decompression if needed */
-        this->reader->set_use_threads(this->use_threads && parquet_fdw_use_threads);
-    }
+        TypeInfo   &typinfo = this->types[col];
 
-    void open()
-    {
-        arrow::Status   status;
-        std::unique_ptr<parquet::arrow::FileReader> reader;
+        if ((arrow_type = this->statistics_type(typinfo)) == nullptr)
+            continue;
 
-        status = parquet::arrow::FileReader::Make(
-                        arrow::default_memory_pool(),
-                        parquet::ParquetFileReader::OpenFile(filename, use_mmap),
-                        &reader);
-        if (!status.ok())
-            throw Error("parquet_s3_fdw: failed to open Parquet file %s ('%s')",
-                        status.message().c_str(), filename.c_str());
-        this->reader = std::move(reader);
+        if (!rowgroup_meta)
+            rowgroup_meta = this->reader->parquet_reader()->metadata()->RowGroup(rowgroup);
+        if (typinfo.index >= rowgroup_meta->num_columns())
+            continue;
 
-        /* Enable parallel columns decoding/decompression if needed */
-        this->reader->set_use_threads(this->use_threads && parquet_fdw_use_threads);
-    }
+        stats = rowgroup_meta->ColumnChunk(typinfo.index)->statistics();
+        if (!stats || !stats->HasMinMax())
+            continue;
 
-    void close()
-    {
-        throw std::runtime_error("parquet_s3_fdw: DefaultParquetReader::close() not implemented");
+        std::string min = stats->EncodeMin();
+        std::string max = stats->EncodeMax();
+
+        if (!row_filter_matches_range(filter, typinfo.pg.oid,
+                bytes_to_postgres_type(min.c_str(), min.length(), arrow_type.get()),
+                bytes_to_postgres_type(max.c_str(), max.length(), arrow_type.get())))
+            return false;
     }
 
-    bool read_next_rowgroup()
-    {
-        arrow::Status               status;
+    return true;
+}
 
-        /*
-         * In case of parallel query get the row group index from the
-         * coordinator. Otherwise just increment it.
-         */
-        if (coordinator)
-        {
-            coordinator->lock();
-            if ((this->row_group = coordinator->next_rowgroup(reader_id)) == -1)
-            {
-                coordinator->unlock();
-                return false;
-            }
-            coordinator->unlock();
-        }
-        else
-            this->row_group++;
+/*
+ * rowgroup_bounds
+ *      Min and max values of the attribute within the row group taken from
+ *      statistics. Returns false if they are unknown or if the row group may
+ *      contain NULLs. The values are integer-like, see statistics_type().
+ */
+bool ParquetReader::rowgroup_bounds(AttrNumber attnum, int rowgroup,
+                                    Datum *min, Datum *max)
+{
+    std::shared_ptr<arrow::DataType> arrow_type;
+    std::shared_ptr<parquet::Statistics> stats;
+    int         attr = attnum - 1;
+    int         col;
 
-        /*
-         * row_group cannot be less than zero at this point so it is safe to cast
-         * it to unsigned int
-         */
-        if ((uint) this->row_group >= this->rowgroups.size())
+    if (this->schemaless ||
+        attr < 0 || (size_t) attr >= this->map.size() || (col = this->map[attr]) < 0)
+        return false;
+
+    TypeInfo   &typinfo = this->types[col];
+
+    if ((arrow_type = this->statistics_type(typinfo)) == nullptr)
+        return false;
+
+    auto rowgroup_meta = this->reader->parquet_reader()->metadata()->RowGroup(rowgroup);
+
+    if (typinfo.index >= rowgroup_meta->num_columns())
+        return false;
+
+    stats = rowgroup_meta->ColumnChunk(typinfo.index)->statistics();
+    if (!stats || !stats->HasMinMax() || !stats->HasNullCount() ||
+        stats->null_count() > 0)
+        return false;
+
+    std::string encoded_min = stats->EncodeMin();
+    std::string encoded_max = stats->EncodeMax();
+
+    *min = bytes_to_postgres_type(encoded_min.c_str(), encoded_min.length(),
+                                  arrow_type.get());
+    *max = bytes_to_postgres_type(encoded_max.c_str(), encoded_max.length(),
+                                  arrow_type.get());
+    return true;
+}
+
+/*
+ * lower_bound
+ *      Smallest value of the attribute within the row groups to read, taken
+ *      from statistics. Returns false if it is unknown or if the row groups
+ *      may contain NULLs. Only valid when int8 is passed by value.
+ */
+bool ParquetReader::lower_bound(AttrNumber attnum, Datum *value)
+{
+    bool        found = false;
+
+    for (int rowgroup : this->rowgroups)
+    {
+        Datum   min, max;
+
+        if (!this->rowgroup_bounds(attnum, rowgroup, &min, &max))
+            return false;
+
+        /* Integer-like values compare as int64 */
+        if (!found || DatumGetInt64(min) < DatumGetInt64(*value))
+            *value = min;
+        found = true;
+    }
+
+    return found;
+}
+
+/*
+ * upper_bound
+ *      Largest value of the attribute within the row groups to read, see
+ *      lower_bound().
+ */
+bool ParquetReader::upper_bound(AttrNumber attnum, Datum *value)
+{
+    bool        found = false;
+
+    for (int rowgroup : this->rowgroups)
+    {
+        Datum   min, max;
+
+        if (!this->rowgroup_bounds(attnum, rowgroup, &min, &max))
             return false;
 
-        int  rowgroup = this->rowgroups[this->row_group];
-        auto rowgroup_meta = this->reader
-                                ->parquet_reader()
-                                ->metadata()
-                                ->RowGroup(rowgroup);
+        /* Integer-like values compare as int64 */
+        if (!found || DatumGetInt64(max) > DatumGetInt64(*value))
+            *value = max;
+        found = true;
+    }
+
+    return found;
+}
+
+/*
+ * next_rowgroup
+ *      Make the next row group having rows passing the row filters current
+ *      and hand its columns over to the caller. Its rows can then be read one
+ *      by one using next_rowgroup_row().
+ */
+ReadStatus ParquetReader::next_rowgroup(RowGroupBatch &)
+{
+    throw Error("parquet_s3_fdw: reading whole row groups is not supported by the reader ('%s')",
+                this->filename.c_str());
+}
+
+/*
+ * next_rowgroup_row
+ *      Read the next row of the current row group, see next_rowgroup().
+ *      Returns RS_EOF at the end of the row group.
+ */
+ReadStatus ParquetReader::next_rowgroup_row(TupleTableSlot *)
+{
+    throw Error("parquet_s3_fdw: reading whole row groups is not supported by the reader ('%s')",
+                this->filename.c_str());
+}
+
+std::vector<ParquetReader::preSortedColumnData> ParquetReader::get_current_sorted_cols_data()
+{
+    return this->sorted_cols_data;
+}
+
+/*
+ * Column decoders convert a whole arrow array into Datums at once, with the
+ * type dispatch done once per array instead of once per cell. They are only
+ * used for fixed width types which need no cast; all other types are
+ * converted cell by cell by read_primitive_type().
+ */
+typedef void (*ColumnDecoder)(const arrow::Array *array, Datum *values, bool *nulls);
+
+template <typename ArrayType, typename Convert>
+static inline void
+decode_column(const arrow::Array *array, Datum *values, bool *nulls, Convert convert)
+{
+    const ArrayType *typed = static_cast<const ArrayType *>(array);
+    const auto     *raw = typed->raw_values();
+    int64           len = array->length();
+
+    for (int64 i = 0; i < len; i++)
+        values[i] = convert(raw[i]);
+
+    if (array->null_count() == 0)
+        memset(nulls, 0, sizeof(bool) * len);
+    else
+    {
+        for (int64 i = 0; i < len; i++)
+            nulls[i] = array->IsNull(i);
+    }
+}
+
+static void
+decode_bool(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    const arrow::BooleanArray *boolarray = static_cast<const arrow::BooleanArray *>(array);
+    int64       len = array->length();
+
+    for (int64 i = 0; i < len; i++)
+        values[i] = BoolGetDatum(boolarray->Value(i));
+
+    if (array->null_count() == 0)
+        memset(nulls, 0, sizeof(bool) * len);
+    else
+    {
+        for (int64 i = 0; i < len; i++)
+            nulls[i] = array->IsNull(i);
+    }
+}
+
+static void
+decode_int8(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    decode_column<arrow::Int8Array>(array, values, nulls,
+                                    [](int8_t v) { return Int8GetDatum(v); });
+}
+
+static void
+decode_int16(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    decode_column<arrow::Int16Array>(array, values, nulls,
+                                     [](int16_t v) { return Int16GetDatum(v); });
+}
+
+static void
+decode_int32(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    decode_column<arrow::Int32Array>(array, values, nulls,
+                                     [](int32_t v) { return Int32GetDatum(v); });
+}
+
+static void
+decode_int64(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    decode_column<arrow::Int64Array>(array, values, nulls,
+                                     [](int64_t v) { return Int64GetDatum(v); });
+}
+
+static void
+decode_float(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    decode_column<arrow::FloatArray>(array, values, nulls,
+                                     [](float v) { return Float4GetDatum(v); });
+}
+
+static void
+decode_double(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    decode_column<arrow::DoubleArray>(array, values, nulls,
+                                      [](double v) { return Float8GetDatum(v); });
+}
+
+static void
+decode_date32(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    /* See read_primitive_type() */
+    decode_column<arrow::Date32Array>(array, values, nulls,
+            [](int32_t v) {
+                return DateADTGetDatum(v + (UNIX_EPOCH_JDATE - POSTGRES_EPOCH_JDATE));
+            });
+}
+
+static void
+decode_timestamp(const arrow::Array *array, Datum *values, bool *nulls)
+{
+    auto tstype = (arrow::TimestampType *) array->type().get();
+
+    decode_column<arrow::TimestampArray>(array, values, nulls,
+            [tstype](int64_t v) {
+                TimestampTz ts;
+
+                to_postgres_timestamp(tstype, v, ts);
+                return TimestampGetDatum(ts);
+            });
+}
+
+class DefaultParquetReader : public ParquetReader
+{
+private:
+    struct ChunkInfo
+    {
+        int     chunk;      /* current chunk number */
+        int64   pos;        /* current pos within chunk */
+        int64   len;        /* current chunk length */
+
+        ChunkInfo (int64 len) : chunk(0), pos(0), len(len) {}
+    };
+
+    /* Current row group */
+    std::shared_ptr<arrow::Table>   table;
+
+    /*
+     * Plain pointers to inner the structures of row group. It's needed to
+     * prevent excessive shared_ptr management.
+     */
+    std::vector<arrow::Array *>     chunks;
+
+    /*
+     * Row group which is (or is going to be) read in background while the
+     * current one is being consumed.
+     */
+    struct PrefetchedRowGroup
+    {
+        int     rowgroup;   /* row group number in the file */
+        int64   bytes;      /* estimated size of decoded data */
+        bool    started;    /* whether reading has been started */
+        arrow::Future<std::shared_ptr<arrow::Table>> table;
+    };
+
+    int             row_group;          /* last claimed row group index */
+    uint32_t        row;                /* current row within row group */
+    uint32_t        num_rows;           /* total rows in row group */
+    std::vector<ChunkInfo> chunk_info;  /* current chunk and position per-column */
+
+    /*
+     * Row groups claimed ahead of the current one. They are read in background
+     * by the pool shared by the readers of the backend, in claiming order and
+     * one at a time; the reader itself is never used concurrently.
+     */
+    std::deque<PrefetchedRowGroup>  prefetch_queue;
+    std::shared_ptr<SerialReads>    prefetch_reads;
+    bool            rowgroups_exhausted;
+
+    /*
+     * In streaming mode (parquet_s3_fdw.batch_size > 0) row groups are read
+     * in batches of batch_size rows rather than materialized as a whole.
+     * Scans under a small LIMIT start streaming in batches of about the
+     * limit, see set_limit().
+     */
+    int64           batch_size;
+    int             batch_rowgroup;     /* row group the batches come from */
+    std::unique_ptr<arrow::RecordBatchReader> batch_reader;
+
+    /*
+     * Values of the current chunk of the columns having a decoder (see
+     * ColumnDecoder), converted when the chunk becomes current.
+     */
+    struct DecodedChunk
+    {
+        std::vector<Datum>      values;
+        std::unique_ptr<bool[]> nulls;
+        int64                   capacity = 0;
+    };
+
+    std::vector<ColumnDecoder>  decoders;   /* per-column, NULL if none */
+    std::vector<DecodedChunk>   decoded;
+
+    /*
+     * Rows of the current row group passing the row filters. Empty if there
+     * are no filters applicable to the row group. selection_exact tells
+     * whether every row filter has been evaluated.
+     */
+    std::vector<uint8_t>        selection;
+    bool                        selection_exact;
+
+    /*
+     * Late materialization. When some columns are only needed for output,
+     * the first read of a row group (possibly done in background) only
+     * covers the columns of the row filters. The other ones are read once
+     * the row group is known to have matching rows.
+     */
+    bool                        columns_split_checked;
+    std::vector<int>            filter_indices;
+    std::vector<int>            other_indices;
+    int                         current_rowgroup;
+
+public:
+    /* 
+     * Constructor.
+     * The reader_id parameter is only used for parallel execution of
+     * MultifileExecutionState.
+     */
+    DefaultParquetReader(const char* filename, MemoryContext cxt, int reader_id = -1)
+        : ParquetReader(cxt), row_group(-1), row(0), num_rows(0),
+          rowgroups_exhausted(false),
+          batch_size(configured_batch_size), batch_rowgroup(-1),
+          selection_exact(true), columns_split_checked(false),
+          current_rowgroup(-1)
+    {
+        this->reader_entry = NULL;
+        this->filename = filename;
+        this->reader_id = reader_id;
+        this->coordinator = NULL;
+        this->initialized = false;
+        this->schemaless = false;
+    }
+
+    /*
+     * set_limit
+     *      Read only about as many rows as the limit at first, so that neither
+     *      whole row groups are decoded nor the next ones read ahead when a
+     *      few rows are enough. Batches grow with every row group in case the
+     *      quals reject most of the rows.
+     */
+    void set_limit(int64 rows)
+    {
+        ParquetReader::set_limit(rows);
+
+        if (rows <= 0 || rows >= LIMIT_MAX_BATCH_SIZE)
+            return;
+
+        rows = std::max<int64>(rows, LIMIT_MIN_BATCH_SIZE);
+        if (this->batch_size <= 0 || this->batch_size > rows)
+            this->batch_size = rows;
+    }
+
+    ~DefaultParquetReader()
+    {
+        /* Background reads use the reader, wait for them before handing it back */
+        this->drain_prefetch();
+        this->batch_reader.reset();
+
+        this->release_cached_reader();
+    }
+
+    void open(const char *dirname,
+              Aws::S3::S3Client *s3_client)
+    {
+        arrow::Status   status;
+        char *dname;
+        char *fname;
+        parquetSplitS3Path(dirname, filename.c_str(), &dname, &fname);
+        this->reader_entry = parquetGetFileReader(s3_client, dname, fname);
+        elog(DEBUG1, "parquet_s3_fdw: open Parquet file on S3. %s%s", dname, fname);
+        pfree(dname);
+        pfree(fname);
+
+        this->take_cached_reader();
+
+        /* Enable parallel columns decoding/decompression if needed */
+        this->reader->set_use_threads(this->use_threads && parquet_fdw_use_threads);
+    }
+
+    void open()
+    {
+        arrow::Status   status;
+        std::unique_ptr<parquet::arrow::FileReader> reader;
+
+        auto parquet_reader = parquetOpenLocalFile(filename, use_mmap);
+        auto props = parquetDictionaryReaderProperties(parquet_reader->metadata()->schema());
+
+        status = parquet::arrow::FileReader::Make(
+                        arrow::default_memory_pool(),
+                        std::move(parquet_reader),
+                        props,
+                        &reader);
+        if (!status.ok())
+            throw Error("parquet_s3_fdw: failed to open Parquet file %s ('%s')",
+                        status.message().c_str(), filename.c_str());
+        this->reader = std::move(reader);
+
+        /* Enable parallel columns decoding/decompression if needed */
+        this->reader->set_use_threads(this->use_threads && parquet_fdw_use_threads);
+    }
+
+    void close()
+    {
+        /* Background reads use the reader, wait for them before closing it */
+        this->drain_prefetch();
+        this->batch_reader.reset();
+
+        this->release_cached_reader();
+        this->reader = nullptr;
+    }
+
+    /*
+     * claim_rowgroup
+     *      Take the next row group to read, either from the coordinator in
+     *      case of parallel query or just the next one in the list. Returns
+     *      false once there is nothing left.
+     */
+    bool claim_rowgroup(int *rowgroup)
+    {
+        while (!this->rowgroups_exhausted)
+        {
+            /*
+             * In case of parallel query get the row group index from the
+             * coordinator. Otherwise just increment it.
+             */
+            if (coordinator)
+            {
+                coordinator->lock();
+                this->row_group = coordinator->next_rowgroup(reader_id);
+                coordinator->unlock();
+            }
+            else
+                this->row_group++;
+
+            /*
+             * row_group is -1 if the coordinator has moved on to another
+             * reader, otherwise it cannot be less than zero so it is safe to
+             * cast it to unsigned int
+             */
+            if (this->row_group == -1 || (uint) this->row_group >= this->rowgroups.size())
+            {
+                this->rowgroups_exhausted = true;
+                return false;
+            }
+
+            *rowgroup = this->rowgroups[this->row_group];
+
+            /* Statistics may rule out the row group once parameters are known */
+            if (!this->rowgroup_matches_params(*rowgroup))
+            {
+                elog(DEBUG2, "parquet_s3_fdw: skip rowgroup %d by parameter values",
+                     *rowgroup + 1);
+                continue;
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    /*
+     * rowgroup_size
+     *      Estimate the memory needed by the decoded row group by the
+     *      uncompressed size of the projected column chunks.
+     */
+    int64 rowgroup_size(int rowgroup)
+    {
+        auto    rowgroup_meta = this->reader
+                                    ->parquet_reader()
+                                    ->metadata()
+                                    ->RowGroup(rowgroup);
+        int64   size = 0;
+
+        for (int col : this->first_read_indices())
+        {
+            if (col >= 0 && col < rowgroup_meta->num_columns())
+                size += rowgroup_meta->ColumnChunk(col)->total_uncompressed_size();
+        }
+        return size;
+    }
+
+    /*
+     * first_read_indices
+     *      Columns read when a row group is claimed.
+     */
+    const std::vector<int> &first_read_indices()
+    {
+        return this->other_indices.empty() ? this->indices : this->filter_indices;
+    }
+
+    /*
+     * split_columns
+     *      Decide whether row groups are read in two steps, see
+     *      filter_indices.
+     */
+    void split_columns()
+    {
+        std::set<int>   filter_cols;
+
+        this->columns_split_checked = true;
+
+        /* Streaming reads whole batches anyway */
+        if (this->schemaless || this->batch_size > 0 || this->row_filters.empty())
+            return;
+
+        for (auto &filter : this->row_filters)
+        {
+            int     attr = filter.attnum - 1;
+            int     col;
+
+            if (attr < 0 || attr >= (int) this->map.size() || (col = this->map[attr]) < 0)
+                continue;
+
+            /* Only filters on plain columns can be evaluated */
+            if (this->types[col].index < 0 || this->types[col].need_cast)
+                continue;
+
+            filter_cols.insert(this->types[col].index);
+        }
+
+        if (filter_cols.empty())
+            return;
+
+        for (int idx : this->indices)
+        {
+            if (filter_cols.count(idx))
+            {
+                if (std::find(this->filter_indices.begin(), this->filter_indices.end(), idx)
+                        == this->filter_indices.end())
+                    this->filter_indices.push_back(idx);
+            }
+            else
+                this->other_indices.push_back(idx);
+        }
+    }
+
+    /*
+     * read_rowgroup
+     *      Read given columns of the row group into arrow table. May be run
+     *      by the prefetch thread, so it must not use any PostgreSQL facility.
+     */
+    arrow::Result<std::shared_ptr<arrow::Table>> read_rowgroup(int rowgroup,
+                                                               const std::vector<int> &indices)
+    {
+        std::shared_ptr<arrow::Table>   table;
+        arrow::Status                   status;
+
+        try
+        {
+            /* Let S3 fetch the column chunks by a few concurrent requests */
+            parquetWillNeedRowGroup(this->reader_entry, this->reader.get(),
+                                    rowgroup, indices);
+
+            status = this->reader
+                ->RowGroup(rowgroup)
+                ->ReadTable(indices, &table);
+        }
+        catch (const std::exception &e)
+        {
+            status = arrow::Status::UnknownError(e.what());
+        }
+
+        if (!status.ok())
+            return status;
+        return table;
+    }
+
+    void start_prefetch(PrefetchedRowGroup &p, bool urgent = false)
+    {
+        p.started = true;
+        prefetch_bytes_total += p.bytes;
+        p.table = this->submit_read(p.rowgroup, this->first_read_indices(),
+                                    urgent);
+    }
+
+    /* Forget the read-ahead of a row group in the backend-wide budget */
+    void release_prefetch(const PrefetchedRowGroup &p)
+    {
+        if (p.started)
+            prefetch_bytes_total -= p.bytes;
+    }
+
+    /*
+     * submit_read
+     *      Read the row group columns in background if read-ahead is enabled.
+     *      The reads of the reader are run one by one in the order they were
+     *      submitted, so the reader is never used concurrently. An urgent read
+     *      is one the caller is going to wait for right away; it is not queued
+     *      behind the read-ahead.
+     */
+    arrow::Future<std::shared_ptr<arrow::Table>>
+    submit_read(int rowgroup, const std::vector<int> &indices,
+                bool urgent = false)
+    {
+        if (parquet_s3_prefetch_depth > 0 || this->prefetch_reads)
+        {
+            auto    fut = arrow::Future<std::shared_ptr<arrow::Table>>::Make();
+
+            if (!this->prefetch_reads)
+                this->prefetch_reads = std::make_shared<SerialReads>();
+
+            if (this->prefetch_reads->submit([this, rowgroup, &indices, fut]() mutable {
+                    fut.MarkFinished(this->read_rowgroup(rowgroup, indices));
+                }, urgent))
+                return fut;
+        }
+
+        /* No read-ahead, read it right here */
+        return arrow::Future<std::shared_ptr<arrow::Table>>::MakeFinished(
+                    this->read_rowgroup(rowgroup, indices));
+    }
+
+    /*
+     * prefetch_rowgroups
+     *      Claim up to parquet_s3_fdw.prefetch_depth row groups ahead of the
+     *      current one and start reading those which fit into
+     *      parquet_s3_fdw.prefetch_memory along with the read-ahead of the
+     *      other readers of the backend.
+     */
+    void prefetch_rowgroups()
+    {
+        int64   cap = (int64) parquet_s3_prefetch_memory * 1024 * 1024;
+        int     rowgroup;
+
+        while (this->prefetch_queue.size() < (size_t) parquet_s3_prefetch_depth &&
+               this->claim_rowgroup(&rowgroup))
+        {
+            this->prefetch_queue.push_back({rowgroup, this->rowgroup_size(rowgroup),
+                                            false, {}});
+        }
+
+        for (auto &p : this->prefetch_queue)
+        {
+            if (p.started)
+                continue;
+            if (prefetch_bytes_total + p.bytes > cap)
+                break;
+            this->start_prefetch(p);
+        }
+    }
+
+    /*
+     * drain_prefetch
+     *      Wait for the row groups being read in background and forget them.
+     */
+    void drain_prefetch()
+    {
+        for (auto &p : this->prefetch_queue)
+        {
+            if (p.started)
+                p.table.Wait();
+            this->release_prefetch(p);
+        }
+        this->prefetch_queue.clear();
+    }
+
+    /*
+     * read_next_batch
+     *      Streaming counterpart of read_next_rowgroup(). Makes the next batch
+     *      of the current row group the current table, moving on to the next
+     *      row group once the current one is exhausted. Read-ahead is not used
+     *      in this mode as its point is to bound memory usage.
+     */
+    bool read_next_batch()
+    {
+        arrow::Status   status;
+        int             rowgroup;
+
+        while (true)
+        {
+            if (this->batch_reader)
+            {
+                std::shared_ptr<arrow::RecordBatch> batch;
+
+                status = this->batch_reader->ReadNext(&batch);
+                if (!status.ok())
+                    throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                                this->batch_rowgroup, status.message().c_str(),
+                                this->filename.c_str());
+
+                if (batch)
+                {
+                    auto table = arrow::Table::FromRecordBatches({batch});
+
+                    if (!table.ok())
+                        throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                                    this->batch_rowgroup, table.status().message().c_str(),
+                                    this->filename.c_str());
+
+                    /* Batches may come with dictionaries of their own */
+                    this->reset_dictionary_values();
+                    this->table = *table;
+                    return true;
+                }
+                this->batch_reader.reset();
+
+                /*
+                 * The limit has not been reached within the row group, read
+                 * the next one in larger batches. Once they get large, go
+                 * back to the configured way of reading.
+                 */
+                if (this->limit_rows > 0 && this->batch_size < this->configured_batch_size)
+                    this->batch_size = std::min<int64>(this->batch_size * 2,
+                                                       this->configured_batch_size);
+                else if (this->limit_rows > 0 && this->configured_batch_size <= 0)
+                {
+                    this->batch_size *= 2;
+                    if (this->batch_size > LIMIT_MAX_BATCH_SIZE)
+                    {
+                        this->batch_size = 0;
+                        return this->read_next_prefetched();
+                    }
+                }
+            }
+
+            /* Release the previous batch before the next row group is opened */
+            this->table = nullptr;
+
+            if (!this->claim_rowgroup(&rowgroup))
+                return false;
+            this->batch_rowgroup = rowgroup;
+
+            /* Let S3 fetch the column chunks by a few concurrent requests */
+            parquetWillNeedRowGroup(this->reader_entry, this->reader.get(),
+                                    rowgroup, this->indices);
+
+            this->reader->set_batch_size(this->batch_size);
+            status = this->reader->GetRecordBatchReader({rowgroup}, this->indices,
+                                                        &this->batch_reader);
+            if (!status.ok())
+                throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                            rowgroup, status.message().c_str(), this->filename.c_str());
+        }
+    }
+
+    bool read_next_rowgroup()
+    {
+        /* Values of the previous row group are not referenced anymore */
+        this->reset_dictionary_values();
+
+        if (!this->columns_split_checked)
+            this->split_columns();
 
-        status = this->reader
-            ->RowGroup(rowgroup)
-            ->ReadTable(this->indices, &this->table);
+        while (true)
+        {
+            if (this->batch_size > 0)
+            {
+                if (!this->read_next_batch())
+                    return false;
+            }
+            else if (!this->read_next_prefetched())
+                return false;
 
-        if (!status.ok())
-            throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
-                        rowgroup, status.message().c_str(), this->filename.c_str());
+            if (this->other_indices.empty())
+                break;
 
-        if (!this->table)
-            throw std::runtime_error("parquet_s3_fdw: got empty table");
+            /*
+             * Only the filtered columns have been read so far. Don't bother
+             * reading the rest if no row passes the filters.
+             */
+            this->compute_selection();
+            if (std::find(this->selection.begin(), this->selection.end(), 1)
+                    != this->selection.end())
+            {
+                this->read_other_columns();
+                break;
+            }
+        }
 
         /* TODO: don't clear each time */
         this->chunk_info.clear();
@@ -1271,10 +2328,262 @@ public:
             int64 len = column->chunk(0)->length();
             this->chunk_info.emplace_back(len);
             this->chunks.push_back(column->chunk(0).get());
+            this->decode_chunk(i);
         }
 
         this->row = 0;
         this->num_rows = this->table->num_rows();
+        if (this->other_indices.empty())
+            this->compute_selection();
+
+        return true;
+    }
+
+    /*
+     * read_other_columns
+     *      Read the columns of the current row group not read by the first
+     *      read (see filter_indices) and add them to the table.
+     */
+    void read_other_columns()
+    {
+        std::vector<std::shared_ptr<arrow::Field>>          fields;
+        std::vector<std::shared_ptr<arrow::ChunkedArray>>   columns;
+        std::set<std::string>   seen;
+        auto        result = this->submit_read(this->current_rowgroup,
+                                               this->other_indices,
+                                               true).result();
+
+        if (!result.ok())
+            throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                        this->current_rowgroup, result.status().message().c_str(),
+                        this->filename.c_str());
+
+        const auto &other = *result;
+
+        /*
+         * Keep the column order ReadTable(indices) would produce, as chunks
+         * are looked up by position when switching to the next one.
+         */
+        for (auto &typinfo : this->types)
+        {
+            const std::string &name = typinfo.arrow.column_name;
+            auto    src = this->table;
+            int     idx;
+
+            if (!seen.insert(name).second)
+                continue;
+
+            if ((idx = src->schema()->GetFieldIndex(name)) < 0)
+            {
+                src = other;
+                if ((idx = src->schema()->GetFieldIndex(name)) < 0)
+                    continue;
+            }
+            fields.push_back(src->schema()->field(idx));
+            columns.push_back(src->column(idx));
+        }
+
+        this->table = arrow::Table::Make(arrow::schema(fields), columns,
+                                         this->table->num_rows());
+    }
+
+    /*
+     * compute_selection
+     *      Evaluate the row filters on the whole current row group.
+     */
+    void compute_selection()
+    {
+        this->selection.clear();
+        this->selection_exact = !this->schemaless;
+
+        if (this->row_filters.empty() || this->schemaless)
+            return;
+
+        this->selection_exact = this->filter_rows(*this->table, this->selection,
+                                                  0, this->table->num_rows());
+    }
+
+    /*
+     * next_chunk
+     *      Make the next chunk of the column current. Returns false if there
+     *      are no more chunks.
+     */
+    bool next_chunk(int col)
+    {
+        ChunkInfo  &chunkInfo = this->chunk_info[col];
+        const auto &column = this->table->column(col);
+        arrow::Array *array;
+
+        if (++chunkInfo.chunk >= column->num_chunks())
+            return false;
+
+        array = column->chunk(chunkInfo.chunk).get();
+        this->chunks[col] = array;
+        chunkInfo.pos = 0;
+        chunkInfo.len = array->length();
+        this->decode_chunk(col);
+
+        return true;
+    }
+
+    /*
+     * skip_rows
+     *      Move all the columns n rows forward without reading the values.
+     */
+    void skip_rows(int64 n)
+    {
+        for (size_t col = 0; col < this->chunk_info.size(); ++col)
+        {
+            ChunkInfo  &chunkInfo = this->chunk_info[col];
+            int64       left = n;
+
+            while (left > 0)
+            {
+                int64   step;
+
+                if (chunkInfo.pos >= chunkInfo.len && !this->next_chunk(col))
+                    break;
+
+                step = Min(left, chunkInfo.len - chunkInfo.pos);
+                chunkInfo.pos += step;
+                left -= step;
+            }
+        }
+        this->row += n;
+    }
+
+    /*
+     * init_decoders
+     *      Bind the columns to the decoders of their types. Types needing a
+     *      cast are left to read_primitive_type() as the cast may fail per
+     *      value. Same for 8-byte types on platforms where they are passed
+     *      by reference.
+     */
+    void init_decoders()
+    {
+        this->decoders.assign(this->types.size(), NULL);
+        this->decoded.resize(this->types.size());
+
+        if (this->schemaless)
+            return;
+
+        for (size_t i = 0; i < this->types.size(); ++i)
+        {
+            TypeInfo   &typinfo = this->types[i];
+
+            if (typinfo.need_cast)
+                continue;
+
+            switch (typinfo.arrow.type_id)
+            {
+                case arrow::Type::BOOL:
+                    this->decoders[i] = decode_bool;
+                    break;
+                case arrow::Type::INT8:
+                    this->decoders[i] = decode_int8;
+                    break;
+                case arrow::Type::INT16:
+                    this->decoders[i] = decode_int16;
+                    break;
+                case arrow::Type::INT32:
+                    this->decoders[i] = decode_int32;
+                    break;
+                case arrow::Type::FLOAT:
+                    this->decoders[i] = decode_float;
+                    break;
+                case arrow::Type::DATE32:
+                    this->decoders[i] = decode_date32;
+                    break;
+                case arrow::Type::INT64:
+                    if (FLOAT8PASSBYVAL)
+                        this->decoders[i] = decode_int64;
+                    break;
+                case arrow::Type::DOUBLE:
+                    if (FLOAT8PASSBYVAL)
+                        this->decoders[i] = decode_double;
+                    break;
+                case arrow::Type::TIMESTAMP:
+                    if (FLOAT8PASSBYVAL)
+                        this->decoders[i] = decode_timestamp;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    /*
+     * decode_chunk
+     *      Convert the current chunk of the column if it has a decoder.
+     */
+    void decode_chunk(size_t col)
+    {
+        if (this->decoders.size() != this->types.size())
+            this->init_decoders();
+
+        if (this->decoders[col] == NULL)
+            return;
+
+        DecodedChunk   &dc = this->decoded[col];
+        arrow::Array   *array = this->chunks[col];
+        int64           len = array->length();
+
+        if (len > dc.capacity)
+        {
+            dc.values.resize(len);
+            dc.nulls.reset(new bool[len]);
+            dc.capacity = len;
+        }
+        this->decoders[col](array, dc.values.data(), dc.nulls.get());
+    }
+
+    /*
+     * read_next_prefetched
+     *      Make the next row group the current table, waiting for it to be
+     *      read if needed, and start reading the following ones.
+     */
+    bool read_next_prefetched()
+    {
+        PrefetchedRowGroup  next;
+        int                 rowgroup;
+
+        /* Release the previous row group before the next one is decoded */
+        this->table = nullptr;
+
+        if (this->prefetch_queue.empty())
+        {
+            if (!this->claim_rowgroup(&rowgroup))
+                return false;
+            this->prefetch_queue.push_back({rowgroup, this->rowgroup_size(rowgroup),
+                                            false, {}});
+        }
+
+        /*
+         * The row group we are going to return now is read regardless of the
+         * cap and ahead of the read-ahead.
+         */
+        if (!this->prefetch_queue.front().started)
+            this->start_prefetch(this->prefetch_queue.front(), true);
+
+        next = std::move(this->prefetch_queue.front());
+        this->prefetch_queue.pop_front();
+        this->release_prefetch(next);
+        this->current_rowgroup = next.rowgroup;
+
+        /* Read the following row groups while this one is being consumed */
+        this->prefetch_rowgroups();
+
+        const auto &result = next.table.result();
+
+        if (!result.ok())
+            throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                        next.rowgroup, result.status().message().c_str(),
+                        this->filename.c_str());
+
+        this->table = *result;
+
+        if (!this->table)
+            throw std::runtime_error("parquet_s3_fdw: got empty table");
 
         return true;
     }
@@ -1414,11 +2723,107 @@ public:
         }
     }
 
+    /*
+     * skip_to_selected
+     *      Skip the rows of the current row group rejected by the row filters.
+     *      Returns false if no rows are left in the row group.
+     */
+    bool skip_to_selected()
+    {
+        uint32_t    skip = 0;
+
+        if (this->row >= this->num_rows)
+            return false;
+
+        if (this->selection.empty())
+            return true;
+
+        while (this->row + skip < this->num_rows && !this->selection[this->row + skip])
+            skip++;
+        if (skip > 0)
+            this->skip_rows(skip);
+
+        return this->row < this->num_rows;
+    }
+
+    /*
+     * key_run_length
+     *      Number of rows next() is going to return from the current chunk of
+     *      the sorted integer-like attribute before its value exceeds the
+     *      limit. NULLs sort last, so they end the run. The end of the run is
+     *      found by galloping followed by a binary search, which takes
+     *      O(log n) probes for a run of n rows.
+     */
+    uint32 key_run_length(AttrNumber attnum, int64 limit)
+    {
+        int         attr = attnum - 1;
+        int         col;
+        int64       n, lo, hi, step;
+
+        if (this->schemaless || this->row >= this->num_rows ||
+            attr < 0 || (size_t) attr >= this->map.size() ||
+            (col = this->map[attr]) < 0 ||
+            this->statistics_type(this->types[col]) == nullptr)
+            return 0;
+
+        ChunkInfo      &chunkInfo = this->chunk_info[col];
+        arrow::Array   *array = this->chunks[col];
+        TypeInfo       &typinfo = this->types[col];
+
+        auto key_fits = [&] (int64 i) -> bool
+        {
+            int64   pos = chunkInfo.pos + i;
+
+            if (this->decoders[col] != NULL)
+            {
+                DecodedChunk   &dc = this->decoded[col];
+
+                return !dc.nulls[pos] && DatumGetInt64(dc.values[pos]) <= limit;
+            }
+            if (array->IsNull(pos))
+                return false;
+            return DatumGetInt64(this->read_primitive_type(array, typinfo, pos)) <= limit;
+        };
+
+        n = Min(chunkInfo.len - chunkInfo.pos, (int64) (this->num_rows - this->row));
+        if (n <= 0 || !key_fits(0))
+            return 0;
+
+        /* Rows [0, lo] fit, rows from hi on are not known to */
+        lo = 0;
+        step = 1;
+        while (lo + step < n && key_fits(lo + step))
+        {
+            lo += step;
+            step *= 2;
+        }
+        hi = Min(lo + step, n);
+        while (hi - lo > 1)
+        {
+            int64   mid = lo + (hi - lo) / 2;
+
+            if (key_fits(mid))
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        /* Only the selected rows are returned */
+        if (this->selection.empty())
+            return lo + 1;
+
+        uint32  nselected = 0;
+
+        for (int64 i = 0; i <= lo; i++)
+            nselected += this->selection[this->row + i] ? 1 : 0;
+        return nselected;
+    }
+
     ReadStatus next(TupleTableSlot *slot, bool fake=false)
     {
         allocator->recycle();
 
-        if (this->row >= this->num_rows)
+        while (!this->skip_to_selected())
         {
             /*
              * Read next row group. We do it in a loop to skip possibly empty
@@ -1438,6 +2843,44 @@ public:
         return RS_SUCCESS;
     }
 
+    ReadStatus next_rowgroup(RowGroupBatch &batch)
+    {
+        do
+        {
+            if (!this->read_next_rowgroup())
+                return RS_EOF;
+        }
+        while (!this->num_rows);
+
+        batch.columns.assign(this->map.size(), nullptr);
+        for (size_t attr = 0; attr < this->map.size(); attr++)
+        {
+            int     col = this->map[attr];
+
+            if (col >= 0)
+                batch.columns[attr] =
+                    this->table->GetColumnByName(this->types[col].arrow.column_name);
+        }
+        batch.num_rows = this->num_rows;
+        batch.selection = this->selection.empty() ? NULL : this->selection.data();
+        batch.filtered = this->selection_exact;
+
+        return RS_SUCCESS;
+    }
+
+    ReadStatus next_rowgroup_row(TupleTableSlot *slot)
+    {
+        allocator->recycle();
+
+        if (!this->skip_to_selected())
+            return RS_EOF;
+
+        this->populate_slot(slot);
+        this->row++;
+
+        return RS_SUCCESS;
+    }
+
     /*
      * populate_slot
      *      Fill slot with the values from parquet row.
@@ -1469,22 +2912,28 @@ public:
 
                 if (chunkInfo.pos >= chunkInfo.len)
                 {
-                    const auto &column = this->table->column(arrow_col);
-
                     /* There are no more chunks */
-                    if (++chunkInfo.chunk >= column->num_chunks())
+                    if (!this->next_chunk(arrow_col))
                         break;
 
-                    array = column->chunk(chunkInfo.chunk).get();
-                    this->chunks[arrow_col] = array;
-                    chunkInfo.pos = 0;
-                    chunkInfo.len = array->length();
+                    array = this->chunks[arrow_col];
                 }
 
                 /* Don't do actual reading data into slot in fake mode */
                 if (fake)
                     continue;
 
+                /* Values already converted by the column decoder */
+                if (this->decoders[arrow_col] != NULL)
+                {
+                    DecodedChunk   &dc = this->decoded[arrow_col];
+
+                    slot->tts_values[attr] = dc.values[chunkInfo.pos];
+                    slot->tts_isnull[attr] = dc.nulls[chunkInfo.pos];
+                    chunkInfo.pos++;
+                    continue;
+                }
+
                 if (array->IsNull(chunkInfo.pos))
                 {
                     slot->tts_isnull[attr] = true;
@@ -1539,9 +2988,17 @@ public:
 
     void rescan(void)
     {
+        this->drain_prefetch();
+        this->batch_reader.reset();
+        this->rowgroups_exhausted = false;
         this->row_group = -1;
         this->row = 0;
         this->num_rows = 0;
+        this->selection.clear();
+
+        /* Start with small batches again */
+        this->batch_size = this->configured_batch_size;
+        this->set_limit(this->limit_rows);
     }
 };
 
@@ -1557,6 +3014,13 @@ private:
     uint32_t        row;                /* current row within row group */
     uint32_t        num_rows;           /* total rows in row group */
 
+    /*
+     * Rows of the current row group passing the row filters, empty if no
+     * filter applies. Rejected rows are still converted, as the whole row
+     * group is, but they are skipped by next().
+     */
+    std::vector<uint8_t>    selection;
+
 public:
     CachingParquetReader(const char* filename, MemoryContext cxt, int reader_id = -1)
         : ParquetReader(cxt), is_active(false), row_group(-1), row(0), num_rows(0)
@@ -1571,8 +3035,7 @@ public:
 
     ~CachingParquetReader()
     {
-        if (this->reader_entry && this->reader)
-            this->reader_entry->file_reader->reader = std::move(this->reader);
+        this->release_cached_reader();
     }
 
     void open(const char *dirname,
@@ -1587,7 +3050,7 @@ public:
         pfree(dname);
         pfree(fname);
 
-        this->reader = std::move(this->reader_entry->file_reader->reader);
+        this->take_cached_reader();
 
         /* Enable parallel columns decoding/decompression if needed */
         this->reader->set_use_threads(this->use_threads && parquet_fdw_use_threads);
@@ -1600,9 +3063,13 @@ public:
         arrow::Status   status;
         std::unique_ptr<parquet::arrow::FileReader> reader;
 
+        auto parquet_reader = parquetOpenLocalFile(filename, use_mmap);
+        auto props = parquetDictionaryReaderProperties(parquet_reader->metadata()->schema());
+
         status = parquet::arrow::FileReader::Make(
                         arrow::default_memory_pool(),
-                        parquet::ParquetFileReader::OpenFile(filename, use_mmap),
+                        std::move(parquet_reader),
+                        props,
                         &reader);
         if (!status.ok())
             throw Error("parquet_s3_fdw: failed to open Parquet file %s ('%s')",
@@ -1617,6 +3084,7 @@ public:
 
     void close()
     {
+        this->release_cached_reader();
         this->reader = nullptr;  /* destroy the reader */
         is_active = false;
     }
@@ -1660,45 +3128,116 @@ public:
                                 ->metadata()
                                 ->RowGroup(rowgroup);
 
-        status = this->reader
-            ->RowGroup(rowgroup)
-            ->ReadTable(this->indices, &table);
-        if (!status.ok())
-            throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
-                        rowgroup, status.message().c_str(), this->filename.c_str());
+        /* Let S3 fetch the column chunks by a few concurrent requests */
+        parquetWillNeedRowGroup(this->reader_entry, this->reader.get(),
+                                rowgroup, this->indices);
 
         /* Release resources acquired in the previous iteration */
         allocator->recycle();
+        this->reset_dictionary_values();
+        this->selection.clear();
+
+        std::vector<bool>   has_nulls(types.size());
 
-        /* Read columns data and store it into column_data vector */
         for (std::vector<TypeInfo>::size_type col = 0; col < types.size(); ++col)
         {
-            bool            has_nulls;
             std::shared_ptr<parquet::Statistics>  stats;
 
             if (types[col].index >= 0)
                 stats = rowgroup_meta->ColumnChunk(types[col].index)->statistics();
-            has_nulls = stats ? stats->null_count() > 0 : true;
+            has_nulls[col] = stats && stats->HasNullCount() ?
+                                stats->null_count() > 0 : true;
+        }
+
+        /*
+         * In streaming mode convert the row group batch by batch, so that
+         * only one batch of arrow data is kept in memory besides the
+         * converted values.
+         */
+        if (this->configured_batch_size > 0)
+        {
+            std::unique_ptr<arrow::RecordBatchReader> batch_reader;
+            int64       offset = 0;
+
+            this->reader->set_batch_size(this->configured_batch_size);
+            status = this->reader->GetRecordBatchReader({rowgroup}, this->indices,
+                                                        &batch_reader);
+            if (!status.ok())
+                throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                            rowgroup, status.message().c_str(), this->filename.c_str());
+
+            this->num_rows = rowgroup_meta->num_rows();
+            for (std::vector<TypeInfo>::size_type col = 0; col < types.size(); ++col)
+                this->column_nulls[col].resize(this->num_rows);
+
+            while (true)
+            {
+                std::shared_ptr<arrow::RecordBatch> batch;
+
+                status = batch_reader->ReadNext(&batch);
+                if (!status.ok())
+                    throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                                rowgroup, status.message().c_str(), this->filename.c_str());
+                if (!batch)
+                    break;
+
+                auto batch_table = arrow::Table::FromRecordBatches({batch});
 
+                if (!batch_table.ok())
+                    throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                                rowgroup, batch_table.status().message().c_str(),
+                                this->filename.c_str());
+
+                for (std::vector<TypeInfo>::size_type col = 0; col < types.size(); ++col)
+                    this->read_column(*batch_table, col, has_nulls[col], offset);
+                if (!this->schemaless)
+                    (void) this->filter_rows(**batch_table, this->selection,
+                                             offset, this->num_rows);
+                offset += batch->num_rows();
+            }
+
+            this->row = 0;
+            return true;
+        }
+
+        status = this->reader
+            ->RowGroup(rowgroup)
+            ->ReadTable(this->indices, &table);
+        if (!status.ok())
+            throw Error("parquet_s3_fdw: failed to read rowgroup #%i: %s ('%s')",
+                        rowgroup, status.message().c_str(), this->filename.c_str());
+
+        /* Read columns data and store it into column_data vector */
+        for (std::vector<TypeInfo>::size_type col = 0; col < types.size(); ++col)
+        {
             this->num_rows = table->num_rows();
             this->column_nulls[col].resize(this->num_rows);
 
-            this->read_column(table, col, has_nulls);
+            this->read_column(table, col, has_nulls[col]);
         }
+        if (!this->schemaless)
+            (void) this->filter_rows(*table, this->selection, 0, table->num_rows());
 
         this->row = 0;
         return true;
     }
 
+    /*
+     * read_column
+     *      Convert the column of the table into column_data starting at
+     *      the given row. The column buffer is allocated for the whole row
+     *      group when the first rows are stored.
+     */
     void read_column(std::shared_ptr<arrow::Table> table,
                      int col,
-                     bool has_nulls)
+                     bool has_nulls,
+                     int64 offset = 0)
     {
         std::shared_ptr<arrow::ChunkedArray> column = nullptr;
         TypeInfo &typinfo = this->types[col];
         void   *data;
         size_t  sz;
-        int     row = 0;
+        int64   row = offset;
 
         /*
          * By using column name remapping feature, multiple columns of foreign table
@@ -1741,7 +3280,10 @@ public:
                 sz = sizeof(Datum);
         }
 
-        data = allocator->fast_alloc(sz * num_rows);
+        if (offset == 0)
+            data = allocator->fast_alloc(sz * num_rows);
+        else
+            data = this->column_data[col];
 
         for (int i = 0; i < column->num_chunks(); ++i) {
             arrow::Array *array = column->chunk(i).get();
@@ -1766,37 +3308,37 @@ public:
                     case arrow::Type::BOOL:
                         {
                             arrow::BooleanArray *boolarray = (arrow::BooleanArray *) array;
-                            ((bool *) data)[row] = boolarray->Value(row);
+                            ((bool *) data)[row] = boolarray->Value(j);
                             break;
                         }
                     case arrow::Type::INT8:
                         {
                             arrow::Int8Array *intarray = (arrow::Int8Array *) array;
-                            ((int8 *) data)[row] = intarray->Value(row);
+                            ((int8 *) data)[row] = intarray->Value(j);
                             break;
                         }
                     case arrow::Type::INT16:
                         {
                             arrow::Int16Array *intarray = (arrow::Int16Array *) array;
-                            ((int16 *) data)[row] = intarray->Value(row);
+                            ((int16 *) data)[row] = intarray->Value(j);
                             break;
                         }
                     case arrow::Type::INT32:
                         {
                             arrow::Int32Array *intarray = (arrow::Int32Array *) array;
-                            ((int32 *) data)[row] = intarray->Value(row);
+                            ((int32 *) data)[row] = intarray->Value(j);
                             break;
                         }
                     case arrow::Type::FLOAT:
                         {
                             arrow::FloatArray *farray = (arrow::FloatArray *) array;
-                            ((float *) data)[row] = farray->Value(row);
+                            ((float *) data)[row] = farray->Value(j);
                             break;
                         }
                     case arrow::Type::DATE32:
                         {
                             arrow::Date32Array *tsarray = (arrow::Date32Array *) array;
-                            ((int *) data)[row] = tsarray->Value(row);
+                            ((int *) data)[row] = tsarray->Value(j);
                             break;
                         }
 
@@ -1984,21 +3526,29 @@ public:
 
     ReadStatus next(TupleTableSlot *slot, bool fake=false)
     {
-        if (this->row >= this->num_rows)
+        while (true)
         {
-            if (!is_active)
-                return RS_INACTIVE;
-
-            /*
-             * Read next row group. We do it in a loop to skip possibly empty
-             * row groups.
-             */
-            do
+            if (this->row >= this->num_rows)
             {
-                if (!this->read_next_rowgroup())
-                    return RS_EOF;
+                if (!is_active)
+                    return RS_INACTIVE;
+
+                /*
+                 * Read next row group. We do it in a loop to skip possibly
+                 * empty row groups.
+                 */
+                do
+                {
+                    if (!this->read_next_rowgroup())
+                        return RS_EOF;
+                }
+                while (!this->num_rows);
             }
-            while (!this->num_rows);
+
+            /* Skip the rows rejected by the row filters */
+            if (this->selection.empty() || this->selection[this->row])
+                break;
+            this->row++;
         }
 
         if (!fake)
@@ -14,6 +14,8 @@
 #ifndef PARQUET_FDW_READER_HPP
 #define PARQUET_FDW_READER_HPP
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -32,6 +34,7 @@ extern "C"
 #include "access/tupdesc.h"
 #include "executor/tuptable.h"
 #include "nodes/pg_list.h"
+#include "port/atomics.h"
 #include "storage/spin.h"
 #include "utils/sortsupport.h"
 #include "parser/parse_oper.h"
@@ -46,10 +49,21 @@ extern bool parquet_fdw_use_threads;
 
 class ParallelCoordinator
 {
+public:
+    /* Row group to be read by one of the workers */
+    struct WorkItem
+    {
+        int32   reader;     /* file number */
+        int32   rowgroup;   /* position in the file's row group list */
+        int32   size;       /* compressed size in kB */
+    };
+
 private:
     enum Type {
         PC_SINGLE = 0,
-        PC_MULTI
+        PC_MULTI,
+        PC_QUEUE,
+        PC_RANGES
     };
 
     Type        type;
@@ -67,8 +81,30 @@ private:
         {
             int32   next_rowgroup[FLEXIBLE_ARRAY_MEMBER]; /* per-reader counters */
         } multi;   /* multimerge case */
+        struct
+        {
+            pg_atomic_uint32 next_item; /* next item to claim */
+            int32   nitems;
+            WorkItem items[FLEXIBLE_ARRAY_MEMBER];
+        } queue;   /* multifile case, see init_queue() */
+        struct
+        {
+            pg_atomic_uint32 next_range; /* next key range to claim */
+            int32   nbounds;
+            Datum   bounds[FLEXIBLE_ARRAY_MEMBER]; /* ascending boundaries */
+        } ranges;  /* multimerge case split by the sort key */
     } data;
 
+    /* Sizes within the same power of two are considered equal */
+    static int size_class(int32 size)
+    {
+        int     cls = 0;
+
+        while (size >>= 1)
+            cls++;
+        return cls;
+    }
+
 public:
     void lock() { SpinLockAcquire(&latch); }
     void unlock() { SpinLockRelease(&latch); }
@@ -88,10 +124,90 @@ public:
     void init_multi(int nfiles)
     {
         type = PC_MULTI;
+        SpinLockInit(&latch);
         for (int i = 0; i < nfiles; ++i)
             data.multi.next_rowgroup[i] = 0;
     }
 
+    /*
+     * init_queue
+     *      Build the shared work queue. The largest row groups go first so
+     *      that the workers finish at about the same time instead of waiting
+     *      for whoever drew a huge row group last. Row groups of similar size
+     *      keep the file order so that a worker tends to stay on one file.
+     */
+    void init_queue(const WorkItem *items, int32 nitems)
+    {
+        type = PC_QUEUE;
+        data.queue.nitems = nitems;
+        pg_atomic_init_u32(&data.queue.next_item, 0);
+
+        if (nitems == 0)
+            return;
+
+        memcpy(data.queue.items, items, sizeof(WorkItem) * nitems);
+        std::stable_sort(data.queue.items, data.queue.items + nitems,
+                         [] (const WorkItem &a, const WorkItem &b)
+                         {
+                             return size_class(a.size) > size_class(b.size);
+                         });
+    }
+
+    /* Claim the next work item. Doesn't require the lock. */
+    bool next_item(WorkItem *item)
+    {
+        uint32  pos;
+
+        Assert(type == PC_QUEUE);
+        pos = pg_atomic_fetch_add_u32(&data.queue.next_item, 1);
+        if (pos >= (uint32) data.queue.nitems)
+            return false;
+
+        *item = data.queue.items[pos];
+        return true;
+    }
+
+    /*
+     * init_ranges
+     *      Split the first sort key into nbounds + 1 ranges separated by the
+     *      given boundaries. Each range is merged by one participant, which
+     *      claims ranges in ascending order so that its output stays sorted.
+     */
+    void init_ranges(const Datum *bounds, int32 nbounds)
+    {
+        type = PC_RANGES;
+        data.ranges.nbounds = nbounds;
+        pg_atomic_init_u32(&data.ranges.next_range, 0);
+        if (nbounds)
+            memcpy(data.ranges.bounds, bounds, sizeof(Datum) * nbounds);
+    }
+
+    bool is_ranged()
+    {
+        return type == PC_RANGES;
+    }
+
+    /*
+     * Claim the next key range. Range i covers keys from bounds[i - 1]
+     * inclusive to bounds[i] exclusive; the first and the last ones are
+     * unbounded on one side. Doesn't require the lock.
+     */
+    bool next_range(Datum *lower, bool *has_lower, Datum *upper, bool *has_upper)
+    {
+        uint32  pos;
+
+        Assert(type == PC_RANGES);
+        pos = pg_atomic_fetch_add_u32(&data.ranges.next_range, 1);
+        if (pos > (uint32) data.ranges.nbounds)
+            return false;
+
+        if ((*has_lower = pos > 0))
+            *lower = data.ranges.bounds[pos - 1];
+        if ((*has_upper = pos < (uint32) data.ranges.nbounds))
+            *upper = data.ranges.bounds[pos];
+        return true;
+    }
+
     /* Get the next reader id. Caller must hold the lock. */
     int32 next_reader()
     {
@@ -133,6 +249,69 @@ public:
 
 class FastAllocatorS3;
 
+enum RowFilterKind
+{
+    RF_COMPARE = 0,     /* var OP const, var OP ANY/ALL (array) */
+    RF_IS_NULL,
+    RF_IS_NOT_NULL
+};
+
+/*
+ * Restriction evaluated by the reader on arrow arrays. See row_filter.cpp.
+ */
+struct RowFilter
+{
+    RowFilterKind       kind;
+    AttrNumber          attnum;
+    int                 strategy;   /* btree strategy number */
+    bool                negate;     /* "<>", i.e. negated BTEqualStrategyNumber */
+    bool                use_or;     /* ANY (true) or ALL (false) */
+    bool                has_null;   /* NULL among the values */
+    Oid                 valtype;
+    std::vector<Datum>  values;
+    Oid                 collid;
+    FmgrInfo           *cmpfunc;    /* btree support function, strings only */
+
+    /*
+     * Values compared with a parameter are computed at execution time, see
+     * set_row_filter_params(). Until then the filter is unknown and ignored.
+     */
+    struct ExprState   *param;
+    bool                unknown;
+    MemoryContext       param_cxt;  /* holds the computed values */
+
+    RowFilter()
+        : kind(RF_COMPARE), attnum(InvalidAttrNumber), strategy(0),
+          negate(false), use_or(true), has_null(false), valtype(InvalidOid),
+          collid(InvalidOid), cmpfunc(nullptr), param(nullptr),
+          unknown(false), param_cxt(nullptr)
+    {}
+};
+
+bool evaluate_row_filter(const RowFilter &filter, Oid coltype,
+                         const arrow::Array *array, uint8_t *sel);
+bool row_filter_matches_range(const RowFilter &filter, Oid coltype,
+                              Datum min, Datum max);
+
+/*
+ * Rows of a row group handed over as arrow arrays, see
+ * ParquetReader::next_rowgroup().
+ */
+struct RowGroupBatch
+{
+    /* Per attribute of the tuple descriptor, NULL if not read or missing */
+    std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+    int64               num_rows;
+
+    /*
+     * Rows passing the row filters, NULL if all rows do. When "filtered" is
+     * set every row filter has been evaluated; as evaluated filters are exact,
+     * the selection is then the result of the quals they were built from.
+     */
+    const uint8_t      *selection;
+    bool                filtered;
+};
+
 enum ReadStatus
 {
     RS_SUCCESS = 0,
@@ -189,7 +368,7 @@ protected:
         TypeInfo(TypeInfo &&ti)
             : arrow(ti.arrow), pg(ti.pg), need_cast(ti.need_cast),
               castfunc(ti.castfunc), outfunc(ti.outfunc), infunc(ti.infunc),
-              children(std::move(ti.children)), index(-1)
+              children(std::move(ti.children)), index(ti.index)
         {}
 
         TypeInfo(std::shared_ptr<arrow::DataType> arrow_type, Oid typid=InvalidOid)
@@ -197,6 +376,9 @@ protected:
         {
             arrow.type_id = arrow_type->id();
             arrow.type_name = arrow_type->name();
+            if (arrow.type_id == arrow::Type::TIMESTAMP)
+                arrow.time_precision =
+                    static_cast<arrow::TimestampType *>(arrow_type.get())->unit();
             pg.oid = typid;
             pg.len = 0;
             pg.byval = false;
@@ -226,6 +408,12 @@ protected:
 
     std::unique_ptr<parquet::arrow::FileReader> reader;
 
+    /*
+     * Reader taken from the S3 reader cache, kept aside while "reader" (which
+     * reads string columns as dictionaries) is used and handed back once done.
+     */
+    std::unique_ptr<parquet::arrow::FileReader> cached_reader;
+
     /* Arrow column indices that are used in query */
     std::vector<int>                indices;
 
@@ -279,10 +467,47 @@ protected:
     /* Whether object is properly initialized */
     bool                            initialized;
 
+    /* Restrictions used to skip rows before they are materialized */
+    std::vector<RowFilter>          row_filters;
+
+    /* Number of rows the scan is expected to stop after, 0 if unknown */
+    int64                           limit_rows;
+
+    /*
+     * parquet_s3_fdw.batch_size taken when the reader is created, so that a
+     * scan does not change the way it reads in the middle.
+     */
+    int64                           configured_batch_size;
+
+    /*
+     * Datums built for the entries of dictionary encoded string columns,
+     * keyed by the dictionary and the column type. They are kept in dict_cxt
+     * until the row group (or batch) they come from is released. The entry
+     * holds a reference to the dictionary, so that its address cannot be
+     * reused by another dictionary while the entry exists.
+     */
+    struct DictionaryValues
+    {
+        std::shared_ptr<arrow::Array>   dictionary;
+        std::vector<Datum>  values;
+        std::vector<bool>   built;
+    };
+
+    MemoryContext                   dict_cxt;
+    std::map<std::pair<const arrow::Array *, const TypeInfo *>,
+             DictionaryValues>      dict_values;
+
 protected:
     Datum do_cast(Datum val, const TypeInfo &typinfo);
     Datum read_primitive_type(arrow::Array *array, const TypeInfo &typinfo,
                               int64_t i);
+    Datum read_dictionary_value(arrow::DictionaryArray *array,
+                                const TypeInfo &typinfo, int64_t i);
+    void reset_dictionary_values();
+    bool filter_rows(const arrow::Table &table, std::vector<uint8_t> &selection,
+                     int64 offset, int64 total_rows);
+    void take_cached_reader();
+    void release_cached_reader();
     Datum nested_list_to_datum(arrow::ListArray *larray, int pos, const TypeInfo &typinfo);
     Datum nested_list_to_jsonb_datum(arrow::ListArray *larray, int pos, const TypeInfo &typinfo);
 
@@ -297,11 +522,15 @@ protected:
                                                      int elem_size);
     template <typename T> inline const T* GetPrimitiveValues(const arrow::Array& arr);
     void schemaless_create_column_mapping(parquet::arrow::SchemaManifest  manifest);
+    std::shared_ptr<arrow::DataType> statistics_type(const TypeInfo &typinfo);
+    bool rowgroup_matches_params(int rowgroup);
 
 public:
     ParquetReader(MemoryContext cxt);
     virtual ~ParquetReader() = 0;
     virtual ReadStatus next(TupleTableSlot *slot, bool fake=false) = 0;
+    virtual ReadStatus next_rowgroup(RowGroupBatch &batch);
+    virtual ReadStatus next_rowgroup_row(TupleTableSlot *slot);
     virtual void rescan() = 0;
     virtual void open() = 0;
     virtual void open(const char *dirname,
@@ -314,6 +543,12 @@ public:
     void set_options(bool use_threads, bool use_mmap);
     void set_coordinator(ParallelCoordinator *coord);
     void set_schemaless_info(bool schemaless,  std::set<std::string> slcols, std::set<std::string> sorted_cols);
+    void set_row_filters(const std::vector<RowFilter> &filters);
+    virtual void set_limit(int64 rows);
+    virtual uint32 key_run_length(AttrNumber attnum, int64 limit);
+    bool rowgroup_bounds(AttrNumber attnum, int rowgroup, Datum *min, Datum *max);
+    bool lower_bound(AttrNumber attnum, Datum *value);
+    bool upper_bound(AttrNumber attnum, Datum *value);
     std::vector<preSortedColumnData> get_current_sorted_cols_data();
 };
 
@@ -0,0 +1,589 @@
+/*-------------------------------------------------------------------------
+ *
+ * row_filter.cpp
+ *		  Evaluation of simple restrictions on arrow arrays for parquet_s3_fdw
+ *
+ * Row filters are the subset of scan quals of the form "column OP constant",
+ * "column OP ANY/ALL (array)" and "column IS [NOT] NULL" on columns read
+ * without a cast. They are evaluated on whole arrow arrays before rows are
+ * materialized, so that rows which cannot pass the quals are skipped by the
+ * reader. The quals themselves remain in the plan and are still checked by
+ * the executor; the filters only need to never reject a row the quals would
+ * accept.
+ *
+ * Portions Copyright (c) 2021, TOSHIBA CORPORATION
+ *
+ * IDENTIFICATION
+ *		  contrib/parquet_s3_fdw/src/row_filter.cpp
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <cmath>
+
+#include "arrow/api.h"
+
+#include "common.hpp"
+#include "reader.hpp"
+
+extern "C"
+{
+#include "postgres.h"
+#include "access/stratnum.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+
+#if PG_VERSION_NUM < 110000
+#include "catalog/pg_type.h"
+#else
+#include "catalog/pg_type_d.h"
+#endif
+}
+
+/* Three-way comparisons matching PostgreSQL btree semantics */
+static inline int
+cmp3(int64 a, int64 b)
+{
+    return (a > b) - (a < b);
+}
+
+/* NaN is equal to itself and greater than any other value, as in float.c */
+static inline int
+cmp3(double a, double b)
+{
+    if (std::isnan(a))
+        return std::isnan(b) ? 0 : 1;
+    if (std::isnan(b))
+        return -1;
+    return (a > b) - (a < b);
+}
+
+/*
+ * compare_column
+ *      Store into out whether each of len values returned by get() satisfies
+ *      "value OP constant" where OP is given by btree strategy.
+ */
+template <typename Key, typename Get>
+static void
+compare_column(int64 len, Get get, Key value, int strategy, bool negate,
+               uint8_t *out)
+{
+    switch (strategy)
+    {
+        case BTLessStrategyNumber:
+            for (int64 i = 0; i < len; i++)
+                out[i] = cmp3(get(i), value) < 0;
+            break;
+        case BTLessEqualStrategyNumber:
+            for (int64 i = 0; i < len; i++)
+                out[i] = cmp3(get(i), value) <= 0;
+            break;
+        case BTEqualStrategyNumber:
+            for (int64 i = 0; i < len; i++)
+                out[i] = (cmp3(get(i), value) == 0) != negate;
+            break;
+        case BTGreaterEqualStrategyNumber:
+            for (int64 i = 0; i < len; i++)
+                out[i] = cmp3(get(i), value) >= 0;
+            break;
+        case BTGreaterStrategyNumber:
+            for (int64 i = 0; i < len; i++)
+                out[i] = cmp3(get(i), value) > 0;
+            break;
+        default:
+            /* should not happen, accept everything */
+            memset(out, 1, len);
+    }
+}
+
+/*
+ * combine_values
+ *      Evaluate the filter for every constant by calling evaluate(value, out)
+ *      and combine the results by OR (= ANY) or AND (<> ALL) into sel.
+ */
+template <typename Evaluate>
+static void
+combine_values(const RowFilter &filter, int64 len, uint8_t *sel, Evaluate evaluate)
+{
+    std::vector<uint8_t>    acc(len, filter.use_or ? 0 : 1);
+    std::vector<uint8_t>    tmp(len);
+
+    /*
+     * NULL among values makes "x OP ALL (...)" either false or NULL, and a
+     * single NULL constant makes the whole comparison NULL. Neither can pass.
+     */
+    if (filter.has_null && !filter.use_or)
+    {
+        memset(sel, 0, len);
+        return;
+    }
+
+    for (Datum value : filter.values)
+    {
+        evaluate(value, tmp.data());
+
+        if (filter.use_or)
+            for (int64 i = 0; i < len; i++)
+                acc[i] |= tmp[i];
+        else
+            for (int64 i = 0; i < len; i++)
+                acc[i] &= tmp[i];
+    }
+
+    for (int64 i = 0; i < len; i++)
+        sel[i] &= acc[i];
+}
+
+static bool
+integer_value(Oid valtype, Datum value, int64 *res)
+{
+    switch (valtype)
+    {
+        case INT2OID:
+            *res = DatumGetInt16(value);
+            return true;
+        case INT4OID:
+            *res = DatumGetInt32(value);
+            return true;
+        case INT8OID:
+            *res = DatumGetInt64(value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool
+float_value(Oid valtype, Datum value, double *res)
+{
+    switch (valtype)
+    {
+        case FLOAT4OID:
+            *res = DatumGetFloat4(value);
+            return true;
+        case FLOAT8OID:
+            *res = DatumGetFloat8(value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+template <typename ArrayType>
+static bool
+filter_integer(const RowFilter &filter, const arrow::Array *array, uint8_t *sel)
+{
+    const auto *raw = static_cast<const ArrayType *>(array)->raw_values();
+    int64       len = array->length();
+    int64       dummy;
+
+    if (!filter.values.empty() && !integer_value(filter.valtype, filter.values[0], &dummy))
+        return false;
+
+    combine_values(filter, len, sel, [&](Datum value, uint8_t *out) {
+        int64   v;
+
+        integer_value(filter.valtype, value, &v);
+        compare_column<int64>(len, [raw](int64 i) { return (int64) raw[i]; },
+                              v, filter.strategy, filter.negate, out);
+    });
+    return true;
+}
+
+template <typename ArrayType>
+static bool
+filter_float(const RowFilter &filter, const arrow::Array *array, uint8_t *sel)
+{
+    const auto *raw = static_cast<const ArrayType *>(array)->raw_values();
+    int64       len = array->length();
+    double      dummy;
+
+    if (!filter.values.empty() && !float_value(filter.valtype, filter.values[0], &dummy))
+        return false;
+
+    combine_values(filter, len, sel, [&](Datum value, uint8_t *out) {
+        double  v;
+
+        float_value(filter.valtype, value, &v);
+        compare_column<double>(len, [raw](int64 i) { return (double) raw[i]; },
+                               v, filter.strategy, filter.negate, out);
+    });
+    return true;
+}
+
+static bool
+filter_bool(const RowFilter &filter, const arrow::Array *array, uint8_t *sel)
+{
+    auto   *boolarray = static_cast<const arrow::BooleanArray *>(array);
+    int64   len = array->length();
+
+    if (filter.valtype != BOOLOID)
+        return false;
+
+    combine_values(filter, len, sel, [&](Datum value, uint8_t *out) {
+        compare_column<int64>(len, [boolarray](int64 i) { return (int64) boolarray->Value(i); },
+                              (int64) DatumGetBool(value), filter.strategy,
+                              filter.negate, out);
+    });
+    return true;
+}
+
+static bool
+filter_date(const RowFilter &filter, const arrow::Array *array, uint8_t *sel)
+{
+    const int32_t *raw = static_cast<const arrow::Date32Array *>(array)->raw_values();
+    int64       len = array->length();
+
+    if (filter.valtype != DATEOID)
+        return false;
+
+    /* See read_primitive_type() for the conversion */
+    combine_values(filter, len, sel, [&](Datum value, uint8_t *out) {
+        compare_column<int64>(len,
+                              [raw](int64 i) {
+                                  return (int64) raw[i] + (UNIX_EPOCH_JDATE - POSTGRES_EPOCH_JDATE);
+                              },
+                              (int64) DatumGetDateADT(value), filter.strategy,
+                              filter.negate, out);
+    });
+    return true;
+}
+
+static bool
+filter_timestamp(const RowFilter &filter, const arrow::Array *array, uint8_t *sel)
+{
+    const int64_t *raw = static_cast<const arrow::TimestampArray *>(array)->raw_values();
+    auto        tstype = (arrow::TimestampType *) array->type().get();
+    int64       len = array->length();
+    std::vector<int64> keys(len);
+
+    if (filter.valtype != TIMESTAMPOID)
+        return false;
+
+    /* Convert once, the same way read_primitive_type() does */
+    for (int64 i = 0; i < len; i++)
+    {
+        TimestampTz ts;
+
+        to_postgres_timestamp(tstype, raw[i], ts);
+        keys[i] = ts;
+    }
+
+    combine_values(filter, len, sel, [&](Datum value, uint8_t *out) {
+        compare_column<int64>(len, [&keys](int64 i) { return keys[i]; },
+                              (int64) DatumGetTimestamp(value), filter.strategy,
+                              filter.negate, out);
+    });
+    return true;
+}
+
+/*
+ * compare_strings
+ *      Evaluate the filter for the values of a string or binary array. For
+ *      equality under a deterministic collation the bytes are compared
+ *      directly, otherwise the btree comparison function is called.
+ */
+static void
+compare_strings(const RowFilter &filter, const arrow::BinaryArray *array,
+                uint8_t *sel)
+{
+    int64       len = array->length();
+    bool        bytewise;
+    std::vector<char> buf;
+
+    bytewise = filter.strategy == BTEqualStrategyNumber &&
+               filter.valtype == to_postgres_type(array->type_id()) &&
+               (!OidIsValid(filter.collid) || get_collation_isdeterministic(filter.collid));
+
+    combine_values(filter, len, sel, [&](Datum value, uint8_t *out) {
+        if (bytewise)
+        {
+            struct varlena *v = (struct varlena *) DatumGetPointer(value);
+            const char *vdata = VARDATA_ANY(v);
+            int32_t     vlen = VARSIZE_ANY_EXHDR(v);
+
+            for (int64 i = 0; i < len; i++)
+            {
+                int32_t     l;
+                const uint8_t *s = array->GetValue(i, &l);
+
+                out[i] = (l == vlen && memcmp(s, vdata, l) == 0) != filter.negate;
+            }
+            return;
+        }
+
+        for (int64 i = 0; i < len; i++)
+        {
+            int32_t     l;
+            const uint8_t *s = array->GetValue(i, &l);
+            int         cmp;
+
+            /* Build a varlena in a scratch buffer */
+            buf.resize(l + VARHDRSZ);
+            SET_VARSIZE(buf.data(), l + VARHDRSZ);
+            memcpy(VARDATA(buf.data()), s, l);
+
+            cmp = DatumGetInt32(FunctionCall2Coll(filter.cmpfunc, filter.collid,
+                                                  PointerGetDatum(buf.data()),
+                                                  value));
+            switch (filter.strategy)
+            {
+                case BTLessStrategyNumber:
+                    out[i] = cmp < 0;
+                    break;
+                case BTLessEqualStrategyNumber:
+                    out[i] = cmp <= 0;
+                    break;
+                case BTEqualStrategyNumber:
+                    out[i] = (cmp == 0) != filter.negate;
+                    break;
+                case BTGreaterEqualStrategyNumber:
+                    out[i] = cmp >= 0;
+                    break;
+                case BTGreaterStrategyNumber:
+                    out[i] = cmp > 0;
+                    break;
+                default:
+                    out[i] = 1;
+            }
+        }
+    });
+}
+
+static bool
+filter_string(const RowFilter &filter, const arrow::Array *array, uint8_t *sel)
+{
+    bool        error = false;
+    char        errstr[ERROR_STR_LEN];
+    MemoryContext ccxt = CurrentMemoryContext;
+
+    if (filter.cmpfunc == NULL)
+        return false;
+
+    PG_TRY();
+    {
+        if (array->type_id() == arrow::Type::DICTIONARY)
+        {
+            /* Evaluate the dictionary once and look the rows up by index */
+            auto   *dictarray = static_cast<const arrow::DictionaryArray *>(array);
+            auto    dict = std::static_pointer_cast<arrow::BinaryArray>(dictarray->dictionary());
+            std::vector<uint8_t> dsel(dict->length(), 1);
+            int64   len = array->length();
+
+            compare_strings(filter, dict.get(), dsel.data());
+            for (int64 i = 0; i < len; i++)
+                sel[i] &= dsel[dictarray->GetValueIndex(i)];
+        }
+        else
+            compare_strings(filter, static_cast<const arrow::BinaryArray *>(array), sel);
+    }
+    PG_CATCH();
+    {
+        ErrorData *errdata;
+
+        MemoryContextSwitchTo(ccxt);
+        error = true;
+        errdata = CopyErrorData();
+        FlushErrorState();
+
+        strncpy(errstr, errdata->message, ERROR_STR_LEN - 1);
+        errstr[ERROR_STR_LEN - 1] = '\0';
+        FreeErrorData(errdata);
+    }
+    PG_END_TRY();
+    if (error)
+        throw std::runtime_error(errstr);
+
+    return true;
+}
+
+/*
+ * evaluate_row_filter
+ *      Clear sel[i] for every row i of the array which does not satisfy the
+ *      filter. coltype is the type of the foreign table column, which must be
+ *      the type the arrow values are read as without a cast. Returns false
+ *      (leaving sel untouched) if the filter cannot be evaluated natively.
+ */
+bool
+evaluate_row_filter(const RowFilter &filter, Oid coltype,
+                    const arrow::Array *array, uint8_t *sel)
+{
+    int64       len = array->length();
+    arrow::Type::type type_id = array->type_id();
+    bool        ok;
+
+    if (filter.unknown)
+        return false;
+
+    if (type_id == arrow::Type::DICTIONARY)
+        type_id = static_cast<const arrow::DictionaryType *>(array->type().get())
+                        ->value_type()->id();
+
+    if (coltype != to_postgres_type(type_id))
+        return false;
+
+    switch (filter.kind)
+    {
+        case RF_IS_NULL:
+            for (int64 i = 0; i < len; i++)
+                sel[i] &= array->IsNull(i);
+            return true;
+        case RF_IS_NOT_NULL:
+            if (array->null_count() > 0)
+                for (int64 i = 0; i < len; i++)
+                    sel[i] &= !array->IsNull(i);
+            return true;
+        case RF_COMPARE:
+            break;
+    }
+
+    switch (type_id)
+    {
+        case arrow::Type::BOOL:
+            ok = filter_bool(filter, array, sel);
+            break;
+        case arrow::Type::INT8:
+            ok = filter_integer<arrow::Int8Array>(filter, array, sel);
+            break;
+        case arrow::Type::INT16:
+            ok = filter_integer<arrow::Int16Array>(filter, array, sel);
+            break;
+        case arrow::Type::INT32:
+            ok = filter_integer<arrow::Int32Array>(filter, array, sel);
+            break;
+        case arrow::Type::INT64:
+            ok = filter_integer<arrow::Int64Array>(filter, array, sel);
+            break;
+        case arrow::Type::FLOAT:
+            ok = filter_float<arrow::FloatArray>(filter, array, sel);
+            break;
+        case arrow::Type::DOUBLE:
+            ok = filter_float<arrow::DoubleArray>(filter, array, sel);
+            break;
+        case arrow::Type::DATE32:
+            ok = filter_date(filter, array, sel);
+            break;
+        case arrow::Type::TIMESTAMP:
+            ok = filter_timestamp(filter, array, sel);
+            break;
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+            ok = filter_string(filter, array, sel);
+            break;
+        default:
+            return false;
+    }
+
+    /* Comparisons with NULL are never true */
+    if (ok && array->null_count() > 0)
+        for (int64 i = 0; i < len; i++)
+            if (array->IsNull(i))
+                sel[i] = 0;
+
+    return ok;
+}
+
+/*
+ * range_key
+ *      Represent value of an integer-like type as int64 for comparisons.
+ *      Floats are not handled as NaNs are not accounted in Parquet min/max
+ *      statistics.
+ */
+static bool
+range_key(Oid type, Datum value, int64 *key)
+{
+    switch (type)
+    {
+        case BOOLOID:
+            *key = DatumGetBool(value);
+            return true;
+        case DATEOID:
+            *key = DatumGetDateADT(value);
+            return true;
+        case TIMESTAMPOID:
+            *key = DatumGetTimestamp(value);
+            return true;
+        default:
+            return integer_value(type, value, key);
+    }
+}
+
+/*
+ * row_filter_matches_range
+ *      Check whether any value within [min, max] (row group statistics of
+ *      the column of coltype) may satisfy the filter. Only the filters
+ *      which evaluate_row_filter() can check natively are considered, for
+ *      the others true is returned.
+ */
+bool
+row_filter_matches_range(const RowFilter &filter, Oid coltype,
+                         Datum min, Datum max)
+{
+    int64       lo,
+                hi;
+    bool        res;
+
+    if (filter.unknown || filter.kind != RF_COMPARE)
+        return true;
+
+    if (!range_key(coltype, min, &lo) || !range_key(coltype, max, &hi))
+        return true;
+
+    /* Make sure the values are of the same kind as the column */
+    switch (coltype)
+    {
+        case BOOLOID:
+        case DATEOID:
+        case TIMESTAMPOID:
+            if (filter.valtype != coltype)
+                return true;
+            break;
+        default:
+            if (filter.valtype != INT2OID && filter.valtype != INT4OID &&
+                filter.valtype != INT8OID)
+                return true;
+    }
+
+    if (filter.has_null && !filter.use_or)
+        return false;
+
+    res = !filter.use_or;
+    for (Datum value : filter.values)
+    {
+        int64   v;
+        bool    match;
+
+        range_key(filter.valtype, value, &v);
+        switch (filter.strategy)
+        {
+            case BTLessStrategyNumber:
+                match = lo < v;
+                break;
+            case BTLessEqualStrategyNumber:
+                match = lo <= v;
+                break;
+            case BTEqualStrategyNumber:
+                if (filter.negate)
+                    match = !(lo == v && hi == v);
+                else
+                    match = lo <= v && v <= hi;
+                break;
+            case BTGreaterEqualStrategyNumber:
+                match = hi >= v;
+                break;
+            case BTGreaterStrategyNumber:
+                match = hi > v;
+                break;
+            default:
+                match = true;
+        }
+
+        if (filter.use_or && match)
+            return true;
+        if (!filter.use_or && !match)
+            return false;
+    }
+
+    return res;
+}